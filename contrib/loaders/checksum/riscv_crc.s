@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+	Works on both RV32 and RV64: only the low 32 bits of the CRC register
+	are meaningful, and the top bit is tested explicitly rather than through
+	the sign of the register.
+
+	parameters:
+	a0 - address in - crc out
+	a1 - byte count
+	a2..a5 - scratch
+*/
+
+	.text
+	.option norvc
+
+	.align	2
+
+_start:
+main:
+	mv		a2, a0
+	li		a0, -1
+	li		a3, 0x04c11db7
+	beqz	a1, done
+nbyte:
+	lbu		a4, 0(a2)
+	slli	a4, a4, 24
+	xor		a0, a0, a4
+	li		a5, 8
+loop:
+	srli	a4, a0, 31
+	andi	a4, a4, 1
+	slli	a0, a0, 1
+	beqz	a4, notset
+	xor		a0, a0, a3
+notset:
+	addi	a5, a5, -1
+	bnez	a5, loop
+	addi	a2, a2, 1
+	addi	a1, a1, -1
+	bnez	a1, nbyte
+done:
+	ebreak
+
+	.end
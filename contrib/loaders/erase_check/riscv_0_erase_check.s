@@ -0,0 +1,38 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+	parameters:
+	a0 - address in
+	a1 - byte count
+	a2 - mask - result out
+	a3 - scratch
+*/
+
+	.text
+	.option norvc
+
+	.align	2
+
+loop:
+	lbu		a3, 0(a0)
+	addi	a0, a0, 1
+	or		a2, a2, a3
+	addi	a1, a1, -1
+	bnez	a1, loop
+end:
+	ebreak
+
+	.end
@@ -296,6 +296,8 @@ static void cleanup_all_fds(void)
 static void process_remote_protocol(void)
 {
 	int c;
+	/* the last two writes, for the 'C<count>;' run-length request */
+	char last_write[2] = { 0, 0 };
 	while (1) {
 		c = getchar();
 		if (c == EOF || c == 'Q') /* Quit */
@@ -311,6 +313,22 @@ static void process_remote_protocol(void)
 			sysfsgpio_write(!!(d & 4),
 					!!(d & 2),
 					(d & 1));
+			last_write[0] = last_write[1];
+			last_write[1] = d;
+		} else if (c == 'C') { /* Repeat the last clock cycle */
+			unsigned count = 0;
+			while ((c = getchar()) >= '0' && c <= '9')
+				count = count * 10 + (c - '0');
+			if (c != ';') {
+				LOG_ERROR("Malformed run-length request");
+				break;
+			}
+			while (count--) {
+				for (int i = 0; i < 2; i++)
+					sysfsgpio_write(!!(last_write[i] & 4),
+							!!(last_write[i] & 2),
+							(last_write[i] & 1));
+			}
 		} else if (c == 'R')
 			putchar(sysfsgpio_read());
 		else
@@ -559,8 +559,138 @@ static int compare_section(const void *a, const void *b)
 		return -1;
 }
 
+/* Unlock and erase as requested, then program one contiguous run of a bank */
+static int flash_write_run(struct target *target, struct flash_bank *c,
+	uint8_t *buffer, uint32_t run_address, uint32_t run_size,
+	int erase, bool unlock)
+{
+	int retval = ERROR_OK;
+
+	if (unlock)
+		retval = flash_unlock_address_range(target, run_address, run_size);
+	if (retval == ERROR_OK) {
+		if (erase) {
+			/* calculate and erase sectors */
+			retval = flash_erase_address_range(target,
+					true, run_address, run_size);
+		}
+	}
+
+	if (retval == ERROR_OK) {
+		/* write flash sectors */
+		retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+	}
+
+	return retval;
+}
+
+/* Compare image data against the flash contents by CRC, computed on the
+ * target where possible.  Failing to checksum counts as a mismatch. */
+static bool flash_range_matches(struct target *target, uint8_t *buffer,
+	uint32_t address, uint32_t size)
+{
+	uint32_t target_crc, image_crc;
+
+	if (target_checksum_memory(target, address, size, &target_crc) != ERROR_OK)
+		return false;
+	if (image_calculate_checksum(buffer, size, &image_crc) != ERROR_OK)
+		return false;
+
+	return target_crc == image_crc;
+}
+
+/* Like flash_write_run(), but only unlock, erase and program the sectors
+ * whose contents differ from the image.  Consecutive differing sectors
+ * are programmed together. */
+static int flash_write_run_diff(struct target *target, struct flash_bank *c,
+	uint8_t *buffer, uint32_t run_address, uint32_t run_size,
+	int erase, bool unlock, uint32_t *written)
+{
+	/* Unchanged firmware is the common case, check the whole run first */
+	if (flash_range_matches(target, buffer, run_address, run_size)) {
+		LOG_INFO("flash at 0x%8.8" PRIx32 " already holds the image data, "
+			"skipping %" PRIu32 " bytes", run_address, run_size);
+		return ERROR_OK;
+	}
+
+	uint32_t run_start = run_address - c->base;
+	uint32_t run_end = run_start + run_size;
+	uint32_t dirty_start = 0, dirty_end = 0;
+	uint32_t dirty_total = 0;
+	int retval = ERROR_OK;
+
+	/* Without sectors covering all of the run there is nothing to compare
+	 * the uncovered part against, so program the whole run */
+	uint32_t covered = 0;
+	for (int sector = 0; sector < c->num_sectors; sector++) {
+		uint32_t start = MAX(c->sectors[sector].offset, run_start);
+		uint32_t end = MIN(c->sectors[sector].offset + c->sectors[sector].size, run_end);
+		if (start < end)
+			covered += end - start;
+	}
+	if (covered != run_size) {
+		LOG_DEBUG("diff: sectors don't cover the run, programming all of it");
+		retval = flash_write_run(target, c, buffer, run_address, run_size,
+				erase, unlock);
+		if (retval == ERROR_OK && written != NULL)
+			*written += run_size;
+		return retval;
+	}
+
+	for (int sector = 0; sector <= c->num_sectors; sector++) {
+		bool same = true;
+		uint32_t start = 0, end = 0;
+
+		if (sector < c->num_sectors) {
+			start = MAX(c->sectors[sector].offset, run_start);
+			end = MIN(c->sectors[sector].offset + c->sectors[sector].size, run_end);
+			if (start >= end)
+				continue;
+
+			same = flash_range_matches(target, buffer + start - run_start,
+					c->base + start, end - start);
+			if (!same) {
+				if (dirty_end == 0)
+					dirty_start = start;
+				dirty_end = end;
+				continue;
+			}
+		}
+
+		/* program the differing sectors collected so far */
+		if (dirty_end != 0) {
+			LOG_DEBUG("diff: programming 0x%8.8" PRIx32 " - 0x%8.8" PRIx32,
+				c->base + dirty_start, c->base + dirty_end - 1);
+			retval = flash_write_run(target, c, buffer + dirty_start - run_start,
+					c->base + dirty_start, dirty_end - dirty_start,
+					erase, unlock);
+			if (retval != ERROR_OK)
+				return retval;
+
+			dirty_total += dirty_end - dirty_start;
+			if (written != NULL)
+				*written += dirty_end - dirty_start;
+			dirty_end = 0;
+		}
+	}
+
+	/* Every sector has been compared, so if none differed the check of
+	 * the whole run must have failed on its own */
+	if (dirty_total == 0) {
+		LOG_INFO("flash at 0x%8.8" PRIx32 " already holds the image data, "
+			"skipping %" PRIu32 " bytes", run_address, run_size);
+		return ERROR_OK;
+	}
+
+	LOG_INFO("flash at 0x%8.8" PRIx32 ": programmed %" PRIu32 " of %" PRIu32
+		" bytes, the rest already held the image data",
+		run_address, dirty_total, run_size);
+
+	return retval;
+}
+
 int flash_write_unlock(struct target *target, struct image *image,
-	uint32_t *written, int erase, bool unlock)
+	uint32_t *written, int erase, bool unlock, bool diff_only)
 {
 	int retval = ERROR_OK;
 
@@ -694,14 +824,35 @@ int flash_write_unlock(struct target *target, struct image *image,
 			run_size += delta;
 		}
 
+		/* A run that is a plain piece of one section is written straight
+		 * from the image data, e.g. a mapped file, without a copy. */
+		bool buffer_owned = true;
+		buffer = NULL;
+		if (section_last == section && padding[section] == 0 &&
+				run_size <= sections[section]->size - section_offset) {
+			intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+			int t_section_num = diff / sizeof(struct imagesection);
+
+			buffer = image_section_data(image, t_section_num, section_offset, run_size);
+			if (buffer) {
+				buffer_owned = false;
+				section_offset += run_size;
+				if (section_offset >= sections[section]->size) {
+					section++;
+					section_offset = 0;
+				}
+			}
+		}
+
 		/* allocate buffer */
-		buffer = malloc(run_size);
+		if (buffer_owned)
+			buffer = malloc(run_size);
 		if (buffer == NULL) {
 			LOG_ERROR("Out of memory for flash bank buffer");
 			retval = ERROR_FAIL;
 			goto done;
 		}
-		buffer_size = 0;
+		buffer_size = buffer_owned ? 0 : run_size;
 
 		/* read sections to the buffer */
 		while (buffer_size < run_size) {
@@ -743,32 +894,23 @@ int flash_write_unlock(struct target *target, struct image *image,
 			}
 		}
 
-		retval = ERROR_OK;
-
-		if (unlock)
-			retval = flash_unlock_address_range(target, run_address, run_size);
-		if (retval == ERROR_OK) {
-			if (erase) {
-				/* calculate and erase sectors */
-				retval = flash_erase_address_range(target,
-						true, run_address, run_size);
-			}
-		}
-
-		if (retval == ERROR_OK) {
-			/* write flash sectors */
-			retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+		if (diff_only) {
+			retval = flash_write_run_diff(target, c, buffer, run_address,
+					run_size, erase, unlock, written);
+		} else {
+			retval = flash_write_run(target, c, buffer, run_address,
+					run_size, erase, unlock);
+			if (retval == ERROR_OK && written != NULL)
+				*written += run_size;	/* add run size to total written counter */
 		}
 
-		free(buffer);
+		if (buffer_owned)
+			free(buffer);
 
 		if (retval != ERROR_OK) {
 			/* abort operation */
 			goto done;
 		}
-
-		if (written != NULL)
-			*written += run_size;	/* add run size to total written counter */
 	}
 
 done:
@@ -781,7 +923,7 @@ done:
 int flash_write(struct target *target, struct image *image,
 	uint32_t *written, int erase)
 {
-	return flash_write_unlock(target, image, written, erase, false);
+	return flash_write_unlock(target, image, written, erase, false, false);
 }
 
 struct flash_sector *alloc_block_array(uint32_t offset, uint32_t size, int num_blocks)
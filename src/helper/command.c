@@ -129,7 +129,7 @@ extern struct command_context *global_cmd_ctx;
 void script_debug(Jim_Interp *interp, const char *name,
 	unsigned argc, Jim_Obj * const *argv)
 {
-	if (debug_level < LOG_LVL_DEBUG)
+	if (!LOG_LEVEL_ENABLED(LOG_LVL_DEBUG))
 		return;
 
 	char *dbg = alloc_printf("command - %s", name);
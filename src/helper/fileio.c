@@ -30,16 +30,28 @@
 #include "configuration.h"
 #include "fileio.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 struct fileio {
 	char *url;
 	size_t size;
 	enum fileio_type type;
 	enum fileio_access access;
 	FILE *file;
+	uint8_t *map;		/* see fileio_map() */
 };
 
 static inline int fileio_close_local(struct fileio *fileio)
 {
+#ifdef HAVE_SYS_MMAN_H
+	if (fileio->map) {
+		munmap(fileio->map, fileio->size);
+		fileio->map = NULL;
+	}
+#endif
+
 	int retval = fclose(fileio->file);
 	if (retval != 0) {
 		if (retval == EBADF)
@@ -127,6 +139,7 @@ int fileio_open(struct fileio **fileio, const char *url,
 	tmp->type = type;
 	tmp->access = access_type;
 	tmp->url = strdup(url);
+	tmp->map = NULL;
 
 	retval = fileio_open_local(tmp);
 
@@ -252,6 +265,39 @@ int fileio_write_u32(struct fileio *fileio, uint32_t data)
 	return retval;
 }
 
+/**
+ * Map the whole contents of a file opened with FILEIO_READ into memory, so
+ * that it can be used without copying it through fileio_read(). The mapping
+ * is private: writes to it are allowed but never reach the file. It stays
+ * valid until fileio_close().
+ *
+ * Returns ERROR_FILEIO_OPERATION_NOT_SUPPORTED where mapping is not
+ * possible, e.g. for empty files or on hosts without mmap(); callers are
+ * expected to fall back to fileio_read() then.
+ */
+int fileio_map(struct fileio *fileio, uint8_t **data)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!fileio->map) {
+		if (fileio->access != FILEIO_READ || fileio->size == 0)
+			return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+
+		void *map = mmap(NULL, fileio->size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE, fileno(fileio->file), 0);
+		if (map == MAP_FAILED) {
+			LOG_DEBUG("couldn't map %s: %s", fileio->url, strerror(errno));
+			return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+		}
+		fileio->map = map;
+	}
+
+	*data = fileio->map;
+	return ERROR_OK;
+#else
+	return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+#endif
+}
+
 /**
  * FIX!!!!
  *
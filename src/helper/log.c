@@ -32,6 +32,10 @@
 
 #include <stdarg.h>
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifdef _DEBUG_FREE_SPACE_
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
@@ -41,6 +45,7 @@
 #endif
 
 int debug_level = -1;
+int log_level_max = -1;
 
 static FILE *log_output;
 static struct log_callback *log_callbacks;
@@ -61,6 +66,46 @@ static const char * const log_strings[6] = {
 
 static int count;
 
+enum log_format {
+	LOG_FORMAT_DEFAULT,
+	LOG_FORMAT_COMPACT,
+};
+
+static enum log_format log_format;
+
+/* Subsystems can get a log level of their own, which overrides debug_level
+ * for the messages from their source files; e.g. debugging only the JTAG
+ * layer doesn't slow down everything else. */
+static const struct {
+	const char *name;
+	const char *path;
+} log_subsystems[] = {
+	{ .name = "jtag", .path = "/jtag/" },
+	{ .name = "target", .path = "/target/" },
+	{ .name = "flash", .path = "/flash/" },
+	{ .name = "gdb", .path = "/server/gdb_server." },
+	{ .name = "rtos", .path = "/rtos/" },
+};
+
+static int log_subsystem_level[ARRAY_SIZE(log_subsystems)];
+static bool log_subsystem_level_set[ARRAY_SIZE(log_subsystems)];
+static bool log_subsystem_levels_set;	/* any of the above */
+
+/* With "log_async on", log output is copied into this ring buffer and
+ * written out by a separate thread, so that the code which logs waits
+ * neither for the write nor for the flush. There is one producer, the
+ * main thread, and one consumer, so each index has a single writer. */
+#define LOG_RING_SIZE		(1024 * 1024)
+#define LOG_WRITER_POLL_US	(10 * 1000)
+
+static char *log_ring;
+static size_t log_ring_head;	/* advanced by the main thread */
+static size_t log_ring_tail;	/* advanced by the writer thread */
+#ifdef HAVE_PTHREAD_H
+static bool log_writer_stop;
+static pthread_t log_writer;
+#endif
+
 static struct store_log_forward *log_head;
 static int log_forward_count;
 
@@ -104,6 +149,186 @@ static void log_forward(const char *file, unsigned line, const char *function, c
 	}
 }
 
+/* Write to the log output, or queue for the writer thread. */
+static void log_write(const char *string, size_t len)
+{
+	if (log_ring == NULL) {
+		fwrite(string, 1, len, log_output);
+		return;
+	}
+
+	while (len > 0) {
+		size_t head = log_ring_head;
+		size_t tail = __atomic_load_n(&log_ring_tail, __ATOMIC_ACQUIRE);
+		size_t pos = head % LOG_RING_SIZE;
+		size_t chunk = MIN(len, LOG_RING_SIZE - (head - tail));
+
+		if (chunk == 0) {
+			/* rather wait for the writer than lose messages */
+			usleep(1000);
+			continue;
+		}
+
+		chunk = MIN(chunk, LOG_RING_SIZE - pos);
+		memcpy(log_ring + pos, string, chunk);
+		__atomic_store_n(&log_ring_head, head + chunk, __ATOMIC_RELEASE);
+
+		string += chunk;
+		len -= chunk;
+	}
+}
+
+static void log_flush(void)
+{
+	/* the writer thread flushes whenever it has caught up */
+	if (log_ring == NULL)
+		fflush(log_output);
+}
+
+/* Wait until the writer thread has written out everything queued so far. */
+static void log_drain(void)
+{
+	while (log_ring &&
+			__atomic_load_n(&log_ring_tail, __ATOMIC_ACQUIRE) != log_ring_head)
+		usleep(1000);
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *log_writer_thread(void *arg)
+{
+	size_t tail = log_ring_tail;
+
+	for (;;) {
+		size_t head = __atomic_load_n(&log_ring_head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			if (__atomic_load_n(&log_writer_stop, __ATOMIC_ACQUIRE))
+				break;
+			usleep(LOG_WRITER_POLL_US);
+			continue;
+		}
+
+		while (tail != head) {
+			size_t pos = tail % LOG_RING_SIZE;
+			size_t chunk = MIN(head - tail, LOG_RING_SIZE - pos);
+
+			fwrite(log_ring + pos, 1, chunk, log_output);
+			tail += chunk;
+		}
+		fflush(log_output);
+
+		__atomic_store_n(&log_ring_tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+#endif
+
+static void log_async_stop(void)
+{
+#ifdef HAVE_PTHREAD_H
+	if (log_ring == NULL)
+		return;
+
+	/* the writer drains the ring before it stops */
+	__atomic_store_n(&log_writer_stop, true, __ATOMIC_RELEASE);
+	pthread_join(log_writer, NULL);
+
+	free(log_ring);
+	log_ring = NULL;
+#endif
+}
+
+static int log_async_start(void)
+{
+#ifdef HAVE_PTHREAD_H
+	static bool registered;
+
+	if (log_ring)
+		return ERROR_OK;
+
+	log_ring = malloc(LOG_RING_SIZE);
+	if (log_ring == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	fflush(log_output);
+	log_ring_head = 0;
+	log_ring_tail = 0;
+	log_writer_stop = false;
+	if (pthread_create(&log_writer, NULL, log_writer_thread, NULL) != 0) {
+		free(log_ring);
+		log_ring = NULL;
+		LOG_ERROR("couldn't start the log writer thread");
+		return ERROR_FAIL;
+	}
+
+	/* don't lose the tail of the log when OpenOCD exits */
+	if (!registered) {
+		atexit(log_async_stop);
+		registered = true;
+	}
+
+	return ERROR_OK;
+#else
+	LOG_ERROR("asynchronous logging is not supported on this host");
+	return ERROR_FAIL;
+#endif
+}
+
+/* Subsystem of a source file, or -1. The lookup is cached per file name
+ * pointer, which is the same for all messages from one file. */
+static int log_file_subsystem(const char *file)
+{
+	static struct {
+		const char *file;
+		int subsystem;
+	} cache[64];
+	unsigned i = ((uintptr_t)file >> 3) % ARRAY_SIZE(cache);
+
+	if (cache[i].file != file) {
+		cache[i].file = file;
+		cache[i].subsystem = -1;
+		for (unsigned j = 0; j < ARRAY_SIZE(log_subsystems); j++) {
+			if (strstr(file, log_subsystems[j].path)) {
+				cache[i].subsystem = j;
+				break;
+			}
+		}
+	}
+
+	return cache[i].subsystem;
+}
+
+bool log_level_enabled(enum log_levels level, const char *file)
+{
+	int limit = debug_level;
+
+	if (log_subsystem_levels_set) {
+		int subsystem = log_file_subsystem(file);
+		if (subsystem >= 0 && log_subsystem_level_set[subsystem])
+			limit = log_subsystem_level[subsystem];
+	}
+
+	return level <= limit;
+}
+
+/* log_level_max gates the LOG_* macros, so it must cover every level in use */
+static void log_update_level_max(void)
+{
+	log_level_max = debug_level;
+	log_subsystem_levels_set = false;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(log_subsystems); i++) {
+		if (!log_subsystem_level_set[i])
+			continue;
+		log_subsystem_levels_set = true;
+		if (log_subsystem_level[i] > log_level_max)
+			log_level_max = log_subsystem_level[i];
+	}
+}
+
 /* The log_puts() serves two somewhat different goals:
  *
  * - logging
@@ -123,8 +348,8 @@ static void log_puts(enum log_levels level,
 	char *f;
 	if (level == LOG_LVL_OUTPUT) {
 		/* do not prepend any headers, just print out what we were given and return */
-		fputs(string, log_output);
-		fflush(log_output);
+		log_write(string, strlen(string));
+		log_flush();
 		return;
 	}
 
@@ -133,34 +358,44 @@ static void log_puts(enum log_levels level,
 		file = f + 1;
 
 	if (strlen(string) > 0) {
-		if (debug_level >= LOG_LVL_DEBUG) {
+		char header[256];
+		int len;
+
+		if (log_level_max >= LOG_LVL_DEBUG) {
 			/* print with count and time information */
 			int64_t t = timeval_ms() - start;
 #ifdef _DEBUG_FREE_SPACE_
 			struct mallinfo info;
 			info = mallinfo();
 #endif
-			fprintf(log_output, "%s%d %" PRId64 " %s:%d %s()"
+			if (log_format == LOG_FORMAT_COMPACT)
+				len = snprintf(header, sizeof(header), "%c %" PRId64 " %s:%d: ",
+					"UEWIDD"[level + 1], t, file, line);
+			else
+				len = snprintf(header, sizeof(header), "%s%d %" PRId64 " %s:%d %s()"
 #ifdef _DEBUG_FREE_SPACE_
-				" %d"
+					" %d"
 #endif
-				": %s", log_strings[level + 1], count, t, file, line, function,
+					": ", log_strings[level + 1], count, t, file, line, function
 #ifdef _DEBUG_FREE_SPACE_
-				info.fordblks,
+					, info.fordblks
 #endif
-				string);
+					);
 		} else {
 			/* if we are using gdb through pipes then we do not want any output
 			 * to the pipe otherwise we get repeated strings */
-			fprintf(log_output, "%s%s",
-				(level > LOG_LVL_USER) ? log_strings[level + 1] : "", string);
+			len = snprintf(header, sizeof(header), "%s",
+				(level > LOG_LVL_USER) ? log_strings[level + 1] : "");
 		}
+
+		log_write(header, MIN((size_t)len, sizeof(header) - 1));
+		log_write(string, strlen(string));
 	} else {
 		/* Empty strings are sent to log callbacks to keep e.g. gdbserver alive, here we do
 		 *nothing. */
 	}
 
-	fflush(log_output);
+	log_flush();
 
 	/* Never forward LOG_LVL_DEBUG, too verbose and they can be found in the log if need be */
 	if (level <= LOG_LVL_INFO)
@@ -178,7 +413,7 @@ void log_printf(enum log_levels level,
 	va_list ap;
 
 	count++;
-	if (level > debug_level)
+	if (!log_level_enabled(level, file))
 		return;
 
 	va_start(ap, format);
@@ -199,7 +434,7 @@ void log_vprintf_lf(enum log_levels level, const char *file, unsigned line,
 
 	count++;
 
-	if (level > debug_level)
+	if (!log_level_enabled(level, file))
 		return;
 
 	tmp = alloc_vprintf(format, args);
@@ -240,6 +475,7 @@ COMMAND_HANDLER(handle_debug_level_command)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 		}
 		debug_level = new_level;
+		log_update_level_max();
 	} else if (CMD_ARGC > 1)
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
@@ -256,6 +492,8 @@ COMMAND_HANDLER(handle_log_output_command)
 			LOG_ERROR("failed to open output log '%s'", CMD_ARGV[0]);
 			return ERROR_FAIL;
 		}
+		/* the writer thread may still be busy with the previous file */
+		log_drain();
 		if (log_output != stderr && log_output != NULL) {
 			/* Close previous log file, if it was open and wasn't stderr. */
 			fclose(log_output);
@@ -266,6 +504,97 @@ COMMAND_HANDLER(handle_log_output_command)
 	return ERROR_OK;
 }
 
+static void log_print_subsystem_level(struct command_context *cmd_ctx, unsigned i)
+{
+	if (log_subsystem_level_set[i])
+		command_print(cmd_ctx, "%s: %i", log_subsystems[i].name, log_subsystem_level[i]);
+	else
+		command_print(cmd_ctx, "%s: default", log_subsystems[i].name);
+}
+
+COMMAND_HANDLER(handle_log_subsystem_command)
+{
+	unsigned i;
+
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 0) {
+		for (i = 0; i < ARRAY_SIZE(log_subsystems); i++)
+			log_print_subsystem_level(CMD_CTX, i);
+		return ERROR_OK;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(log_subsystems); i++)
+		if (strcmp(CMD_ARGV[0], log_subsystems[i].name) == 0)
+			break;
+	if (i == ARRAY_SIZE(log_subsystems)) {
+		LOG_ERROR("unknown subsystem '%s'", CMD_ARGV[0]);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (CMD_ARGC == 2) {
+		if (strcmp(CMD_ARGV[1], "default") == 0)
+			log_subsystem_level_set[i] = false;
+		else {
+			int new_level;
+			COMMAND_PARSE_NUMBER(int, CMD_ARGV[1], new_level);
+			if ((new_level > LOG_LVL_DEBUG_IO) || (new_level < LOG_LVL_SILENT)) {
+				LOG_ERROR("level must be between %d and %d", LOG_LVL_SILENT, LOG_LVL_DEBUG_IO);
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			}
+			log_subsystem_level[i] = new_level;
+			log_subsystem_level_set[i] = true;
+		}
+		log_update_level_max();
+	}
+
+	log_print_subsystem_level(CMD_CTX, i);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_log_async_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		bool enable;
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], enable);
+		if (enable) {
+			int retval = log_async_start();
+			if (retval != ERROR_OK)
+				return retval;
+		} else
+			log_async_stop();
+	}
+
+	command_print(CMD_CTX, "log_async: %s", log_ring ? "on" : "off");
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_log_format_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "default") == 0)
+			log_format = LOG_FORMAT_DEFAULT;
+		else if (strcmp(CMD_ARGV[0], "compact") == 0)
+			log_format = LOG_FORMAT_COMPACT;
+		else
+			return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	command_print(CMD_CTX, "log_format: %s",
+			log_format == LOG_FORMAT_COMPACT ? "compact" : "default");
+
+	return ERROR_OK;
+}
+
 static struct command_registration log_command_handlers[] = {
 	{
 		.name = "log_output",
@@ -284,6 +613,30 @@ static struct command_registration log_command_handlers[] = {
 			"4 adds extra verbose debugging.",
 		.usage = "number",
 	},
+	{
+		.name = "log_subsystem",
+		.handler = handle_log_subsystem_command,
+		.mode = COMMAND_ANY,
+		.help = "Sets the verbosity level of one subsystem "
+			"(jtag, target, flash, gdb, rtos), overriding debug_level. "
+			"Without arguments, lists the levels of all subsystems.",
+		.usage = "[subsystem [number|'default']]",
+	},
+	{
+		.name = "log_async",
+		.handler = handle_log_async_command,
+		.mode = COMMAND_ANY,
+		.help = "Write the log from a separate thread, so that "
+			"logging doesn't stall the code that logs.",
+		.usage = "['on'|'off']",
+	},
+	{
+		.name = "log_format",
+		.handler = handle_log_format_command,
+		.mode = COMMAND_ANY,
+		.help = "Select the format of debug log lines.",
+		.usage = "['default'|'compact']",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -312,11 +665,14 @@ void log_init(void)
 	if (log_output == NULL)
 		log_output = stderr;
 
+	log_update_level_max();
+
 	start = last_time = timeval_ms();
 }
 
 int set_log_output(struct command_context *cmd_ctx, FILE *output)
 {
+	log_drain();
 	log_output = output;
 	return ERROR_OK;
 }
@@ -98,23 +98,32 @@ char *alloc_vprintf(const char *fmt, va_list ap);
 char *alloc_printf(const char *fmt, ...);
 
 extern int debug_level;
+/* highest level enabled by debug_level or any log_subsystem setting */
+extern int log_level_max;
 
 /* Avoid fn call and building parameter list if we're not outputting the information.
  * Matters on feeble CPUs for DEBUG/INFO statements that are involved frequently */
 
-#define LOG_LEVEL_IS(FOO)  ((debug_level) >= (FOO))
+#define LOG_LEVEL_IS(FOO)  ((log_level_max) >= (FOO))
+
+/* whether messages of this level from this source file get logged, taking
+ * log_subsystem levels into account */
+bool log_level_enabled(enum log_levels level, const char *file);
+
+#define LOG_LEVEL_ENABLED(FOO) \
+	(LOG_LEVEL_IS(FOO) && log_level_enabled(FOO, __FILE__))
 
 #define LOG_DEBUG_IO(expr ...) \
 	do { \
-		if (debug_level >= LOG_LVL_DEBUG_IO) \
-			log_printf_lf(LOG_LVL_DEBUG, \
+		if (log_level_max >= LOG_LVL_DEBUG_IO) \
+			log_printf_lf(LOG_LVL_DEBUG_IO, \
 				__FILE__, __LINE__, __func__, \
 				expr); \
 	} while (0)
 
 #define LOG_DEBUG(expr ...) \
 	do { \
-		if (debug_level >= LOG_LVL_DEBUG) \
+		if (log_level_max >= LOG_LVL_DEBUG) \
 			log_printf_lf(LOG_LVL_DEBUG, \
 				__FILE__, __LINE__, __func__, \
 				expr); \
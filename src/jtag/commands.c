@@ -36,12 +36,22 @@
 struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
+	size_t size;
 	size_t used;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
+/* Number of standard-sized pages kept across queue resets. The queue memory
+ * is reused as an arena: resetting the queue only rewinds the pages. */
+#define CMD_QUEUE_KEEP_PAGES 4
 static struct cmd_queue_page *cmd_queue_pages;
 static struct cmd_queue_page *cmd_queue_pages_tail;
+/* page allocations are currently served from */
+static struct cmd_queue_page *cmd_queue_cur_page;
+/* bytes handed out since the last reset */
+static size_t cmd_queue_used;
+
+static struct cmd_queue_stats cmd_queue_stats;
 
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
@@ -62,8 +72,7 @@ void jtag_queue_command(struct jtag_command *cmd)
 
 void *cmd_queue_alloc(size_t size)
 {
-	struct cmd_queue_page **p_page = &cmd_queue_pages;
-	int offset;
+	size_t offset;
 	uint8_t *t;
 
 	/*
@@ -98,42 +107,76 @@ void *cmd_queue_alloc(size_t size)
 	size = (size + ALIGN_SIZE - 1) & (~(ALIGN_SIZE - 1));
 	/* Done... */
 
-	if (*p_page) {
-		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
-			p_page = &((*p_page)->next);
-	}
+	/* pages past the current one have been rewound, so skip forward to
+	 * the first one with enough room */
+	struct cmd_queue_page *page = cmd_queue_cur_page;
+	while (page && page->size - page->used < size)
+		page = page->next;
 
-	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
-		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
+	if (!page) {
+		page = malloc(sizeof(struct cmd_queue_page));
+		page->used = 0;
+		page->size = (size < CMD_QUEUE_PAGE_SIZE) ?
 					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
-		(*p_page)->next = NULL;
-		cmd_queue_pages_tail = *p_page;
+		page->address = malloc(page->size);
+		page->next = NULL;
+		if (cmd_queue_pages_tail)
+			cmd_queue_pages_tail->next = page;
+		else
+			cmd_queue_pages = page;
+		cmd_queue_pages_tail = page;
+		cmd_queue_stats.page_mallocs++;
 	}
+	cmd_queue_cur_page = page;
 
-	offset = (*p_page)->used;
-	(*p_page)->used += size;
+	offset = page->used;
+	page->used += size;
 
-	t = (*p_page)->address;
+	cmd_queue_used += size;
+	cmd_queue_stats.allocs++;
+	cmd_queue_stats.bytes += size;
+	if (cmd_queue_used > cmd_queue_stats.high_water)
+		cmd_queue_stats.high_water = cmd_queue_used;
+
+	t = page->address;
 	return t + offset;
 }
 
+/* Rewind all pages for the next queue. Oversized pages and pages beyond
+ * CMD_QUEUE_KEEP_PAGES are given back. */
 static void cmd_queue_free(void)
 {
 	struct cmd_queue_page *page = cmd_queue_pages;
+	struct cmd_queue_page **p_next = &cmd_queue_pages;
+	unsigned kept = 0;
 
+	cmd_queue_pages_tail = NULL;
 	while (page) {
-		struct cmd_queue_page *last = page;
-		free(page->address);
-		page = page->next;
-		free(last);
+		struct cmd_queue_page *next = page->next;
+
+		if (page->size == CMD_QUEUE_PAGE_SIZE && kept < CMD_QUEUE_KEEP_PAGES) {
+			page->used = 0;
+			*p_next = page;
+			p_next = &page->next;
+			cmd_queue_pages_tail = page;
+			kept++;
+		} else {
+			free(page->address);
+			free(page);
+		}
+		page = next;
 	}
+	*p_next = NULL;
 
-	cmd_queue_pages = NULL;
-	cmd_queue_pages_tail = NULL;
+	cmd_queue_cur_page = cmd_queue_pages;
+	cmd_queue_used = 0;
+	cmd_queue_stats.resets++;
+	cmd_queue_stats.pages = kept;
+}
+
+void cmd_queue_get_stats(struct cmd_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
 }
 
 void jtag_command_queue_reset(void)
@@ -163,7 +163,18 @@ struct jtag_command {
 /** The current queue of jtag_command_s structures. */
 extern struct jtag_command *jtag_command_queue;
 
+/** Counters of the command queue allocator, see cmd_queue_get_stats(). */
+struct cmd_queue_stats {
+	uint64_t allocs;	/**< cmd_queue_alloc() calls */
+	uint64_t bytes;		/**< bytes handed out, after alignment */
+	uint64_t resets;	/**< queue resets */
+	uint64_t page_mallocs;	/**< pages obtained from malloc() */
+	size_t high_water;	/**< most bytes used by a single queue */
+	unsigned pages;		/**< pages kept for reuse */
+};
+
 void *cmd_queue_alloc(size_t size);
+void cmd_queue_get_stats(struct cmd_queue_stats *stats);
 
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
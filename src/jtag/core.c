@@ -843,7 +843,7 @@ int default_interface_jtag_execute_queue(void)
 	// TODO: I like these better than some of the other JTAG debug statements,
 	// but having both is silly.
 	struct jtag_command *cmd = jtag_command_queue;
-	while (debug_level >= LOG_LVL_DEBUG && cmd) {
+	while (LOG_LEVEL_ENABLED(LOG_LVL_DEBUG) && cmd) {
 		switch (cmd->type) {
 			case JTAG_SCAN:
 #if 0
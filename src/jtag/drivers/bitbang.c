@@ -185,15 +185,104 @@ static void bitbang_stableclocks(int num_cycles)
 	}
 }
 
-static void bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
-		unsigned scan_size)
+/* A scan whose TDO samples may still be sitting in the interface's buffer.
+ * Interfaces with buf_size != 0 get all scans of one queue pipelined; the
+ * samples are read back in bulk once buf_size of them are outstanding, or
+ * at the end of the queue, and only then handed to jtag_read_buffer(). */
+struct bitbang_pending_scan {
+	struct scan_command *command;
+	uint8_t *buffer;
+	unsigned sampled;	/* bits for which sample() has been issued */
+	unsigned read;		/* bits already fetched with read_sample() */
+	bool complete;		/* all bits have been clocked */
+};
+
+static struct bitbang_pending_scan *pending_scans;
+static unsigned pending_scan_count;
+static unsigned pending_scan_alloc;
+/* Number of samples issued but not yet read back. */
+static size_t pending_samples;
+
+static struct bitbang_pending_scan *bitbang_add_pending_scan(
+		struct scan_command *command, uint8_t *buffer)
+{
+	if (pending_scan_count == pending_scan_alloc) {
+		unsigned alloc = pending_scan_alloc ? pending_scan_alloc * 2 : 16;
+		struct bitbang_pending_scan *p = realloc(pending_scans, alloc * sizeof(*p));
+		if (!p) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		pending_scans = p;
+		pending_scan_alloc = alloc;
+	}
+
+	struct bitbang_pending_scan *p = &pending_scans[pending_scan_count++];
+	p->command = command;
+	p->buffer = buffer;
+	p->sampled = 0;
+	p->read = 0;
+	p->complete = false;
+	return p;
+}
+
+/**
+ * Read back every outstanding TDO sample and hand completed scans to
+ * jtag_read_buffer(). A scan that is still being clocked stays queued.
+ */
+static int bitbang_read_pending_samples(void)
+{
+	int retval = ERROR_OK;
+	unsigned i;
+
+	for (i = 0; i < pending_scan_count; i++) {
+		struct bitbang_pending_scan *p = &pending_scans[i];
+
+		for (; p->read < p->sampled; p->read++) {
+			unsigned bit = p->read;
+			if (bitbang_interface->read_sample())
+				p->buffer[bit/8] |= 1 << (bit % 8);
+			else
+				p->buffer[bit/8] &= ~(1 << (bit % 8));
+		}
+
+		if (!p->complete)
+			break;
+
+		if (jtag_read_buffer(p->buffer, p->command) != ERROR_OK)
+			retval = ERROR_JTAG_QUEUE_FAILED;
+		free(p->buffer);
+	}
+
+	/* only the scan currently being clocked can be left over */
+	if (i < pending_scan_count) {
+		pending_scans[0] = pending_scans[i];
+		pending_scan_count = 1;
+	} else
+		pending_scan_count = 0;
+	pending_samples = 0;
+
+	return retval;
+}
+
+static int bitbang_flush(void)
+{
+	if (bitbang_interface->flush)
+		return bitbang_interface->flush();
+	return ERROR_OK;
+}
+
+/**
+ * Clock a scan through the TAP. With @a pipelined set, the scan must be the
+ * last entry of pending_scans and its TDO bits are only requested with
+ * sample(); otherwise they are read synchronously into @a buffer.
+ */
+static int bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
+		unsigned scan_size, bool pipelined)
 {
 	tap_state_t saved_end_state = tap_get_end_state();
-#if BUILD_RISCV == 1
 	unsigned bit_cnt;
-#else
-	int bit_cnt;
-#endif
+	int retval = ERROR_OK;
 
 	if (!((!ir_scan &&
 			(tap_get_state() == TAP_DRSHIFT)) ||
@@ -207,13 +296,7 @@ static void bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		bitbang_end_state(saved_end_state);
 	}
 
-#if BUILD_RISCV == 1
-	size_t buffered = 0;
-#endif
 	for (bit_cnt = 0; bit_cnt < scan_size; bit_cnt++) {
-#if BUILD_RISCV != 1
-		int val = 0;
-#endif
 		int tms = (bit_cnt == scan_size-1) ? 1 : 0;
 		int tdi;
 		int bytec = bit_cnt/8;
@@ -229,11 +312,11 @@ static void bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 
 		bitbang_interface->write(0, tms, tdi);
 
-#if BUILD_RISCV == 1
 		if (type != SCAN_OUT) {
-			if (bitbang_interface->buf_size) {
+			if (pipelined) {
 				bitbang_interface->sample();
-				buffered++;
+				pending_scans[pending_scan_count - 1].sampled++;
+				pending_samples++;
 			} else {
 				int val = bitbang_interface->read();
 				if (val)
@@ -242,33 +325,13 @@ static void bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 					buffer[bytec] &= ~bcval;
 			}
 		}
-#else
-		if (type != SCAN_OUT)
-			val = bitbang_interface->read();
 
-#endif		
 		bitbang_interface->write(1, tms, tdi);
 
-#if BUILD_RISCV == 1
-		if (type != SCAN_OUT && bitbang_interface->buf_size &&
-				(buffered == bitbang_interface->buf_size ||
-				 bit_cnt == scan_size - 1)) {
-			for (unsigned i = bit_cnt + 1 - buffered; i <= bit_cnt; i++) {
-				if (bitbang_interface->read_sample())
-					buffer[i/8] |= 1 << (i % 8);
-				else
-					buffer[i/8] &= ~(1 << (i % 8));
-			}
-			buffered = 0;
+		if (pipelined && pending_samples == bitbang_interface->buf_size) {
+			if (bitbang_read_pending_samples() != ERROR_OK)
+				retval = ERROR_JTAG_QUEUE_FAILED;
 		}
-#else
-		if (type != SCAN_OUT) {
-			if (val)
-				buffer[bytec] |= bcval;
-			else
-				buffer[bytec] &= ~bcval;
-		}
-#endif
 	}
 
 	if (tap_get_state() != tap_get_end_state()) {
@@ -278,6 +341,8 @@ static void bitbang_scan(bool ir_scan, enum scan_type type, uint8_t *buffer,
 		 */
 		bitbang_state_move(1);
 	}
+
+	return retval;
 }
 
 int bitbang_execute_queue(void)
@@ -348,7 +413,6 @@ int bitbang_execute_queue(void)
 				bitbang_path_move(cmd->cmd.pathmove);
 				break;
 			case JTAG_SCAN:
-#if BUILD_RISCV == 1
 				bitbang_end_state(cmd->cmd.scan->end_state);
 				scan_size = jtag_build_buffer(cmd->cmd.scan, &buffer);
 #ifdef _DEBUG_JTAG_IO_
@@ -356,18 +420,20 @@ int bitbang_execute_queue(void)
 						(cmd->cmd.scan->ir_scan) ? "IR" : "DR",
 						scan_size,
 					tap_state_name(cmd->cmd.scan->end_state));
-#endif
-#else
-#ifdef _DEBUG_JTAG_IO_
-				LOG_DEBUG("%s scan end in %s",
-						(cmd->cmd.scan->ir_scan) ? "IR" : "DR",
-						tap_state_name(cmd->cmd.scan->end_state));
-#endif
-				bitbang_end_state(cmd->cmd.scan->end_state);
-				scan_size = jtag_build_buffer(cmd->cmd.scan, &buffer);
 #endif
 				type = jtag_scan_type(cmd->cmd.scan);
-				bitbang_scan(cmd->cmd.scan->ir_scan, type, buffer, scan_size);
+				if (bitbang_interface->buf_size) {
+					if (!bitbang_add_pending_scan(cmd->cmd.scan, buffer)) {
+						free(buffer);
+						return ERROR_FAIL;
+					}
+					if (bitbang_scan(cmd->cmd.scan->ir_scan, type, buffer,
+							scan_size, true) != ERROR_OK)
+						retval = ERROR_JTAG_QUEUE_FAILED;
+					pending_scans[pending_scan_count - 1].complete = true;
+					break;
+				}
+				bitbang_scan(cmd->cmd.scan->ir_scan, type, buffer, scan_size, false);
 				if (jtag_read_buffer(buffer, cmd->cmd.scan) != ERROR_OK)
 					retval = ERROR_JTAG_QUEUE_FAILED;
 				if (buffer)
@@ -377,6 +443,9 @@ int bitbang_execute_queue(void)
 #ifdef _DEBUG_JTAG_IO_
 				LOG_DEBUG("sleep %" PRIi32, cmd->cmd.sleep->us);
 #endif
+				/* whatever was queued so far must reach the target first */
+				if (bitbang_flush() != ERROR_OK)
+					retval = ERROR_JTAG_QUEUE_FAILED;
 				jtag_sleep(cmd->cmd.sleep->us);
 				break;
 			case JTAG_TMS:
@@ -391,6 +460,11 @@ int bitbang_execute_queue(void)
 	if (bitbang_interface->blink)
 		bitbang_interface->blink(0);
 
+	if (pending_scan_count && bitbang_read_pending_samples() != ERROR_OK)
+		retval = ERROR_JTAG_QUEUE_FAILED;
+	if (bitbang_flush() != ERROR_OK)
+		retval = ERROR_JTAG_QUEUE_FAILED;
+
 	return retval;
 }
 
@@ -27,26 +27,26 @@
 struct bitbang_interface {
 	/* low level callbacks (for bitbang)
 	 */
-#if BUILD_RISCV == 1
 	/* Either read() or sample()/read_sample() must be implemented. */
 
 	/* Sample TDO and return 0 or 1. */
-#endif
 	int (*read)(void);
-#if BUILD_RISCV == 1
 	/* The sample functions allow an interface to batch a number of writes and
 	 * sample requests together. Not waiting for a value to come back can
 	 * greatly increase throughput. */
 	/* The number of TDO samples that can be buffered up before the caller has
-	 * to call read_sample. */
+	 * to call read_sample. Samples of consecutive scans in one queue are
+	 * accumulated, so this is a per-queue rather than a per-scan limit. */
 	size_t buf_size;
 	/* Sample TDO and put the result in a buffer. */
 	void (*sample)(void);
 	/* Return the next unread value from the buffer. */
 	int (*read_sample)(void);
+	/* Optional: push any buffered requests out to the hardware. Called
+	 * before sleeping and at the end of each queue. */
+	int (*flush)(void);
 
 	/* Set TCK, TMS, and TDI to the given values. */
-#endif
 	void (*write)(int tck, int tms, int tdi);
 	void (*reset)(int trst, int srst);
 	void (*blink)(int on);
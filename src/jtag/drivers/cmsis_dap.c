@@ -38,7 +38,7 @@
 #include <jtag/commands.h>
 #include <jtag/tcl.h>
 
-#include <hidapi.h>
+#include "cmsis_dap.h"
 
 /*
  * See CMSIS-DAP documentation:
@@ -64,96 +64,6 @@ static uint16_t cmsis_dap_pid[MAX_USB_IDS + 1] = { 0 };
 static wchar_t *cmsis_dap_serial;
 static bool swd_mode;
 
-#define PACKET_SIZE       (64 + 1)	/* 64 bytes plus report id */
-#define USB_TIMEOUT       1000
-
-/* CMSIS-DAP General Commands */
-#define CMD_DAP_INFO              0x00
-#define CMD_DAP_LED               0x01
-#define CMD_DAP_CONNECT           0x02
-#define CMD_DAP_DISCONNECT        0x03
-#define CMD_DAP_WRITE_ABORT       0x08
-#define CMD_DAP_DELAY             0x09
-#define CMD_DAP_RESET_TARGET      0x0A
-
-/* CMD_INFO */
-#define INFO_ID_VID               0x00      /* string */
-#define INFO_ID_PID               0x02      /* string */
-#define INFO_ID_SERNUM            0x03      /* string */
-#define INFO_ID_FW_VER            0x04      /* string */
-#define INFO_ID_TD_VEND           0x05      /* string */
-#define INFO_ID_TD_NAME           0x06      /* string */
-#define INFO_ID_CAPS              0xf0      /* byte */
-#define INFO_ID_PKT_CNT           0xfe      /* byte */
-#define INFO_ID_PKT_SZ            0xff      /* short */
-
-#define INFO_CAPS_SWD             0x01
-#define INFO_CAPS_JTAG            0x02
-
-/* CMD_LED */
-#define LED_ID_CONNECT            0x00
-#define LED_ID_RUN                0x01
-
-#define LED_OFF                   0x00
-#define LED_ON                    0x01
-
-/* CMD_CONNECT */
-#define CONNECT_DEFAULT           0x00
-#define CONNECT_SWD               0x01
-#define CONNECT_JTAG              0x02
-
-/* CMSIS-DAP Common SWD/JTAG Commands */
-#define CMD_DAP_DELAY             0x09
-#define CMD_DAP_SWJ_PINS          0x10
-#define CMD_DAP_SWJ_CLOCK         0x11
-#define CMD_DAP_SWJ_SEQ           0x12
-
-/*
- * PINS
- * Bit 0: SWCLK/TCK
- * Bit 1: SWDIO/TMS
- * Bit 2: TDI
- * Bit 3: TDO
- * Bit 5: nTRST
- * Bit 7: nRESET
- */
-
-#define SWJ_PIN_TCK               (1<<0)
-#define SWJ_PIN_TMS               (1<<1)
-#define SWJ_PIN_TDI               (1<<2)
-#define SWJ_PIN_TDO               (1<<3)
-#define SWJ_PIN_TRST              (1<<5)
-#define SWJ_PIN_SRST              (1<<7)
-
-/* CMSIS-DAP SWD Commands */
-#define CMD_DAP_SWD_CONFIGURE     0x13
-
-/* CMSIS-DAP JTAG Commands */
-#define CMD_DAP_JTAG_SEQ          0x14
-#define CMD_DAP_JTAG_CONFIGURE    0x15
-#define CMD_DAP_JTAG_IDCODE       0x16
-
-/* CMSIS-DAP JTAG sequence info masks */
-/* Number of bits to clock through (0 means 64) */
-#define DAP_JTAG_SEQ_TCK          0x3F
-/* TMS will be set during the sequence if this bit is set */
-#define DAP_JTAG_SEQ_TMS          0x40
-/* TDO output will be captured if this bit is set */
-#define DAP_JTAG_SEQ_TDO          0x80
-
-
-/* CMSIS-DAP Transfer Commands */
-#define CMD_DAP_TFER_CONFIGURE    0x04
-#define CMD_DAP_TFER              0x05
-#define CMD_DAP_TFER_BLOCK        0x06
-#define CMD_DAP_TFER_ABORT        0x07
-
-/* DAP Status Code */
-#define DAP_OK                    0
-#define DAP_ERROR                 0xFF
-
-/* CMSIS-DAP Vendor Commands
- * None as yet... */
 
 static const char * const info_caps_str[] = {
 	"SWD  Supported",
@@ -163,21 +73,23 @@ static const char * const info_caps_str[] = {
 /* max clock speed (kHz) */
 #define DAP_MAX_CLOCK             5000
 
-struct cmsis_dap {
-	hid_device *dev_handle;
-	uint16_t packet_size;
-	uint16_t packet_count;
-	uint8_t *packet_buffer;
-	uint8_t caps;
-	uint8_t mode;
-};
-
 struct pending_transfer_result {
 	uint8_t cmd;
 	uint32_t data;
 	void *buffer;
 };
 
+/* Transfers carried by one CMD_DAP_TFER or CMD_DAP_TFER_BLOCK packet */
+struct pending_request_block {
+	struct pending_transfer_result *transfers;
+	int transfer_count;
+	/** All transfers access the same register the same way, so the
+	 * block can be sent as a single CMD_DAP_TFER_BLOCK */
+	bool uniform;
+	/** Command the block was sent with */
+	uint8_t command;
+};
+
 struct pending_scan_result {
 	/** Offset in bytes in the CMD_DAP_JTAG_SEQ response buffer. */
 	unsigned first;
@@ -189,8 +101,17 @@ struct pending_scan_result {
 	unsigned buffer_offset;
 };
 
-static int pending_transfer_count, pending_queue_len;
-static struct pending_transfer_result *pending_transfers;
+/* Transfers that fit a CMD_DAP_TFER packet, whatever their mix */
+static int pending_queue_len;
+/* Transfers that fit a CMD_DAP_TFER_BLOCK packet, reads and writes */
+static int pending_block_read_len, pending_block_write_len;
+
+/* Ring of transfer packets. The block at put_idx is being filled; up to
+ * packet_count blocks before it have been sent and wait for a reply,
+ * the oldest one at get_idx. */
+static struct pending_request_block pending_fifo[MAX_PENDING_REQUESTS];
+static int pending_fifo_put_idx, pending_fifo_get_idx;
+static int pending_fifo_block_count;
 
 /* pointers to buffers that will receive jtag scan results on the next flush */
 #define MAX_PENDING_SCAN_RESULTS 256
@@ -208,150 +129,98 @@ static int queued_retval;
 
 static struct cmsis_dap *cmsis_dap_handle;
 
-static int cmsis_dap_usb_open(void)
-{
-	hid_device *dev = NULL;
-	int i;
-	struct hid_device_info *devs, *cur_dev;
-	unsigned short target_vid, target_pid;
-	wchar_t *target_serial = NULL;
+/* backends tried in order when none is selected with cmsis_dap_backend */
+static const struct cmsis_dap_backend *const cmsis_dap_backends[] = {
+#if HAVE_LIBUSB1
+	&cmsis_dap_usb_bulk_backend,
+#endif
+	&cmsis_dap_hid_backend,
+};
 
-	bool found = false;
-	bool serial_found = false;
+/* NULL for automatic selection */
+static const struct cmsis_dap_backend *cmsis_dap_selected_backend;
 
-	target_vid = 0;
-	target_pid = 0;
+static void cmsis_dap_swd_read_process(int timeout_ms);
 
-	/*
-	 * The CMSIS-DAP specification stipulates:
-	 * "The Product String must contain "CMSIS-DAP" somewhere in the string. This is used by the
-	 * debuggers to identify a CMSIS-DAP compliant Debug Unit that is connected to a host computer."
-	 */
-	devs = hid_enumerate(0x0, 0x0);
-	cur_dev = devs;
-	while (NULL != cur_dev) {
-		if (0 == cmsis_dap_vid[0]) {
-			if (NULL == cur_dev->product_string) {
-				LOG_DEBUG("Cannot read product string of device 0x%x:0x%x",
-					  cur_dev->vendor_id, cur_dev->product_id);
-			} else {
-				if (wcsstr(cur_dev->product_string, L"CMSIS-DAP")) {
-					/* if the user hasn't specified VID:PID *and*
-					 * product string contains "CMSIS-DAP", pick it
-					 */
-					found = true;
-				}
-			}
-		} else {
-			/* otherwise, exhaustively compare against all VID:PID in list */
-			for (i = 0; cmsis_dap_vid[i] || cmsis_dap_pid[i]; i++) {
-				if ((cmsis_dap_vid[i] == cur_dev->vendor_id) && (cmsis_dap_pid[i] == cur_dev->product_id))
-					found = true;
-			}
+static int cmsis_dap_open(void)
+{
+	int retval = ERROR_FAIL;
 
-			if (cmsis_dap_vid[i] || cmsis_dap_pid[i])
-				found = true;
-		}
+	struct cmsis_dap *dap = calloc(1, sizeof(struct cmsis_dap));
+	if (dap == NULL) {
+		LOG_ERROR("unable to allocate memory");
+		return ERROR_FAIL;
+	}
 
-		if (found) {
-			/* we have found an adapter, so exit further checks */
-			/* check serial number matches if given */
-			if (cmsis_dap_serial != NULL) {
-				if ((cur_dev->serial_number != NULL) && wcscmp(cmsis_dap_serial, cur_dev->serial_number) == 0) {
-					serial_found = true;
-					break;
-				}
-			} else
+	if (cmsis_dap_selected_backend) {
+		dap->backend = cmsis_dap_selected_backend;
+		retval = dap->backend->open(dap, cmsis_dap_vid, cmsis_dap_pid, cmsis_dap_serial);
+	} else {
+		for (size_t i = 0; i < ARRAY_SIZE(cmsis_dap_backends); i++) {
+			dap->backend = cmsis_dap_backends[i];
+			retval = dap->backend->open(dap, cmsis_dap_vid, cmsis_dap_pid, cmsis_dap_serial);
+			if (retval == ERROR_OK)
 				break;
-
-			found = false;
 		}
-
-		cur_dev = cur_dev->next;
 	}
 
-	if (NULL != cur_dev) {
-		target_vid = cur_dev->vendor_id;
-		target_pid = cur_dev->product_id;
-		if (serial_found)
-			target_serial = cmsis_dap_serial;
-	}
-
-	hid_free_enumeration(devs);
-
-	if (target_vid == 0 && target_pid == 0) {
+	if (retval != ERROR_OK) {
 		LOG_ERROR("unable to find CMSIS-DAP device");
-		return ERROR_FAIL;
-	}
-
-	if (hid_init() != 0) {
-		LOG_ERROR("unable to open HIDAPI");
-		return ERROR_FAIL;
-	}
-
-	dev = hid_open(target_vid, target_pid, target_serial);
-
-	if (dev == NULL) {
-		LOG_ERROR("unable to open CMSIS-DAP device 0x%x:0x%x", target_vid, target_pid);
-		return ERROR_FAIL;
+		free(dap);
+		return retval;
 	}
 
-	struct cmsis_dap *dap = malloc(sizeof(struct cmsis_dap));
-	if (dap == NULL) {
-		LOG_ERROR("unable to allocate memory");
-		return ERROR_FAIL;
-	}
+	LOG_DEBUG("CMSIS-DAP: using %s backend", dap->backend->name);
 
-	dap->dev_handle = dev;
 	dap->caps = 0;
 	dap->mode = 0;
+	dap->packet_count = 1;
 
-	cmsis_dap_handle = dap;
-
-	/* allocate default packet buffer, may be changed later.
-	 * currently with HIDAPI we have no way of getting the output report length
-	 * without this info we cannot communicate with the adapter.
-	 * For the moment we ahve to hard code the packet size */
-
-	int packet_size = PACKET_SIZE;
-
-	/* atmel cmsis-dap uses 512 byte reports */
-	/* except when it doesn't e.g. with mEDBG on SAMD10 Xplained
-	 * board */
-	/* TODO: HID report descriptor should be parsed instead of
-	 * hardcoding a match by VID */
-	if (target_vid == 0x03eb && target_pid != 0x2145)
-		packet_size = 512 + 1;
-
-	cmsis_dap_handle->packet_buffer = malloc(packet_size);
-	cmsis_dap_handle->packet_size = packet_size;
-
-	if (cmsis_dap_handle->packet_buffer == NULL) {
+	/* the default size set by the backend may be changed later */
+	dap->packet_buffer = malloc(dap->packet_size);
+	if (dap->packet_buffer == NULL) {
 		LOG_ERROR("unable to allocate memory");
+		dap->backend->close(dap);
+		free(dap);
 		return ERROR_FAIL;
 	}
 
+	cmsis_dap_handle = dap;
+
 	return ERROR_OK;
 }
 
-static void cmsis_dap_usb_close(struct cmsis_dap *dap)
+static void cmsis_dap_close(struct cmsis_dap *dap)
 {
-	hid_close(dap->dev_handle);
-	hid_exit();
+	dap->backend->close(dap);
 
 	free(cmsis_dap_handle->packet_buffer);
 	free(cmsis_dap_handle);
 	cmsis_dap_handle = NULL;
 	free(cmsis_dap_serial);
 	cmsis_dap_serial = NULL;
-	free(pending_transfers);
-	pending_transfers = NULL;
+
+	for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		free(pending_fifo[i].transfers);
+		pending_fifo[i].transfers = NULL;
+	}
 
 	return;
 }
 
+/* Get the packet buffer for building a synchronous command.  Replies to
+ * transfers still in flight are received into the same buffer, so they
+ * have to be collected before the command is written there. */
+static uint8_t *cmsis_dap_cmd_buffer(void)
+{
+	while (pending_fifo_block_count)
+		cmsis_dap_swd_read_process(USB_TIMEOUT);
+
+	return cmsis_dap_handle->packet_buffer;
+}
+
 /* Send a message and receive the reply */
-static int cmsis_dap_usb_xfer(struct cmsis_dap *dap, int txlen)
+static int cmsis_dap_xfer(struct cmsis_dap *dap, int txlen)
 {
 #ifdef CMSIS_DAP_JTAG_DEBUG
 	LOG_DEBUG("cmsis-dap usb xfer cmd=%02X", dap->packet_buffer[1]);
@@ -360,26 +229,18 @@ static int cmsis_dap_usb_xfer(struct cmsis_dap *dap, int txlen)
 	memset(dap->packet_buffer + txlen, 0, dap->packet_size - txlen);
 
 	/* write data to device */
-	int retval = hid_write(dap->dev_handle, dap->packet_buffer, dap->packet_size);
-	if (retval == -1) {
-		LOG_ERROR("error writing data: %ls", hid_error(dap->dev_handle));
-		return ERROR_FAIL;
-	}
+	int retval = dap->backend->write(dap, txlen);
+	if (retval != ERROR_OK)
+		return retval;
 
 	/* get reply */
-	retval = hid_read_timeout(dap->dev_handle, dap->packet_buffer, dap->packet_size, USB_TIMEOUT);
-	if (retval == -1 || retval == 0) {
-		LOG_DEBUG("error reading data: %ls", hid_error(dap->dev_handle));
-		return ERROR_FAIL;
-	}
-
-	return ERROR_OK;
+	return dap->backend->read(dap, USB_TIMEOUT);
 }
 
 static int cmsis_dap_cmd_DAP_SWJ_Pins(uint8_t pins, uint8_t mask, uint32_t delay, uint8_t *input)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_SWJ_PINS;
@@ -389,7 +250,7 @@ static int cmsis_dap_cmd_DAP_SWJ_Pins(uint8_t pins, uint8_t mask, uint32_t delay
 	buffer[5] = (delay >> 8) & 0xff;
 	buffer[6] = (delay >> 16) & 0xff;
 	buffer[7] = (delay >> 24) & 0xff;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 8);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 8);
 
 	if (retval != ERROR_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_DAP_SWJ_PINS failed.");
@@ -405,7 +266,7 @@ static int cmsis_dap_cmd_DAP_SWJ_Pins(uint8_t pins, uint8_t mask, uint32_t delay
 static int cmsis_dap_cmd_DAP_SWJ_Clock(uint32_t swj_clock)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	/* set clock in Hz */
 	swj_clock *= 1000;
@@ -415,7 +276,7 @@ static int cmsis_dap_cmd_DAP_SWJ_Clock(uint32_t swj_clock)
 	buffer[3] = (swj_clock >> 8) & 0xff;
 	buffer[4] = (swj_clock >> 16) & 0xff;
 	buffer[5] = (swj_clock >> 24) & 0xff;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 6);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 6);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_DAP_SWJ_CLOCK failed.");
@@ -429,7 +290,7 @@ static int cmsis_dap_cmd_DAP_SWJ_Clock(uint32_t swj_clock)
 static int cmsis_dap_cmd_DAP_SWJ_Sequence(uint8_t s_len, const uint8_t *sequence)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 #ifdef CMSIS_DAP_JTAG_DEBUG
 	LOG_DEBUG("cmsis-dap TMS sequence: len=%d", s_len);
@@ -444,7 +305,7 @@ static int cmsis_dap_cmd_DAP_SWJ_Sequence(uint8_t s_len, const uint8_t *sequence
 	buffer[2] = s_len;
 	bit_copy(&buffer[3], 0, sequence, 0, s_len);
 
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, DIV_ROUND_UP(s_len, 8) + 3);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, DIV_ROUND_UP(s_len, 8) + 3);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK)
 		return ERROR_FAIL;
@@ -455,12 +316,12 @@ static int cmsis_dap_cmd_DAP_SWJ_Sequence(uint8_t s_len, const uint8_t *sequence
 static int cmsis_dap_cmd_DAP_Info(uint8_t info, uint8_t **data)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_INFO;
 	buffer[2] = info;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 3);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 3);
 
 	if (retval != ERROR_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_INFO failed.");
@@ -475,13 +336,13 @@ static int cmsis_dap_cmd_DAP_Info(uint8_t info, uint8_t **data)
 static int cmsis_dap_cmd_DAP_LED(uint8_t leds)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_LED;
 	buffer[2] = 0x00;
 	buffer[3] = leds;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 4);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 4);
 
 	if (retval != ERROR_OK || buffer[1] != 0x00) {
 		LOG_ERROR("CMSIS-DAP command CMD_LED failed.");
@@ -494,12 +355,12 @@ static int cmsis_dap_cmd_DAP_LED(uint8_t leds)
 static int cmsis_dap_cmd_DAP_Connect(uint8_t mode)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_CONNECT;
 	buffer[2] = mode;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 3);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 3);
 
 	if (retval != ERROR_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_CONNECT failed.");
@@ -517,11 +378,11 @@ static int cmsis_dap_cmd_DAP_Connect(uint8_t mode)
 static int cmsis_dap_cmd_DAP_Disconnect(void)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_DISCONNECT;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 2);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 2);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_DISCONNECT failed.");
@@ -534,7 +395,7 @@ static int cmsis_dap_cmd_DAP_Disconnect(void)
 static int cmsis_dap_cmd_DAP_TFER_Configure(uint8_t idle, uint16_t retry_count, uint16_t match_retry)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_TFER_CONFIGURE;
@@ -543,7 +404,7 @@ static int cmsis_dap_cmd_DAP_TFER_Configure(uint8_t idle, uint16_t retry_count,
 	buffer[4] = (retry_count >> 8) & 0xff;
 	buffer[5] = match_retry & 0xff;
 	buffer[6] = (match_retry >> 8) & 0xff;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 7);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 7);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_TFER_Configure failed.");
@@ -556,12 +417,12 @@ static int cmsis_dap_cmd_DAP_TFER_Configure(uint8_t idle, uint16_t retry_count,
 static int cmsis_dap_cmd_DAP_SWD_Configure(uint8_t cfg)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_SWD_CONFIGURE;
 	buffer[2] = cfg;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 3);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 3);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_SWD_Configure failed.");
@@ -575,13 +436,13 @@ static int cmsis_dap_cmd_DAP_SWD_Configure(uint8_t cfg)
 static int cmsis_dap_cmd_DAP_Delay(uint16_t delay_us)
 {
 	int retval;
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_DELAY;
 	buffer[2] = delay_us & 0xff;
 	buffer[3] = (delay_us >> 8) & 0xff;
-	retval = cmsis_dap_usb_xfer(cmsis_dap_handle, 4);
+	retval = cmsis_dap_xfer(cmsis_dap_handle, 4);
 
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_Delay failed.");
@@ -592,29 +453,42 @@ static int cmsis_dap_cmd_DAP_Delay(uint16_t delay_us)
 }
 #endif
 
-static int cmsis_dap_swd_run_queue(void)
+/* Send the block being filled without waiting for the reply */
+static void cmsis_dap_swd_write_from_queue(void)
 {
 	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	struct pending_request_block *block = &pending_fifo[pending_fifo_put_idx];
 
-	LOG_DEBUG_IO("Executing %d queued transactions", pending_transfer_count);
+	LOG_DEBUG_IO("Executing %d queued transactions from FIFO index %d",
+			block->transfer_count, pending_fifo_put_idx);
 
 	if (queued_retval != ERROR_OK) {
 		LOG_DEBUG("Skipping due to previous errors: %d", queued_retval);
 		goto skip;
 	}
 
-	if (!pending_transfer_count)
+	if (!block->transfer_count)
 		goto skip;
 
+	/* A run of accesses to one register, typically DRW from a MEM-AP
+	 * block transfer, only needs the request byte once */
+	block->command = block->uniform && block->transfer_count > 1 ?
+		CMD_DAP_TFER_BLOCK : CMD_DAP_TFER;
+
 	size_t idx = 0;
 	buffer[idx++] = 0;	/* report number */
-	buffer[idx++] = CMD_DAP_TFER;
+	buffer[idx++] = block->command;
 	buffer[idx++] = 0x00;	/* DAP Index */
-	buffer[idx++] = pending_transfer_count;
+	if (block->command == CMD_DAP_TFER_BLOCK) {
+		h_u16_to_le(&buffer[idx], block->transfer_count);
+		idx += 2;
+		buffer[idx++] = (block->transfers[0].cmd >> 1) & 0x0f;
+	} else
+		buffer[idx++] = block->transfer_count;
 
-	for (int i = 0; i < pending_transfer_count; i++) {
-		uint8_t cmd = pending_transfers[i].cmd;
-		uint32_t data = pending_transfers[i].data;
+	for (int i = 0; i < block->transfer_count; i++) {
+		uint8_t cmd = block->transfers[i].cmd;
+		uint32_t data = block->transfers[i].data;
 
 		LOG_DEBUG_IO("%s %s reg %x %"PRIx32,
 				cmd & SWD_CMD_APnDP ? "AP" : "DP",
@@ -640,7 +514,8 @@ static int cmsis_dap_swd_run_queue(void)
 			data &= ~CORUNDETECT;
 		}
 
-		buffer[idx++] = (cmd >> 1) & 0x0f;
+		if (block->command == CMD_DAP_TFER)
+			buffer[idx++] = (cmd >> 1) & 0x0f;
 		if (!(cmd & SWD_CMD_RnW)) {
 			buffer[idx++] = (data) & 0xff;
 			buffer[idx++] = (data >> 8) & 0xff;
@@ -649,26 +524,73 @@ static int cmsis_dap_swd_run_queue(void)
 		}
 	}
 
-	queued_retval = cmsis_dap_usb_xfer(cmsis_dap_handle, idx);
+	/* Pad the rest of the TX buffer with 0's */
+	memset(buffer + idx, 0, cmsis_dap_handle->packet_size - idx);
+
+	queued_retval = cmsis_dap_handle->backend->write(cmsis_dap_handle, idx);
+	if (queued_retval != ERROR_OK)
+		goto skip;
+
+	pending_fifo_put_idx = (pending_fifo_put_idx + 1) % cmsis_dap_handle->packet_count;
+	pending_fifo_block_count++;
+	return;
+
+skip:
+	block->transfer_count = 0;
+}
+
+/* Wait for the reply to the oldest block in flight and retire it */
+static void cmsis_dap_swd_read_process(int timeout_ms)
+{
+	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	struct pending_request_block *block = &pending_fifo[pending_fifo_get_idx];
+
+	LOG_DEBUG_IO("Reading %d queued transactions from FIFO index %d",
+			block->transfer_count, pending_fifo_get_idx);
+
+	int retval = cmsis_dap_handle->backend->read(cmsis_dap_handle, timeout_ms);
+	if (retval != ERROR_OK) {
+		queued_retval = retval;
+		goto skip;
+	}
+
+	/* the reply is drained even after an error to keep the
+	 * adapter and the FIFO in step */
 	if (queued_retval != ERROR_OK)
 		goto skip;
 
-	idx = 2;
+	if (buffer[0] != block->command) {
+		LOG_ERROR("CMSIS-DAP command mismatch: expected 0x%" PRIx8 ", got 0x%" PRIx8,
+			  block->command, buffer[0]);
+		queued_retval = ERROR_FAIL;
+		goto skip;
+	}
+
+	int transfer_count;
+	size_t idx;
+	if (block->command == CMD_DAP_TFER_BLOCK) {
+		transfer_count = le_to_h_u16(&buffer[1]);
+		idx = 3;
+	} else {
+		transfer_count = buffer[1];
+		idx = 2;
+	}
+
 	uint8_t ack = buffer[idx] & 0x07;
 	if (ack != SWD_ACK_OK || (buffer[idx] & 0x08)) {
-		LOG_DEBUG("SWD ack not OK: %d %s", buffer[idx-1],
+		LOG_DEBUG("SWD ack not OK: %d %s", transfer_count,
 			  ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK");
 		queued_retval = ack == SWD_ACK_WAIT ? ERROR_WAIT : ERROR_FAIL;
 		goto skip;
 	}
 	idx++;
 
-	if (pending_transfer_count != buffer[1])
+	if (block->transfer_count != transfer_count)
 		LOG_ERROR("CMSIS-DAP transfer count mismatch: expected %d, got %d",
-			  pending_transfer_count, buffer[1]);
+			  block->transfer_count, transfer_count);
 
-	for (int i = 0; i < buffer[1]; i++) {
-		if (pending_transfers[i].cmd & SWD_CMD_RnW) {
+	for (int i = 0; i < transfer_count && i < block->transfer_count; i++) {
+		if (block->transfers[i].cmd & SWD_CMD_RnW) {
 			static uint32_t last_read;
 			uint32_t data = le_to_h_u32(&buffer[idx]);
 			uint32_t tmp = data;
@@ -677,19 +599,34 @@ static int cmsis_dap_swd_run_queue(void)
 			LOG_DEBUG_IO("Read result: %"PRIx32, data);
 
 			/* Imitate posted AP reads */
-			if ((pending_transfers[i].cmd & SWD_CMD_APnDP) ||
-			    ((pending_transfers[i].cmd & SWD_CMD_A32) >> 1 == DP_RDBUFF)) {
+			if ((block->transfers[i].cmd & SWD_CMD_APnDP) ||
+			    ((block->transfers[i].cmd & SWD_CMD_A32) >> 1 == DP_RDBUFF)) {
 				tmp = last_read;
 				last_read = data;
 			}
 
-			if (pending_transfers[i].buffer)
-				*(uint32_t *)pending_transfers[i].buffer = tmp;
+			if (block->transfers[i].buffer)
+				*(uint32_t *)block->transfers[i].buffer = tmp;
 		}
 	}
 
 skip:
-	pending_transfer_count = 0;
+	block->transfer_count = 0;
+	pending_fifo_get_idx = (pending_fifo_get_idx + 1) % cmsis_dap_handle->packet_count;
+	pending_fifo_block_count--;
+}
+
+static int cmsis_dap_swd_run_queue(void)
+{
+	if (pending_fifo[pending_fifo_put_idx].transfer_count)
+		cmsis_dap_swd_write_from_queue();
+
+	while (pending_fifo_block_count)
+		cmsis_dap_swd_read_process(USB_TIMEOUT);
+
+	pending_fifo_put_idx = 0;
+	pending_fifo_get_idx = 0;
+
 	int retval = queued_retval;
 	queued_retval = ERROR_OK;
 
@@ -698,23 +635,40 @@ skip:
 
 static void cmsis_dap_swd_queue_cmd(uint8_t cmd, uint32_t *dst, uint32_t data)
 {
-	if (pending_transfer_count == pending_queue_len) {
-		/* Not enough room in the queue. Run the queue. */
-		queued_retval = cmsis_dap_swd_run_queue();
+	struct pending_request_block *block = &pending_fifo[pending_fifo_put_idx];
+
+	bool uniform = block->transfer_count == 0 ||
+		(block->uniform && block->transfers[0].cmd == cmd);
+	int room = pending_queue_len;
+	if (uniform)
+		room = cmd & SWD_CMD_RnW ? pending_block_read_len : pending_block_write_len;
+
+	if (block->transfer_count >= room) {
+		/* Not enough room in the packet. Send it and go on filling
+		 * the next one, waiting for a reply only once the adapter
+		 * holds as many packets as it can buffer. */
+		cmsis_dap_swd_write_from_queue();
+		if (pending_fifo_block_count == cmsis_dap_handle->packet_count)
+			cmsis_dap_swd_read_process(USB_TIMEOUT);
+		block = &pending_fifo[pending_fifo_put_idx];
+		uniform = true;
 	}
 
 	if (queued_retval != ERROR_OK)
 		return;
 
-	pending_transfers[pending_transfer_count].data = data;
-	pending_transfers[pending_transfer_count].cmd = cmd;
+	block->uniform = uniform;
+
+	block->transfers[block->transfer_count].data = data;
+	block->transfers[block->transfer_count].cmd = cmd;
 	if (cmd & SWD_CMD_RnW) {
 		/* Queue a read transaction */
-		pending_transfers[pending_transfer_count].buffer = dst;
+		block->transfers[block->transfer_count].buffer = dst;
 	}
-	pending_transfer_count++;
+	block->transfer_count++;
 }
 
+
 static void cmsis_dap_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
 {
 	assert(!(cmd & SWD_CMD_RnW));
@@ -836,7 +790,7 @@ static int cmsis_dap_swd_open(void)
 
 	if (cmsis_dap_handle == NULL) {
 		/* SWD init */
-		retval = cmsis_dap_usb_open();
+		retval = cmsis_dap_open();
 		if (retval != ERROR_OK)
 			return retval;
 
@@ -874,7 +828,7 @@ static int cmsis_dap_init(void)
 	if (cmsis_dap_handle == NULL) {
 
 		/* JTAG init */
-		retval = cmsis_dap_usb_open();
+		retval = cmsis_dap_open();
 		if (retval != ERROR_OK)
 			return retval;
 
@@ -911,10 +865,16 @@ static int cmsis_dap_init(void)
 		 * write. For bulk read sequences just 4 bytes are
 		 * needed per transfer, so this is suboptimal. */
 		pending_queue_len = (pkt_sz - 4) / 5;
-		pending_transfers = malloc(pending_queue_len * sizeof(*pending_transfers));
-		if (!pending_transfers) {
-			LOG_ERROR("Unable to allocate memory for CMSIS-DAP queue");
-			return ERROR_FAIL;
+		/* A transfer block request has 5 bytes of header and its
+		 * reply 4, then 4 bytes per register write or read. */
+		pending_block_write_len = (pkt_sz - 5) / 4;
+		pending_block_read_len = (pkt_sz - 4) / 4;
+		for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+			pending_fifo[i].transfers = malloc(pending_block_read_len * sizeof(struct pending_transfer_result));
+			if (!pending_fifo[i].transfers) {
+				LOG_ERROR("Unable to allocate memory for CMSIS-DAP queue");
+				return ERROR_FAIL;
+			}
 		}
 
 		if (cmsis_dap_handle->packet_size != pkt_sz + 1) {
@@ -938,8 +898,9 @@ static int cmsis_dap_init(void)
 
 	if (data[0] == 1) { /* byte */
 		uint16_t pkt_cnt = data[1];
-		cmsis_dap_handle->packet_count = pkt_cnt;
 		LOG_DEBUG("CMSIS-DAP: Packet Count = %" PRId16, pkt_cnt);
+		if (pkt_cnt > 0)
+			cmsis_dap_handle->packet_count = MIN(pkt_cnt, MAX_PENDING_REQUESTS);
 	}
 
 	retval = cmsis_dap_get_status();
@@ -998,7 +959,7 @@ static int cmsis_dap_quit(void)
 	cmsis_dap_cmd_DAP_Disconnect();
 	cmsis_dap_cmd_DAP_LED(0x00);		/* Both LEDs off */
 
-	cmsis_dap_usb_close(cmsis_dap_handle);
+	cmsis_dap_close(cmsis_dap_handle);
 
 	return ERROR_OK;
 }
@@ -1127,7 +1088,7 @@ static void cmsis_dap_flush(void)
 		queued_seq_count, queued_seq_buf_end, pending_scan_result_count);
 
 	/* prep CMSIS-DAP packet */
-	uint8_t *buffer = cmsis_dap_handle->packet_buffer;
+	uint8_t *buffer = cmsis_dap_cmd_buffer();
 	buffer[0] = 0;	/* report number */
 	buffer[1] = CMD_DAP_JTAG_SEQ;
 	buffer[2] = queued_seq_count;
@@ -1138,7 +1099,7 @@ static void cmsis_dap_flush(void)
 #endif
 
 	/* send command to USB device */
-	int retval = cmsis_dap_usb_xfer(cmsis_dap_handle, queued_seq_buf_end + 3);
+	int retval = cmsis_dap_xfer(cmsis_dap_handle, queued_seq_buf_end + 3);
 	if (retval != ERROR_OK || buffer[1] != DAP_OK) {
 		LOG_ERROR("CMSIS-DAP command CMD_DAP_JTAG_SEQ failed.");
 		exit(-1);
@@ -1590,6 +1551,32 @@ COMMAND_HANDLER(cmsis_dap_handle_serial_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(cmsis_dap_handle_backend_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strcmp(CMD_ARGV[0], "auto") == 0) {
+		cmsis_dap_selected_backend = NULL;
+		return ERROR_OK;
+	}
+
+	if (strcmp(CMD_ARGV[0], cmsis_dap_loopback_backend.name) == 0) {
+		cmsis_dap_selected_backend = &cmsis_dap_loopback_backend;
+		return ERROR_OK;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(cmsis_dap_backends); i++) {
+		if (strcmp(CMD_ARGV[0], cmsis_dap_backends[i]->name) == 0) {
+			cmsis_dap_selected_backend = cmsis_dap_backends[i];
+			return ERROR_OK;
+		}
+	}
+
+	LOG_ERROR("invalid or unavailable CMSIS-DAP backend '%s'", CMD_ARGV[0]);
+	return ERROR_COMMAND_ARGUMENT_INVALID;
+}
+
 static const struct command_registration cmsis_dap_subcommand_handlers[] = {
 	{
 		.name = "info",
@@ -1623,6 +1610,14 @@ static const struct command_registration cmsis_dap_command_handlers[] = {
 		.help = "set the serial number of the adapter",
 		.usage = "serial_string",
 	},
+	{
+		.name = "cmsis_dap_backend",
+		.handler = &cmsis_dap_handle_backend_command,
+		.mode = COMMAND_CONFIG,
+		.help = "set the communication backend to use (USB bulk or HID, "
+			"or the loopback adapter emulation)",
+		.usage = "(auto | usb_bulk | hid | loopback)",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
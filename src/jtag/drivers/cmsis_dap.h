@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_JTAG_DRIVERS_CMSIS_DAP_H
+#define OPENOCD_JTAG_DRIVERS_CMSIS_DAP_H
+
+#include <stdint.h>
+#include <wchar.h>
+
+#define PACKET_SIZE       (64 + 1)	/* 64 bytes plus report id */
+#define USB_TIMEOUT       1000
+
+/* CMSIS-DAP General Commands */
+#define CMD_DAP_INFO              0x00
+#define CMD_DAP_LED               0x01
+#define CMD_DAP_CONNECT           0x02
+#define CMD_DAP_DISCONNECT        0x03
+#define CMD_DAP_WRITE_ABORT       0x08
+#define CMD_DAP_DELAY             0x09
+#define CMD_DAP_RESET_TARGET      0x0A
+
+/* CMD_INFO */
+#define INFO_ID_VID               0x00      /* string */
+#define INFO_ID_PID               0x02      /* string */
+#define INFO_ID_SERNUM            0x03      /* string */
+#define INFO_ID_FW_VER            0x04      /* string */
+#define INFO_ID_TD_VEND           0x05      /* string */
+#define INFO_ID_TD_NAME           0x06      /* string */
+#define INFO_ID_CAPS              0xf0      /* byte */
+#define INFO_ID_PKT_CNT           0xfe      /* byte */
+#define INFO_ID_PKT_SZ            0xff      /* short */
+
+#define INFO_CAPS_SWD             0x01
+#define INFO_CAPS_JTAG            0x02
+
+/* CMD_LED */
+#define LED_ID_CONNECT            0x00
+#define LED_ID_RUN                0x01
+
+#define LED_OFF                   0x00
+#define LED_ON                    0x01
+
+/* CMD_CONNECT */
+#define CONNECT_DEFAULT           0x00
+#define CONNECT_SWD               0x01
+#define CONNECT_JTAG              0x02
+
+/* CMSIS-DAP Common SWD/JTAG Commands */
+#define CMD_DAP_DELAY             0x09
+#define CMD_DAP_SWJ_PINS          0x10
+#define CMD_DAP_SWJ_CLOCK         0x11
+#define CMD_DAP_SWJ_SEQ           0x12
+
+/*
+ * PINS
+ * Bit 0: SWCLK/TCK
+ * Bit 1: SWDIO/TMS
+ * Bit 2: TDI
+ * Bit 3: TDO
+ * Bit 5: nTRST
+ * Bit 7: nRESET
+ */
+
+#define SWJ_PIN_TCK               (1<<0)
+#define SWJ_PIN_TMS               (1<<1)
+#define SWJ_PIN_TDI               (1<<2)
+#define SWJ_PIN_TDO               (1<<3)
+#define SWJ_PIN_TRST              (1<<5)
+#define SWJ_PIN_SRST              (1<<7)
+
+/* CMSIS-DAP SWD Commands */
+#define CMD_DAP_SWD_CONFIGURE     0x13
+
+/* CMSIS-DAP JTAG Commands */
+#define CMD_DAP_JTAG_SEQ          0x14
+#define CMD_DAP_JTAG_CONFIGURE    0x15
+#define CMD_DAP_JTAG_IDCODE       0x16
+
+/* CMSIS-DAP JTAG sequence info masks */
+/* Number of bits to clock through (0 means 64) */
+#define DAP_JTAG_SEQ_TCK          0x3F
+/* TMS will be set during the sequence if this bit is set */
+#define DAP_JTAG_SEQ_TMS          0x40
+/* TDO output will be captured if this bit is set */
+#define DAP_JTAG_SEQ_TDO          0x80
+
+
+/* CMSIS-DAP Transfer Commands */
+#define CMD_DAP_TFER_CONFIGURE    0x04
+#define CMD_DAP_TFER              0x05
+#define CMD_DAP_TFER_BLOCK        0x06
+#define CMD_DAP_TFER_ABORT        0x07
+
+/* DAP Status Code */
+#define DAP_OK                    0
+#define DAP_ERROR                 0xFF
+
+/* CMSIS-DAP Vendor Commands
+ * None as yet... */
+
+/* Upper limit on the number of command packets kept in flight, whatever
+ * the adapter reports as its packet count */
+#define MAX_PENDING_REQUESTS      4
+
+struct cmsis_dap_backend;
+struct cmsis_dap_backend_data;
+
+struct cmsis_dap {
+	const struct cmsis_dap_backend *backend;
+	struct cmsis_dap_backend_data *bdata;
+	/** Packet size including the leading report id byte */
+	uint16_t packet_size;
+	/** Number of packets the adapter can buffer (INFO_ID_PKT_CNT) */
+	uint16_t packet_count;
+	/** Command packet, byte 0 is the HID report id. Responses are
+	 * read back starting at byte 0. */
+	uint8_t *packet_buffer;
+	uint8_t caps;
+	uint8_t mode;
+};
+
+/**
+ * Transport used to move command and response packets between the
+ * driver and the adapter.
+ *
+ * write() hands over one command packet taken from dap->packet_buffer;
+ * it may return before the adapter has answered. read() waits for the
+ * response to the oldest outstanding command and stores it in
+ * dap->packet_buffer. A backend must accept at least dap->packet_count
+ * (capped to MAX_PENDING_REQUESTS) writes before the first read.
+ */
+struct cmsis_dap_backend {
+	const char *name;
+	/** Find and open the adapter, set packet_size to the default size */
+	int (*open)(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], wchar_t *serial);
+	void (*close)(struct cmsis_dap *dap);
+	/** Send txlen bytes of packet_buffer, report id byte included */
+	int (*write)(struct cmsis_dap *dap, int txlen);
+	int (*read)(struct cmsis_dap *dap, int timeout_ms);
+};
+
+extern const struct cmsis_dap_backend cmsis_dap_hid_backend;
+extern const struct cmsis_dap_backend cmsis_dap_usb_bulk_backend;
+extern const struct cmsis_dap_backend cmsis_dap_loopback_backend;
+
+#endif /* OPENOCD_JTAG_DRIVERS_CMSIS_DAP_H */
@@ -0,0 +1,453 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * Loopback backend: an adapter emulated in process, for exercising the
+ * driver and the layers above it without hardware or USB libraries.
+ *
+ * It answers the general commands as a CMSIS-DAP v2 adapter with 64 byte
+ * packets would, echoes TDI back as TDO on JTAG sequences and implements
+ * an SW-DP with a single MEM-AP on APSEL 0. The MEM-AP is backed by
+ * 64 KiB of RAM mirrored over the whole address space.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/binarybuffer.h>
+#include <target/arm_adi_v5.h>
+
+#include "cmsis_dap.h"
+
+#define LOOPBACK_PACKET_SIZE      64
+#define LOOPBACK_MEM_SIZE         (64 * 1024)
+
+#define LOOPBACK_DPIDR            0x2BA01477
+#define LOOPBACK_AP_IDR           0x24770011
+
+struct cmsis_dap_backend_data {
+	uint8_t replies[MAX_PENDING_REQUESTS][LOOPBACK_PACKET_SIZE];
+	unsigned int put_idx;
+	unsigned int get_idx;
+	unsigned int count;
+
+	uint8_t pins;
+
+	uint32_t dp_ctrl_stat;
+	uint32_t dp_select;
+	uint32_t dp_rdbuff;
+
+	uint32_t ap_csw;
+	uint32_t ap_tar;
+	uint8_t *mem;
+};
+
+static unsigned int loopback_access_size(struct cmsis_dap_backend_data *bdata)
+{
+	switch (bdata->ap_csw & 7) {
+	case 0:
+		return 1;
+	case 1:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+/* Read or write the bytes lanes selected by the transfer size at addr */
+static uint32_t loopback_mem_access(struct cmsis_dap_backend_data *bdata,
+		uint32_t addr, unsigned int size, bool write, uint32_t data)
+{
+	uint32_t result = 0;
+
+	addr &= ~(size - 1);
+	for (unsigned int i = 0; i < size; i++) {
+		uint32_t a = addr + i;
+		unsigned int lane = (a & 3) * 8;
+		uint8_t *byte = &bdata->mem[a & (LOOPBACK_MEM_SIZE - 1)];
+
+		if (write)
+			*byte = data >> lane;
+		else
+			result |= (uint32_t)*byte << lane;
+	}
+
+	return result;
+}
+
+static uint32_t loopback_ap_access(struct cmsis_dap_backend_data *bdata,
+		unsigned int reg, bool write, uint32_t data)
+{
+	unsigned int size;
+	uint32_t value = 0;
+
+	/* only APSEL 0 exists */
+	if (bdata->dp_select & DP_SELECT_APSEL)
+		return 0;
+
+	reg |= bdata->dp_select & DP_SELECT_APBANK;
+
+	switch (reg) {
+	case MEM_AP_REG_CSW:
+		if (write)
+			bdata->ap_csw = data;
+		value = bdata->ap_csw;
+		break;
+	case MEM_AP_REG_TAR:
+		if (write)
+			bdata->ap_tar = data;
+		value = bdata->ap_tar;
+		break;
+	case MEM_AP_REG_DRW:
+		size = loopback_access_size(bdata);
+		value = loopback_mem_access(bdata, bdata->ap_tar, size, write, data);
+		if ((bdata->ap_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_SINGLE)
+			bdata->ap_tar += size;
+		break;
+	case MEM_AP_REG_BD0:
+	case MEM_AP_REG_BD1:
+	case MEM_AP_REG_BD2:
+	case MEM_AP_REG_BD3:
+		value = loopback_mem_access(bdata, (bdata->ap_tar & ~0xf) + (reg & 0xc),
+				4, write, data);
+		break;
+	case MEM_AP_REG_BASE:
+		/* legacy format, no debug entries */
+		value = 0xffffffff;
+		break;
+	case AP_REG_IDR:
+		value = LOOPBACK_AP_IDR;
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+static uint32_t loopback_dp_access(struct cmsis_dap_backend_data *bdata,
+		unsigned int reg, bool write, uint32_t data)
+{
+	switch (reg) {
+	case DP_DPIDR:
+		/* writes go to ABORT, nothing sticky to clear here */
+		return LOOPBACK_DPIDR;
+	case DP_CTRL_STAT:
+		if (write) {
+			/* acknowledge power up requests right away */
+			bdata->dp_ctrl_stat = data & (CDBGPWRUPREQ | CSYSPWRUPREQ);
+			bdata->dp_ctrl_stat |= bdata->dp_ctrl_stat << 1;
+		}
+		return bdata->dp_ctrl_stat;
+	case DP_SELECT:
+		if (write)
+			bdata->dp_select = data;
+		return 0;
+	case DP_RDBUFF:
+		return bdata->dp_rdbuff;
+	default:
+		return 0;
+	}
+}
+
+static void loopback_transfer(struct cmsis_dap_backend_data *bdata,
+		const uint8_t *request, int request_len, uint8_t *reply)
+{
+	int req_idx = 3;
+	int reply_idx = 3;
+	unsigned int count = request[2];
+	unsigned int done;
+	uint8_t ack = SWD_ACK_OK;
+
+	for (done = 0; done < count; done++) {
+		if (req_idx >= request_len) {
+			ack = SWD_ACK_FAULT;
+			break;
+		}
+
+		uint8_t transfer = request[req_idx++];
+		bool ap = transfer & 1;
+		bool read = transfer & 2;
+		unsigned int reg = transfer & 0xc;
+
+		/* value match and timestamps are not emulated */
+		if (transfer & 0xf0) {
+			ack = SWD_ACK_FAULT;
+			break;
+		}
+
+		if (read) {
+			if (reply_idx + 4 > LOOPBACK_PACKET_SIZE) {
+				ack = SWD_ACK_FAULT;
+				break;
+			}
+			uint32_t value = ap ? loopback_ap_access(bdata, reg, false, 0)
+				: loopback_dp_access(bdata, reg, false, 0);
+			if (ap)
+				bdata->dp_rdbuff = value;
+			h_u32_to_le(&reply[reply_idx], value);
+			reply_idx += 4;
+		} else {
+			if (req_idx + 4 > request_len) {
+				ack = SWD_ACK_FAULT;
+				break;
+			}
+			uint32_t value = le_to_h_u32(&request[req_idx]);
+			req_idx += 4;
+			if (ap)
+				loopback_ap_access(bdata, reg, true, value);
+			else
+				loopback_dp_access(bdata, reg, true, value);
+		}
+	}
+
+	reply[1] = done;
+	reply[2] = ack;
+}
+
+static void loopback_transfer_block(struct cmsis_dap_backend_data *bdata,
+		const uint8_t *request, int request_len, uint8_t *reply)
+{
+	int req_idx = 5;
+	int reply_idx = 4;
+	unsigned int count = le_to_h_u16(&request[2]);
+	unsigned int done;
+
+	if (request_len < req_idx) {
+		reply[3] = SWD_ACK_FAULT;
+		return;
+	}
+
+	uint8_t transfer = request[4];
+	bool ap = transfer & 1;
+	bool read = transfer & 2;
+	unsigned int reg = transfer & 0xc;
+	uint8_t ack = SWD_ACK_OK;
+
+	for (done = 0; done < count; done++) {
+		if (read) {
+			if (reply_idx + 4 > LOOPBACK_PACKET_SIZE) {
+				ack = SWD_ACK_FAULT;
+				break;
+			}
+			uint32_t value = ap ? loopback_ap_access(bdata, reg, false, 0)
+				: loopback_dp_access(bdata, reg, false, 0);
+			if (ap)
+				bdata->dp_rdbuff = value;
+			h_u32_to_le(&reply[reply_idx], value);
+			reply_idx += 4;
+		} else {
+			if (req_idx + 4 > request_len) {
+				ack = SWD_ACK_FAULT;
+				break;
+			}
+			uint32_t value = le_to_h_u32(&request[req_idx]);
+			req_idx += 4;
+			if (ap)
+				loopback_ap_access(bdata, reg, true, value);
+			else
+				loopback_dp_access(bdata, reg, true, value);
+		}
+	}
+
+	h_u16_to_le(&reply[1], done);
+	reply[3] = ack;
+}
+
+static void loopback_jtag_sequence(const uint8_t *request, int request_len, uint8_t *reply)
+{
+	int req_idx = 2;
+	int reply_idx = 2;
+	unsigned int count = request[1];
+
+	reply[1] = DAP_OK;
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (req_idx >= request_len) {
+			reply[1] = DAP_ERROR;
+			return;
+		}
+
+		uint8_t info = request[req_idx++];
+		unsigned int bits = info & DAP_JTAG_SEQ_TCK;
+		unsigned int bytes = DIV_ROUND_UP(bits ? bits : 64, 8);
+
+		if (req_idx + (int)bytes > request_len) {
+			reply[1] = DAP_ERROR;
+			return;
+		}
+
+		/* TDO is wired to TDI */
+		if (info & DAP_JTAG_SEQ_TDO) {
+			if (reply_idx + (int)bytes > LOOPBACK_PACKET_SIZE) {
+				reply[1] = DAP_ERROR;
+				return;
+			}
+			memcpy(&reply[reply_idx], &request[req_idx], bytes);
+			reply_idx += bytes;
+		}
+		req_idx += bytes;
+	}
+}
+
+static void loopback_info(const uint8_t *request, uint8_t *reply)
+{
+	static const char fw_version[] = "2.0.0";
+
+	switch (request[1]) {
+	case INFO_ID_FW_VER:
+		reply[1] = sizeof(fw_version);
+		memcpy(&reply[2], fw_version, sizeof(fw_version));
+		break;
+	case INFO_ID_CAPS:
+		reply[1] = 1;
+		reply[2] = INFO_CAPS_SWD | INFO_CAPS_JTAG;
+		break;
+	case INFO_ID_PKT_CNT:
+		reply[1] = 1;
+		reply[2] = MAX_PENDING_REQUESTS;
+		break;
+	case INFO_ID_PKT_SZ:
+		reply[1] = 2;
+		h_u16_to_le(&reply[2], LOOPBACK_PACKET_SIZE);
+		break;
+	default:
+		reply[1] = 0;
+		break;
+	}
+}
+
+static void loopback_execute(struct cmsis_dap_backend_data *bdata,
+		const uint8_t *request, int request_len, uint8_t *reply)
+{
+	memset(reply, 0, LOOPBACK_PACKET_SIZE);
+	reply[0] = request[0];
+
+	switch (request[0]) {
+	case CMD_DAP_INFO:
+		loopback_info(request, reply);
+		break;
+	case CMD_DAP_CONNECT:
+		reply[1] = request[1] == CONNECT_DEFAULT ? CONNECT_SWD : request[1];
+		break;
+	case CMD_DAP_SWJ_PINS:
+		bdata->pins = (bdata->pins & ~request[2]) | (request[1] & request[2]);
+		reply[1] = bdata->pins;
+		break;
+	case CMD_DAP_TFER:
+		loopback_transfer(bdata, request, request_len, reply);
+		break;
+	case CMD_DAP_TFER_BLOCK:
+		loopback_transfer_block(bdata, request, request_len, reply);
+		break;
+	case CMD_DAP_JTAG_SEQ:
+		loopback_jtag_sequence(request, request_len, reply);
+		break;
+	case CMD_DAP_LED:
+	case CMD_DAP_DISCONNECT:
+	case CMD_DAP_WRITE_ABORT:
+	case CMD_DAP_DELAY:
+	case CMD_DAP_TFER_CONFIGURE:
+	case CMD_DAP_SWJ_CLOCK:
+	case CMD_DAP_SWJ_SEQ:
+	case CMD_DAP_SWD_CONFIGURE:
+	case CMD_DAP_JTAG_CONFIGURE:
+		reply[1] = DAP_OK;
+		break;
+	default:
+		/* ID_DAP_Invalid */
+		reply[0] = 0xff;
+		break;
+	}
+}
+
+static int cmsis_dap_loopback_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], wchar_t *serial)
+{
+	struct cmsis_dap_backend_data *bdata = calloc(1, sizeof(*bdata));
+	if (bdata == NULL) {
+		LOG_ERROR("unable to allocate memory");
+		return ERROR_FAIL;
+	}
+
+	bdata->mem = calloc(1, LOOPBACK_MEM_SIZE);
+	if (bdata->mem == NULL) {
+		LOG_ERROR("unable to allocate memory");
+		free(bdata);
+		return ERROR_FAIL;
+	}
+
+	dap->bdata = bdata;
+	dap->packet_size = LOOPBACK_PACKET_SIZE + 1;
+
+	LOG_INFO("CMSIS-DAP: using the loopback adapter emulation");
+
+	return ERROR_OK;
+}
+
+static void cmsis_dap_loopback_close(struct cmsis_dap *dap)
+{
+	free(dap->bdata->mem);
+	free(dap->bdata);
+	dap->bdata = NULL;
+}
+
+static int cmsis_dap_loopback_write(struct cmsis_dap *dap, int txlen)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	/* a real adapter would drop the packet, flag the driver bug */
+	if (bdata->count == MAX_PENDING_REQUESTS) {
+		LOG_ERROR("BUG: CMSIS-DAP loopback packet buffer overrun");
+		return ERROR_FAIL;
+	}
+
+	/* skip the report id byte */
+	loopback_execute(bdata, dap->packet_buffer + 1,
+			MIN(txlen - 1, LOOPBACK_PACKET_SIZE), bdata->replies[bdata->put_idx]);
+
+	bdata->put_idx = (bdata->put_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->count++;
+
+	return ERROR_OK;
+}
+
+static int cmsis_dap_loopback_read(struct cmsis_dap *dap, int timeout_ms)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	if (bdata->count == 0) {
+		LOG_DEBUG("error reading data: no reply pending");
+		return ERROR_FAIL;
+	}
+
+	memset(dap->packet_buffer, 0, dap->packet_size);
+	memcpy(dap->packet_buffer, bdata->replies[bdata->get_idx],
+			MIN(dap->packet_size, LOOPBACK_PACKET_SIZE));
+
+	bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->count--;
+
+	return ERROR_OK;
+}
+
+const struct cmsis_dap_backend cmsis_dap_loopback_backend = {
+	.name = "loopback",
+	.open = cmsis_dap_loopback_open,
+	.close = cmsis_dap_loopback_close,
+	.write = cmsis_dap_loopback_write,
+	.read = cmsis_dap_loopback_read,
+};
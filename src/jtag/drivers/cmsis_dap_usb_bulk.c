@@ -0,0 +1,438 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+/*
+ * CMSIS-DAP v2 backend: the command and response packets travel over a
+ * pair of vendor specific bulk endpoints instead of HID reports, which
+ * removes the HID polling interval from each round trip. Every command
+ * is submitted as an asynchronous transfer together with the transfer
+ * receiving its reply, so as many packets as the adapter can buffer
+ * are on the bus at the same time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libusb.h>
+#include <helper/log.h>
+#include <helper/time_support.h>
+
+#include "cmsis_dap.h"
+
+#ifndef LIBUSB_CALL
+#define LIBUSB_CALL
+#endif
+
+struct cmsis_dap_bulk_request {
+	struct libusb_transfer *out;
+	struct libusb_transfer *in;
+	uint8_t *out_buf;
+	uint8_t *in_buf;
+	int buf_size;
+	int out_done;
+	int in_done;
+};
+
+struct cmsis_dap_backend_data {
+	struct libusb_context *usb_ctx;
+	struct libusb_device_handle *dev_handle;
+	int interface;
+	unsigned char ep_out;
+	unsigned char ep_in;
+	struct cmsis_dap_bulk_request requests[MAX_PENDING_REQUESTS];
+	unsigned int put_idx;
+	unsigned int get_idx;
+	unsigned int count;
+};
+
+static bool cmsis_dap_usb_match_id(const struct libusb_device_descriptor *dev_desc,
+		const uint16_t vids[], const uint16_t pids[])
+{
+	/* no filter given, rely on the interface string */
+	if (vids[0] == 0 && pids[0] == 0)
+		return true;
+
+	for (int i = 0; vids[i] || pids[i]; i++) {
+		if (dev_desc->idVendor == vids[i] && dev_desc->idProduct == pids[i])
+			return true;
+	}
+
+	return false;
+}
+
+static bool cmsis_dap_usb_match_serial(struct libusb_device_handle *dev_handle,
+		uint8_t str_index, const wchar_t *serial)
+{
+	char desc_string[256 + 1];
+	wchar_t desc_wstring[256 + 1];
+
+	if (serial == NULL)
+		return true;
+
+	if (str_index == 0)
+		return false;
+
+	int retval = libusb_get_string_descriptor_ascii(dev_handle, str_index,
+			(unsigned char *)desc_string, sizeof(desc_string) - 1);
+	if (retval < 0)
+		return false;
+	desc_string[retval] = '\0';
+
+	if (mbstowcs(desc_wstring, desc_string, ARRAY_SIZE(desc_wstring)) == (size_t)-1)
+		return false;
+	desc_wstring[ARRAY_SIZE(desc_wstring) - 1] = L'\0';
+
+	return wcscmp(serial, desc_wstring) == 0;
+}
+
+/* Look for the CMSIS-DAP v2 interface: vendor specific class, an interface
+ * string containing "CMSIS-DAP", a bulk OUT endpoint followed by a bulk IN
+ * endpoint. Returns the interface number or -1. */
+static int cmsis_dap_usb_find_interface(struct libusb_device *dev,
+		struct libusb_device_handle *dev_handle,
+		unsigned char *ep_out, unsigned char *ep_in, uint16_t *max_packet_size)
+{
+	struct libusb_config_descriptor *config_desc;
+	int interface_num = -1;
+
+	if (libusb_get_active_config_descriptor(dev, &config_desc) != 0)
+		return -1;
+
+	for (int i = 0; i < config_desc->bNumInterfaces && interface_num < 0; i++) {
+		if (config_desc->interface[i].num_altsetting < 1)
+			continue;
+
+		const struct libusb_interface_descriptor *intf_desc = &config_desc->interface[i].altsetting[0];
+		if (intf_desc->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC ||
+				intf_desc->bNumEndpoints < 2 || intf_desc->iInterface == 0)
+			continue;
+
+		const struct libusb_endpoint_descriptor *out = &intf_desc->endpoint[0];
+		const struct libusb_endpoint_descriptor *in = &intf_desc->endpoint[1];
+		if ((out->bmAttributes & 3) != LIBUSB_TRANSFER_TYPE_BULK ||
+				(in->bmAttributes & 3) != LIBUSB_TRANSFER_TYPE_BULK ||
+				(out->bEndpointAddress & LIBUSB_ENDPOINT_IN) ||
+				!(in->bEndpointAddress & LIBUSB_ENDPOINT_IN))
+			continue;
+
+		char intf_string[256 + 1];
+		int retval = libusb_get_string_descriptor_ascii(dev_handle, intf_desc->iInterface,
+				(unsigned char *)intf_string, sizeof(intf_string) - 1);
+		if (retval < 0)
+			continue;
+		intf_string[retval] = '\0';
+
+		if (!strstr(intf_string, "CMSIS-DAP"))
+			continue;
+
+		interface_num = intf_desc->bInterfaceNumber;
+		*ep_out = out->bEndpointAddress;
+		*ep_in = in->bEndpointAddress;
+		*max_packet_size = out->wMaxPacketSize;
+	}
+
+	libusb_free_config_descriptor(config_desc);
+
+	return interface_num;
+}
+
+static void LIBUSB_CALL cmsis_dap_usb_callback(struct libusb_transfer *transfer)
+{
+	int *completed = transfer->user_data;
+	*completed = 1;
+}
+
+static void cmsis_dap_usb_wait(struct cmsis_dap_backend_data *bdata, int *completed)
+{
+	while (!*completed) {
+		int retval = libusb_handle_events_completed(bdata->usb_ctx, completed);
+		if (retval != 0 && retval != LIBUSB_ERROR_INTERRUPTED) {
+			LOG_ERROR("libusb event handling failed: %s", libusb_error_name(retval));
+			break;
+		}
+	}
+}
+
+static void cmsis_dap_usb_free(struct cmsis_dap_backend_data *bdata)
+{
+	for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		struct cmsis_dap_bulk_request *req = &bdata->requests[i];
+
+		libusb_free_transfer(req->out);
+		libusb_free_transfer(req->in);
+		free(req->out_buf);
+		free(req->in_buf);
+	}
+
+	free(bdata);
+}
+
+static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], wchar_t *serial)
+{
+	struct libusb_context *ctx;
+	struct libusb_device **device_list;
+
+	int retval = libusb_init(&ctx);
+	if (retval != 0) {
+		LOG_ERROR("libusb initialization failed: %s", libusb_error_name(retval));
+		return ERROR_FAIL;
+	}
+
+	ssize_t num_devices = libusb_get_device_list(ctx, &device_list);
+	if (num_devices < 0) {
+		LOG_ERROR("could not enumerate USB devices: %s", libusb_error_name(num_devices));
+		libusb_exit(ctx);
+		return ERROR_FAIL;
+	}
+
+	for (ssize_t i = 0; i < num_devices; i++) {
+		struct libusb_device *dev = device_list[i];
+		struct libusb_device_descriptor dev_desc;
+
+		if (libusb_get_device_descriptor(dev, &dev_desc) != 0)
+			continue;
+
+		if (!cmsis_dap_usb_match_id(&dev_desc, vids, pids))
+			continue;
+
+		struct libusb_device_handle *dev_handle;
+		retval = libusb_open(dev, &dev_handle);
+		if (retval != 0) {
+			LOG_DEBUG("could not open device 0x%04x:0x%04x: %s",
+				dev_desc.idVendor, dev_desc.idProduct, libusb_error_name(retval));
+			continue;
+		}
+
+		if (!cmsis_dap_usb_match_serial(dev_handle, dev_desc.iSerialNumber, serial)) {
+			libusb_close(dev_handle);
+			continue;
+		}
+
+		unsigned char ep_out, ep_in;
+		uint16_t max_packet_size;
+		int interface_num = cmsis_dap_usb_find_interface(dev, dev_handle,
+				&ep_out, &ep_in, &max_packet_size);
+		if (interface_num < 0) {
+			libusb_close(dev_handle);
+			continue;
+		}
+
+		retval = libusb_claim_interface(dev_handle, interface_num);
+		if (retval != 0) {
+			LOG_ERROR("could not claim interface %d of device 0x%04x:0x%04x: %s",
+				interface_num, dev_desc.idVendor, dev_desc.idProduct,
+				libusb_error_name(retval));
+			libusb_close(dev_handle);
+			continue;
+		}
+
+		libusb_free_device_list(device_list, 1);
+
+		struct cmsis_dap_backend_data *bdata = calloc(1, sizeof(*bdata));
+		if (bdata == NULL) {
+			LOG_ERROR("unable to allocate memory");
+			goto error;
+		}
+
+		for (int j = 0; j < MAX_PENDING_REQUESTS; j++) {
+			bdata->requests[j].out = libusb_alloc_transfer(0);
+			bdata->requests[j].in = libusb_alloc_transfer(0);
+			if (bdata->requests[j].out == NULL || bdata->requests[j].in == NULL) {
+				LOG_ERROR("unable to allocate USB transfers");
+				cmsis_dap_usb_free(bdata);
+				goto error;
+			}
+		}
+
+		bdata->usb_ctx = ctx;
+		bdata->dev_handle = dev_handle;
+		bdata->interface = interface_num;
+		bdata->ep_out = ep_out;
+		bdata->ep_in = ep_in;
+
+		dap->bdata = bdata;
+		/* room for the report id byte the HID backend needs */
+		dap->packet_size = max_packet_size + 1;
+
+		LOG_INFO("CMSIS-DAP: using bulk interface %d of device 0x%04x:0x%04x",
+			interface_num, dev_desc.idVendor, dev_desc.idProduct);
+
+		return ERROR_OK;
+
+error:
+		libusb_release_interface(dev_handle, interface_num);
+		libusb_close(dev_handle);
+		libusb_exit(ctx);
+		return ERROR_FAIL;
+	}
+
+	libusb_free_device_list(device_list, 1);
+	libusb_exit(ctx);
+
+	LOG_DEBUG("no CMSIS-DAP v2 device found");
+	return ERROR_FAIL;
+}
+
+static void cmsis_dap_usb_close(struct cmsis_dap *dap)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	/* cancel whatever is still on the bus before freeing it */
+	for (; bdata->count; bdata->count--) {
+		struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->get_idx];
+
+		if (!req->out_done)
+			libusb_cancel_transfer(req->out);
+		if (!req->in_done)
+			libusb_cancel_transfer(req->in);
+		cmsis_dap_usb_wait(bdata, &req->out_done);
+		cmsis_dap_usb_wait(bdata, &req->in_done);
+
+		bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+	}
+
+	libusb_release_interface(bdata->dev_handle, bdata->interface);
+	libusb_close(bdata->dev_handle);
+	libusb_exit(bdata->usb_ctx);
+
+	cmsis_dap_usb_free(bdata);
+	dap->bdata = NULL;
+}
+
+static int cmsis_dap_usb_write(struct cmsis_dap *dap, int txlen)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	if (bdata->count == MAX_PENDING_REQUESTS) {
+		LOG_ERROR("BUG: too many CMSIS-DAP requests in flight");
+		return ERROR_FAIL;
+	}
+
+	struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->put_idx];
+
+	/* the packet size may grow once the adapter reported it */
+	if (req->buf_size < dap->packet_size) {
+		uint8_t *out_buf = realloc(req->out_buf, dap->packet_size);
+		if (out_buf == NULL) {
+			LOG_ERROR("unable to allocate memory");
+			return ERROR_FAIL;
+		}
+		req->out_buf = out_buf;
+
+		uint8_t *in_buf = realloc(req->in_buf, dap->packet_size);
+		if (in_buf == NULL) {
+			LOG_ERROR("unable to allocate memory");
+			return ERROR_FAIL;
+		}
+		req->in_buf = in_buf;
+
+		req->buf_size = dap->packet_size;
+	}
+
+	/* the report id byte is not part of a bulk transfer */
+	memcpy(req->out_buf, dap->packet_buffer + 1, txlen - 1);
+
+	req->out_done = 0;
+	req->in_done = 0;
+
+	/* the reply has no timeout of its own, read() bounds the wait */
+	libusb_fill_bulk_transfer(req->in, bdata->dev_handle, bdata->ep_in,
+			req->in_buf, dap->packet_size - 1, cmsis_dap_usb_callback, &req->in_done, 0);
+	libusb_fill_bulk_transfer(req->out, bdata->dev_handle, bdata->ep_out,
+			req->out_buf, txlen - 1, cmsis_dap_usb_callback, &req->out_done, USB_TIMEOUT);
+
+	/* queue the IN transfer first so the reply always finds a buffer */
+	int retval = libusb_submit_transfer(req->in);
+	if (retval != 0) {
+		LOG_ERROR("error submitting USB read: %s", libusb_error_name(retval));
+		return ERROR_FAIL;
+	}
+
+	retval = libusb_submit_transfer(req->out);
+	if (retval != 0) {
+		LOG_ERROR("error writing data: %s", libusb_error_name(retval));
+		libusb_cancel_transfer(req->in);
+		cmsis_dap_usb_wait(bdata, &req->in_done);
+		return ERROR_FAIL;
+	}
+
+	bdata->put_idx = (bdata->put_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->count++;
+
+	return ERROR_OK;
+}
+
+static int cmsis_dap_usb_read(struct cmsis_dap *dap, int timeout_ms)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	if (bdata->count == 0) {
+		LOG_ERROR("BUG: no CMSIS-DAP request to read the reply of");
+		return ERROR_FAIL;
+	}
+
+	struct cmsis_dap_bulk_request *req = &bdata->requests[bdata->get_idx];
+	int64_t deadline = timeval_ms() + timeout_ms;
+
+	while (!req->in_done) {
+		int64_t left = deadline - timeval_ms();
+		if (left <= 0)
+			break;
+
+		struct timeval tv = {
+			.tv_sec = left / 1000,
+			.tv_usec = (left % 1000) * 1000,
+		};
+		int retval = libusb_handle_events_timeout_completed(bdata->usb_ctx, &tv, &req->in_done);
+		if (retval != 0 && retval != LIBUSB_ERROR_INTERRUPTED) {
+			LOG_ERROR("libusb event handling failed: %s", libusb_error_name(retval));
+			break;
+		}
+	}
+
+	if (!req->in_done) {
+		libusb_cancel_transfer(req->in);
+		cmsis_dap_usb_wait(bdata, &req->in_done);
+	}
+	cmsis_dap_usb_wait(bdata, &req->out_done);
+
+	bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->count--;
+
+	if (req->out->status != LIBUSB_TRANSFER_COMPLETED) {
+		LOG_ERROR("error writing data: transfer status %d", req->out->status);
+		return ERROR_FAIL;
+	}
+
+	if (req->in->status != LIBUSB_TRANSFER_COMPLETED || req->in->actual_length == 0) {
+		LOG_DEBUG("error reading data: transfer status %d", req->in->status);
+		return ERROR_FAIL;
+	}
+
+	memcpy(dap->packet_buffer, req->in_buf, req->in->actual_length);
+	memset(dap->packet_buffer + req->in->actual_length, 0,
+			dap->packet_size - req->in->actual_length);
+
+	return ERROR_OK;
+}
+
+const struct cmsis_dap_backend cmsis_dap_usb_bulk_backend = {
+	.name = "usb_bulk",
+	.open = cmsis_dap_usb_open,
+	.close = cmsis_dap_usb_close,
+	.write = cmsis_dap_usb_write,
+	.read = cmsis_dap_usb_read,
+};
@@ -42,6 +42,54 @@
 #define CMD_SCAN_CHAIN		2
 #define CMD_SCAN_CHAIN_FLIP_TMS	3
 #define CMD_STOP_SIMU		4
+#define CMD_SET_PROTOCOL	5
+
+/*
+ * Protocol versions.
+ *
+ * Version 1 exchanges a fixed size struct vpi_cmd for every command and
+ * waits for the whole struct to come back after each scan.
+ *
+ * Version 2 (streaming) is negotiated with a version 1 CMD_SET_PROTOCOL
+ * command carrying the requested version in nb_bits. A server supporting
+ * it answers with the same command, the accepted version in nb_bits and
+ * JTAG_VPI_MAGIC in the first bytes of buffer_in; a version 1 server
+ * does not answer or answers without the magic. The server keeps using
+ * version 1 until the client confirms the switch with a second
+ * CMD_SET_PROTOCOL carrying the version in nb_bits and JTAG_VPI_MAGIC in
+ * buffer_out. A client that gave up waiting doesn't confirm, and skips
+ * the late answer when it shows up in place of a version 1 reply.
+ *
+ * After that, commands are variable length frames, integers little endian:
+ *   uint8_t  cmd          CMD_xxx
+ *   uint8_t  flags        VPI_FLAG_xxx
+ *   uint16_t reserved     0
+ *   uint32_t nb_bits
+ *   uint8_t  payload[]    DIV_ROUND_UP(nb_bits, 8) bytes of TMS or TDI,
+ *                         none for CMD_RESET or with VPI_FLAG_NO_TDI
+ * The server answers with DIV_ROUND_UP(nb_bits, 8) bytes of TDO to frames
+ * flagged VPI_FLAG_CAPTURE only, in order. Frames are buffered and sent
+ * in bulk; the driver only waits for replies at the end of the queue or
+ * when enough TDO is outstanding.
+ */
+#define JTAG_VPI_PROTOCOL_AUTO		0
+#define JTAG_VPI_PROTOCOL_LEGACY	1
+#define JTAG_VPI_PROTOCOL_STREAM	2
+
+#define JTAG_VPI_MAGIC			"VPI2"
+#define JTAG_VPI_NEGOTIATE_TIMEOUT_MS	1000
+
+#define VPI_FLAG_CAPTURE	0x01	/* reply with TDO */
+#define VPI_FLAG_NO_TDI		0x02	/* no payload, TDI held high */
+#define VPI_FLAG_TRST		0x04	/* CMD_RESET: assert TRST */
+#define VPI_FLAG_SRST		0x08	/* CMD_RESET: assert SRST */
+
+#define VPI_FRAME_HEADER_SIZE	8
+/* largest scan payload per frame */
+#define VPI_STREAM_XFER_MAX_SIZE	4096
+/* send the buffered frames once this much output or expected TDO piles
+ * up, so neither side can block on a full socket */
+#define VPI_STREAM_FLUSH_SIZE		(32 * 1024)
 
 int server_port = SERVER_PORT;
 char *server_address;
@@ -49,6 +97,10 @@ char *server_address;
 int sockfd;
 struct sockaddr_in serv_addr;
 
+static int jtag_vpi_protocol = JTAG_VPI_PROTOCOL_AUTO;
+static bool jtag_vpi_stream;
+static bool jtag_vpi_negotiating;
+
 struct vpi_cmd {
 	int cmd;
 	unsigned char buffer_out[XFERT_MAX_SIZE];
@@ -57,21 +109,180 @@ struct vpi_cmd {
 	int nb_bits;
 };
 
-static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
+/* Reply expected from the server in streaming mode: either nb_bytes of
+ * TDO to store at dest, or, when scan is set, the end of that scan whose
+ * TDO is now complete in buffer. */
+struct vpi_pending {
+	uint8_t *dest;
+	size_t nb_bytes;
+	const struct scan_command *scan;
+	uint8_t *buffer;
+};
+
+static uint8_t *stream_buf;
+static size_t stream_len, stream_size;
+static struct vpi_pending *pending;
+static size_t pending_count, pending_size;
+static size_t pending_tdo_bytes;
+
+static int jtag_vpi_write_all(const void *buffer, size_t count)
 {
-	int retval = write_socket(sockfd, vpi, sizeof(struct vpi_cmd));
-	if (retval <= 0)
-		return ERROR_FAIL;
+	const uint8_t *p = buffer;
+
+	while (count > 0) {
+		int retval = write_socket(sockfd, p, count);
+		if (retval <= 0)
+			return ERROR_FAIL;
+		p += retval;
+		count -= retval;
+	}
 
 	return ERROR_OK;
 }
 
+static int jtag_vpi_read_all(void *buffer, size_t count)
+{
+	uint8_t *p = buffer;
+
+	while (count > 0) {
+		int retval = read_socket(sockfd, p, count);
+		if (retval <= 0)
+			return ERROR_FAIL;
+		p += retval;
+		count -= retval;
+	}
+
+	return ERROR_OK;
+}
+
+static int jtag_vpi_send_cmd(struct vpi_cmd *vpi)
+{
+	return jtag_vpi_write_all(vpi, sizeof(struct vpi_cmd));
+}
+
 static int jtag_vpi_receive_cmd(struct vpi_cmd *vpi)
 {
-	int retval = read_socket(sockfd, vpi, sizeof(struct vpi_cmd));
-	if (retval < (int)sizeof(struct vpi_cmd))
+	int retval;
+
+	do {
+		retval = jtag_vpi_read_all(vpi, sizeof(struct vpi_cmd));
+		/* a negotiation answer that arrived after we stopped waiting */
+	} while (retval == ERROR_OK && vpi->cmd == CMD_SET_PROTOCOL &&
+			!jtag_vpi_negotiating);
+
+	return retval;
+}
+
+/* Make room for len more bytes of frames */
+static uint8_t *jtag_vpi_stream_reserve(size_t len)
+{
+	if (stream_len + len > stream_size) {
+		size_t size = MAX(stream_size * 2, stream_len + len);
+		uint8_t *buf = realloc(stream_buf, size);
+		if (buf == NULL) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		stream_buf = buf;
+		stream_size = size;
+	}
+
+	uint8_t *p = stream_buf + stream_len;
+	stream_len += len;
+	return p;
+}
+
+static struct vpi_pending *jtag_vpi_pending_add(void)
+{
+	if (pending_count == pending_size) {
+		size_t size = pending_size ? pending_size * 2 : 64;
+		struct vpi_pending *p = realloc(pending, size * sizeof(*pending));
+		if (p == NULL) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		pending = p;
+		pending_size = size;
+	}
+
+	struct vpi_pending *p = &pending[pending_count++];
+	memset(p, 0, sizeof(*p));
+	return p;
+}
+
+static void jtag_vpi_stream_discard(void)
+{
+	for (size_t i = 0; i < pending_count; i++)
+		free(pending[i].buffer);
+
+	stream_len = 0;
+	pending_count = 0;
+	pending_tdo_bytes = 0;
+}
+
+/* Send the buffered frames, then collect the TDO replies in order */
+static int jtag_vpi_stream_flush(void)
+{
+	int retval = ERROR_OK;
+
+	if (stream_len > 0)
+		retval = jtag_vpi_write_all(stream_buf, stream_len);
+	stream_len = 0;
+
+	for (size_t i = 0; i < pending_count && retval == ERROR_OK; i++) {
+		struct vpi_pending *p = &pending[i];
+
+		if (p->scan) {
+			retval = jtag_read_buffer(p->buffer, p->scan);
+			free(p->buffer);
+			p->buffer = NULL;
+		} else {
+			retval = jtag_vpi_read_all(p->dest, p->nb_bytes);
+		}
+	}
+
+	if (retval != ERROR_OK)
+		LOG_ERROR("VPI server communication failed");
+
+	jtag_vpi_stream_discard();
+
+	return retval;
+}
+
+/* Queue one frame, capturing TDO into tdo when it is not NULL */
+static int jtag_vpi_stream_frame(int cmd, uint8_t flags, const uint8_t *payload,
+		uint32_t nb_bits, uint8_t *tdo)
+{
+	size_t nb_bytes = DIV_ROUND_UP(nb_bits, 8);
+	size_t payload_len = payload ? nb_bytes : 0;
+
+	uint8_t *p = jtag_vpi_stream_reserve(VPI_FRAME_HEADER_SIZE + payload_len);
+	if (p == NULL)
 		return ERROR_FAIL;
 
+	if (tdo)
+		flags |= VPI_FLAG_CAPTURE;
+
+	p[0] = cmd;
+	p[1] = flags;
+	p[2] = 0;
+	p[3] = 0;
+	h_u32_to_le(&p[4], nb_bits);
+	if (payload_len)
+		memcpy(&p[VPI_FRAME_HEADER_SIZE], payload, payload_len);
+
+	if (tdo) {
+		struct vpi_pending *pend = jtag_vpi_pending_add();
+		if (pend == NULL)
+			return ERROR_FAIL;
+		pend->dest = tdo;
+		pend->nb_bytes = nb_bytes;
+		pending_tdo_bytes += nb_bytes;
+	}
+
+	if (stream_len >= VPI_STREAM_FLUSH_SIZE || pending_tdo_bytes >= VPI_STREAM_FLUSH_SIZE)
+		return jtag_vpi_stream_flush();
+
 	return ERROR_OK;
 }
 
@@ -84,6 +295,10 @@ static int jtag_vpi_reset(int trst, int srst)
 {
 	struct vpi_cmd vpi;
 
+	if (jtag_vpi_stream)
+		return jtag_vpi_stream_frame(CMD_RESET,
+				(trst ? VPI_FLAG_TRST : 0) | (srst ? VPI_FLAG_SRST : 0), NULL, 0, NULL);
+
 	vpi.cmd = CMD_RESET;
 	vpi.length = 0;
 	return jtag_vpi_send_cmd(&vpi);
@@ -105,6 +320,9 @@ static int jtag_vpi_tms_seq(const uint8_t *bits, int nb_bits)
 	struct vpi_cmd vpi;
 	int nb_bytes;
 
+	if (jtag_vpi_stream)
+		return jtag_vpi_stream_frame(CMD_TMS_SEQ, 0, bits, nb_bits, NULL);
+
 	nb_bytes = DIV_ROUND_UP(nb_bits, 8);
 
 	vpi.cmd = CMD_TMS_SEQ;
@@ -167,11 +385,15 @@ static int jtag_vpi_state_move(tap_state_t state)
 	return ERROR_OK;
 }
 
-static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
+static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift, bool capture)
 {
 	struct vpi_cmd vpi;
 	int nb_bytes = DIV_ROUND_UP(nb_bits, 8);
 
+	if (jtag_vpi_stream)
+		return jtag_vpi_stream_frame(tap_shift ? CMD_SCAN_CHAIN_FLIP_TMS : CMD_SCAN_CHAIN,
+				bits ? 0 : VPI_FLAG_NO_TDI, bits, nb_bits, capture ? bits : NULL);
+
 	vpi.cmd = tap_shift ? CMD_SCAN_CHAIN_FLIP_TMS : CMD_SCAN_CHAIN;
 
 	if (bits)
@@ -200,10 +422,12 @@ static int jtag_vpi_queue_tdi_xfer(uint8_t *bits, int nb_bits, int tap_shift)
  * jtag_vpi_queue_tdi - short description
  * @bits: bits to be queued on TDI (or NULL if 0 are to be queued)
  * @nb_bits: number of bits
+ * @capture: whether TDO is needed, the streaming protocol skips it otherwise
  */
-static int jtag_vpi_queue_tdi(uint8_t *bits, int nb_bits, int tap_shift)
+static int jtag_vpi_queue_tdi(uint8_t *bits, int nb_bits, int tap_shift, bool capture)
 {
-	int nb_xfer = DIV_ROUND_UP(nb_bits, XFERT_MAX_SIZE * 8);
+	int xfer_max_size = jtag_vpi_stream ? VPI_STREAM_XFER_MAX_SIZE : XFERT_MAX_SIZE;
+	int nb_xfer = DIV_ROUND_UP(nb_bits, xfer_max_size * 8);
 	uint8_t *xmit_buffer = bits;
 	int xmit_nb_bits = nb_bits;
 	int i = 0;
@@ -212,15 +436,17 @@ static int jtag_vpi_queue_tdi(uint8_t *bits, int nb_bits, int tap_shift)
 	while (nb_xfer) {
 
 		if (nb_xfer ==  1) {
-			retval = jtag_vpi_queue_tdi_xfer(&xmit_buffer[i], xmit_nb_bits, tap_shift);
+			retval = jtag_vpi_queue_tdi_xfer(xmit_buffer ? &xmit_buffer[i] : NULL,
+					xmit_nb_bits, tap_shift, capture);
 			if (retval != ERROR_OK)
 				return retval;
 		} else {
-			retval = jtag_vpi_queue_tdi_xfer(&xmit_buffer[i], XFERT_MAX_SIZE * 8, NO_TAP_SHIFT);
+			retval = jtag_vpi_queue_tdi_xfer(xmit_buffer ? &xmit_buffer[i] : NULL,
+					xfer_max_size * 8, NO_TAP_SHIFT, capture);
 			if (retval != ERROR_OK)
 				return retval;
-			xmit_nb_bits -= XFERT_MAX_SIZE * 8;
-			i += XFERT_MAX_SIZE;
+			xmit_nb_bits -= xfer_max_size * 8;
+			i += xfer_max_size;
 		}
 
 		nb_xfer--;
@@ -256,6 +482,7 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 	int scan_bits;
 	uint8_t *buf = NULL;
 	int retval = ERROR_OK;
+	bool capture = jtag_scan_type(cmd) != SCAN_OUT;
 
 	scan_bits = jtag_build_buffer(cmd, &buf);
 
@@ -270,11 +497,11 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 	}
 
 	if (cmd->end_state == TAP_DRSHIFT) {
-		retval = jtag_vpi_queue_tdi(buf, scan_bits, NO_TAP_SHIFT);
+		retval = jtag_vpi_queue_tdi(buf, scan_bits, NO_TAP_SHIFT, capture);
 		if (retval != ERROR_OK)
 			return retval;
 	} else {
-		retval = jtag_vpi_queue_tdi(buf, scan_bits, TAP_SHIFT);
+		retval = jtag_vpi_queue_tdi(buf, scan_bits, TAP_SHIFT, capture);
 		if (retval != ERROR_OK)
 			return retval;
 	}
@@ -294,12 +521,27 @@ static int jtag_vpi_scan(struct scan_command *cmd)
 			tap_set_state(TAP_DRPAUSE);
 	}
 
-	retval = jtag_read_buffer(buf, cmd);
-	if (retval != ERROR_OK)
-		return retval;
+	if (jtag_vpi_stream) {
+		/* TDO arrives when the frames are flushed */
+		if (capture) {
+			struct vpi_pending *pend = jtag_vpi_pending_add();
+			if (pend == NULL) {
+				free(buf);
+				return ERROR_FAIL;
+			}
+			pend->scan = cmd;
+			pend->buffer = buf;
+		} else {
+			free(buf);
+		}
+	} else {
+		retval = jtag_read_buffer(buf, cmd);
+		if (retval != ERROR_OK)
+			return retval;
 
-	if (buf)
-		free(buf);
+		if (buf)
+			free(buf);
+	}
 
 	if (cmd->end_state != TAP_DRSHIFT) {
 		retval = jtag_vpi_state_move(cmd->end_state);
@@ -319,9 +561,9 @@ static int jtag_vpi_runtest(int cycles, tap_state_t state)
 		return retval;
 
 #if BUILD_RISCV == 1
-	retval = jtag_vpi_queue_tdi(NULL, cycles, NO_TAP_SHIFT);
+	retval = jtag_vpi_queue_tdi(NULL, cycles, NO_TAP_SHIFT, false);
 #else
-	retval = jtag_vpi_queue_tdi(NULL, cycles, TAP_SHIFT);
+	retval = jtag_vpi_queue_tdi(NULL, cycles, TAP_SHIFT, false);
 #endif
 	if (retval != ERROR_OK)
 		return retval;
@@ -331,7 +573,7 @@ static int jtag_vpi_runtest(int cycles, tap_state_t state)
 
 static int jtag_vpi_stableclocks(int cycles)
 {
-	return jtag_vpi_queue_tdi(NULL, cycles, TAP_SHIFT);
+	return jtag_vpi_queue_tdi(NULL, cycles, TAP_SHIFT, false);
 }
 
 static int jtag_vpi_execute_queue(void)
@@ -362,7 +604,10 @@ static int jtag_vpi_execute_queue(void)
 			retval = jtag_vpi_tms(cmd->cmd.tms);
 			break;
 		case JTAG_SLEEP:
-			jtag_sleep(cmd->cmd.sleep->us);
+			/* the sleep must follow what was queued before it */
+			retval = jtag_vpi_stream_flush();
+			if (retval == ERROR_OK)
+				jtag_sleep(cmd->cmd.sleep->us);
 			break;
 		case JTAG_SCAN:
 			retval = jtag_vpi_scan(cmd->cmd.scan);
@@ -370,9 +615,80 @@ static int jtag_vpi_execute_queue(void)
 		}
 	}
 
+	if (retval == ERROR_OK)
+		retval = jtag_vpi_stream_flush();
+	else
+		jtag_vpi_stream_discard();
+
 	return retval;
 }
 
+/* Wait up to timeout_ms for the socket to become readable */
+static bool jtag_vpi_wait_readable(int timeout_ms)
+{
+	fd_set read_fds;
+	struct timeval tv = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_usec = (timeout_ms % 1000) * 1000,
+	};
+
+	FD_ZERO(&read_fds);
+	FD_SET(sockfd, &read_fds);
+
+	return socket_select(sockfd + 1, &read_fds, NULL, NULL, &tv) > 0;
+}
+
+/* Ask the server for the streaming protocol, see the protocol description
+ * at the top of this file */
+static int jtag_vpi_negotiate(void)
+{
+	struct vpi_cmd vpi;
+
+	memset(&vpi, 0, sizeof(vpi));
+	vpi.cmd = CMD_SET_PROTOCOL;
+	vpi.nb_bits = JTAG_VPI_PROTOCOL_STREAM;
+
+	int retval = jtag_vpi_send_cmd(&vpi);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* An old server won't answer at all, don't wait for it forever
+	 * unless the streaming protocol was explicitly requested */
+	if (jtag_vpi_protocol == JTAG_VPI_PROTOCOL_AUTO &&
+			!jtag_vpi_wait_readable(JTAG_VPI_NEGOTIATE_TIMEOUT_MS)) {
+		LOG_INFO("VPI server does not support the streaming protocol");
+		return ERROR_OK;
+	}
+
+	jtag_vpi_negotiating = true;
+	retval = jtag_vpi_receive_cmd(&vpi);
+	jtag_vpi_negotiating = false;
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (vpi.cmd == CMD_SET_PROTOCOL && vpi.nb_bits == JTAG_VPI_PROTOCOL_STREAM &&
+			memcmp(vpi.buffer_in, JTAG_VPI_MAGIC, strlen(JTAG_VPI_MAGIC)) == 0) {
+		/* confirm, the server switches once it sees this */
+		memset(&vpi, 0, sizeof(vpi));
+		vpi.cmd = CMD_SET_PROTOCOL;
+		vpi.nb_bits = JTAG_VPI_PROTOCOL_STREAM;
+		memcpy(vpi.buffer_out, JTAG_VPI_MAGIC, strlen(JTAG_VPI_MAGIC));
+		retval = jtag_vpi_send_cmd(&vpi);
+		if (retval != ERROR_OK)
+			return retval;
+
+		jtag_vpi_stream = true;
+		LOG_INFO("Using the VPI streaming protocol");
+	} else if (jtag_vpi_protocol == JTAG_VPI_PROTOCOL_STREAM) {
+		LOG_ERROR("VPI server refused the streaming protocol");
+		return ERROR_FAIL;
+	} else {
+		LOG_INFO("VPI server does not support the streaming protocol");
+	}
+
+	return ERROR_OK;
+}
+
 static int jtag_vpi_init(void)
 {
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -404,11 +720,23 @@ static int jtag_vpi_init(void)
 
 	LOG_INFO("Connection to %s : %u succeed", server_address, server_port);
 
+	jtag_vpi_stream = false;
+	if (jtag_vpi_protocol != JTAG_VPI_PROTOCOL_LEGACY)
+		return jtag_vpi_negotiate();
+
 	return ERROR_OK;
 }
 
 static int jtag_vpi_quit(void)
 {
+	jtag_vpi_stream_discard();
+	free(stream_buf);
+	stream_buf = NULL;
+	stream_size = 0;
+	free(pending);
+	pending = NULL;
+	pending_size = 0;
+
 	free(server_address);
 	return close(sockfd);
 }
@@ -440,6 +768,23 @@ COMMAND_HANDLER(jtag_vpi_set_address)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(jtag_vpi_set_protocol)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strcmp(CMD_ARGV[0], "auto") == 0)
+		jtag_vpi_protocol = JTAG_VPI_PROTOCOL_AUTO;
+	else if (strcmp(CMD_ARGV[0], "1") == 0)
+		jtag_vpi_protocol = JTAG_VPI_PROTOCOL_LEGACY;
+	else if (strcmp(CMD_ARGV[0], "2") == 0)
+		jtag_vpi_protocol = JTAG_VPI_PROTOCOL_STREAM;
+	else
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_vpi_command_handlers[] = {
 	{
 		.name = "jtag_vpi_set_port",
@@ -455,6 +800,14 @@ static const struct command_registration jtag_vpi_command_handlers[] = {
 		.help = "set the address of the VPI server",
 		.usage = "description_string",
 	},
+	{
+		.name = "jtag_vpi_set_protocol",
+		.handler = &jtag_vpi_set_protocol,
+		.mode = COMMAND_CONFIG,
+		.help = "set the VPI protocol version: 1 (one round trip per command), "
+			"2 (streaming) or auto (negotiate)",
+		.usage = "(auto | 1 | 2)",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -30,6 +30,11 @@
 /* arbitrary limit on host name length: */
 #define REMOTE_BITBANG_HOST_MAX 255
 
+/* Number of TDO samples that may be requested before the responses are read
+ * back. The responses have to fit in the socket buffers while we keep on
+ * writing, so stay well below the usual socket buffer sizes. */
+#define REMOTE_BITBANG_BUF_SIZE 4096
+
 #define REMOTE_BITBANG_RAISE_ERROR(expr ...) \
 	do { \
 		LOG_ERROR(expr); \
@@ -40,73 +45,49 @@
 static char *remote_bitbang_host;
 static char *remote_bitbang_port;
 
-// [ILG] WORKAROUND
-#if 0 //BUILD_RISCV == 1
 static FILE *remote_bitbang_in;
 static FILE *remote_bitbang_out;
-static int remote_bitbang_fd;
 
-/* Circular buffer. When start == end, the buffer is empty. */
-static char remote_bitbang_buf[64];
-static unsigned remote_bitbang_start;
-static unsigned remote_bitbang_end;
+/* Send repeated clock cycles as 'C<count>;' run-length requests. */
+static bool remote_bitbang_use_rle;
+
+/* Run-length encoder state. A write with TCK low is held back until the next
+ * write shows whether it starts another repetition of the last clock cycle
+ * (a TCK low write followed by the matching TCK high write). */
+static int rle_held = -1;
+static int rle_cycle_low = -1;
+static int rle_cycle_high;
+static unsigned rle_repeat;
 
-static int remote_bitbang_buf_full(void)
+static void remote_bitbang_putc(int c)
 {
-	return remote_bitbang_end ==
-		((remote_bitbang_start + sizeof(remote_bitbang_buf) - 1) %
-		 sizeof(remote_bitbang_buf));
+	if (EOF == fputc(c, remote_bitbang_out))
+		REMOTE_BITBANG_RAISE_ERROR("remote_bitbang_putc: %s", strerror(errno));
 }
 
-/* Read any incoming data, placing it into the buffer. */
-static void remote_bitbang_fill_buf(void)
+/* Emit the pending clock run and any held back write. Must be called before
+ * any request other than a write is sent. */
+static void remote_bitbang_rle_flush(void)
 {
-	fcntl(remote_bitbang_fd, F_SETFL, O_NONBLOCK);
-	while (!remote_bitbang_buf_full()) {
-		unsigned contiguous_available_space;
-		if (remote_bitbang_end >= remote_bitbang_start) {
-			contiguous_available_space = sizeof(remote_bitbang_buf) -
-				remote_bitbang_end;
-			if (remote_bitbang_start == 0)
-				contiguous_available_space -= 1;
-		} else {
-			contiguous_available_space = remote_bitbang_start -
-				remote_bitbang_end - 1;
-		}
-		ssize_t count = read(remote_bitbang_fd,
-				remote_bitbang_buf + remote_bitbang_end,
-				contiguous_available_space);
-		if (count > 0) {
-			remote_bitbang_end += count;
-			// TODO: check for overflow.
-			if (remote_bitbang_end == sizeof(remote_bitbang_buf)) {
-				remote_bitbang_end = 0;
-			}
-		} else if (count == 0) {
-			return;
-		} else if (count < 0) {
-			if (errno == EAGAIN) {
-				return;
-			} else {
-				REMOTE_BITBANG_RAISE_ERROR("remote_bitbang_fill_buf: %s (%d)",
-						strerror(errno), errno);
-			}
-		}
+	if (rle_repeat == 1) {
+		remote_bitbang_putc(rle_cycle_low);
+		remote_bitbang_putc(rle_cycle_high);
+	} else if (rle_repeat > 1) {
+		if (fprintf(remote_bitbang_out, "C%u;", rle_repeat) < 0)
+			REMOTE_BITBANG_RAISE_ERROR("remote_bitbang_rle_flush: %s", strerror(errno));
 	}
-}
-#else
-FILE *remote_bitbang_in;
-FILE *remote_bitbang_out;
-#endif
+	rle_repeat = 0;
 
-static void remote_bitbang_putc(int c)
-{
-	if (EOF == fputc(c, remote_bitbang_out))
-		REMOTE_BITBANG_RAISE_ERROR("remote_bitbang_putc: %s", strerror(errno));
+	if (rle_held >= 0) {
+		remote_bitbang_putc(rle_held);
+		rle_held = -1;
+		rle_cycle_low = -1;
+	}
 }
 
 static int remote_bitbang_quit(void)
 {
+	remote_bitbang_rle_flush();
 	if (EOF == fputc('Q', remote_bitbang_out)) {
 		LOG_ERROR("fputs: %s", strerror(errno));
 		return ERROR_FAIL;
@@ -131,10 +112,15 @@ static int remote_bitbang_quit(void)
 	return ERROR_OK;
 }
 
-// [ILG] WORKAROUND
-#if 0 //BUILD_RISCV == 1
-static int char_to_int(int c)
+/* Get the next read response. */
+static int remote_bitbang_rread(void)
 {
+	if (EOF == fflush(remote_bitbang_out)) {
+		remote_bitbang_quit();
+		REMOTE_BITBANG_RAISE_ERROR("fflush: %s", strerror(errno));
+	}
+
+	int c = fgetc(remote_bitbang_in);
 	switch (c) {
 		case '0':
 			return 0;
@@ -147,100 +133,105 @@ static int char_to_int(int c)
 	}
 }
 
-/* Get the next read response. */
-static int remote_bitbang_rread(void)
+static int remote_bitbang_read(void)
 {
-	if (EOF == fflush(remote_bitbang_out)) {
-		remote_bitbang_quit();
-		REMOTE_BITBANG_RAISE_ERROR("fflush: %s", strerror(errno));
-	}
-
-	/* Enable blocking access. */
-	fcntl(remote_bitbang_fd, F_SETFL, 0);
-	char c;
-	ssize_t count = read(remote_bitbang_fd, &c, 1);
-	if (count == 1) {
-		return char_to_int(c);
-	} else {
-		remote_bitbang_quit();
-		REMOTE_BITBANG_RAISE_ERROR("read: count=%d, error=%s", (int) count,
-				strerror(errno));
-	}
+	remote_bitbang_rle_flush();
+	remote_bitbang_putc('R');
+	return remote_bitbang_rread();
 }
 
+/* Request a TDO sample without waiting for it; the responses are collected
+ * in order by remote_bitbang_read_sample(). */
 static void remote_bitbang_sample(void)
 {
-	remote_bitbang_fill_buf();
-	assert(!remote_bitbang_buf_full());
+	remote_bitbang_rle_flush();
 	remote_bitbang_putc('R');
 }
 
 static int remote_bitbang_read_sample(void)
 {
-	if (remote_bitbang_start != remote_bitbang_end) {
-		int c = remote_bitbang_buf[remote_bitbang_start];
-		remote_bitbang_start = 
-			(remote_bitbang_start + 1) % sizeof(remote_bitbang_buf);
-		return char_to_int(c);
-	}
+	/* The first call flushes all queued requests; the responses then
+	 * arrive in bulk through the stdio buffer of remote_bitbang_in. */
 	return remote_bitbang_rread();
 }
-#else
-/* Get the next read response. */
-static int remote_bitbang_rread(void)
+
+static int remote_bitbang_flush(void)
 {
+	remote_bitbang_rle_flush();
 	if (EOF == fflush(remote_bitbang_out)) {
-		remote_bitbang_quit();
-		REMOTE_BITBANG_RAISE_ERROR("fflush: %s", strerror(errno));
-	}
-
-	int c = fgetc(remote_bitbang_in);
-	switch (c) {
-		case '0':
-			return 0;
-		case '1':
-			return 1;
-		default:
-			remote_bitbang_quit();
-			REMOTE_BITBANG_RAISE_ERROR(
-					"remote_bitbang: invalid read response: %c(%i)", c, c);
+		LOG_ERROR("fflush: %s", strerror(errno));
+		return ERROR_FAIL;
 	}
+	return ERROR_OK;
 }
 
-static int remote_bitbang_read(void)
-{
-	remote_bitbang_putc('R');
-	return remote_bitbang_rread();
-}
-#endif
-
 static void remote_bitbang_write(int tck, int tms, int tdi)
 {
 	char c = '0' + ((tck ? 0x4 : 0x0) | (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
+
+	if (!remote_bitbang_use_rle) {
+		remote_bitbang_putc(c);
+		return;
+	}
+
+	if (rle_held >= 0) {
+		/* setting the same levels again is a no-op */
+		if (c == rle_held)
+			return;
+
+		if (c == rle_held + 0x4) {
+			/* a full clock cycle */
+			int low = rle_held;
+			rle_held = -1;
+			if (low == rle_cycle_low && c == rle_cycle_high) {
+				rle_repeat++;
+				return;
+			}
+			remote_bitbang_rle_flush();
+			remote_bitbang_putc(low);
+			remote_bitbang_putc(c);
+			rle_cycle_low = low;
+			rle_cycle_high = c;
+			return;
+		}
+	}
+
+	/* this may start another repetition of the last cycle, so keep the
+	 * run going until the next write shows whether it does */
+	if (rle_held < 0 && c == rle_cycle_low) {
+		rle_held = c;
+		return;
+	}
+
+	remote_bitbang_rle_flush();
+	if (!tck) {
+		rle_held = c;
+		return;
+	}
 	remote_bitbang_putc(c);
+	rle_cycle_low = -1;
 }
 
 static void remote_bitbang_reset(int trst, int srst)
 {
 	char c = 'r' + ((trst ? 0x2 : 0x0) | (srst ? 0x1 : 0x0));
+	remote_bitbang_rle_flush();
 	remote_bitbang_putc(c);
 }
 
 static void remote_bitbang_blink(int on)
 {
 	char c = on ? 'B' : 'b';
+	remote_bitbang_rle_flush();
 	remote_bitbang_putc(c);
 }
 
 static struct bitbang_interface remote_bitbang_bitbang = {
-// [ILG] WORKAROUND
-#if 0 //BUILD_RISCV == 1
-	.buf_size = sizeof(remote_bitbang_buf) - 1,
+	.buf_size = REMOTE_BITBANG_BUF_SIZE,
 	.sample = &remote_bitbang_sample,
 	.read_sample = &remote_bitbang_read_sample,
-#else
 	.read = &remote_bitbang_read,
-#endif
+	.flush = &remote_bitbang_flush,
 	.write = &remote_bitbang_write,
 	.reset = &remote_bitbang_reset,
 	.blink = &remote_bitbang_blink,
@@ -322,34 +313,13 @@ static int remote_bitbang_init_unix(void)
 
 static int remote_bitbang_init(void)
 {
-// [ILG] WORKAROUND
-#if 0 //BUILD_RISCV == 1
+	int fd;
 	bitbang_interface = &remote_bitbang_bitbang;
 
-	remote_bitbang_start = 0;
-	remote_bitbang_end = 0;
+	rle_held = -1;
+	rle_cycle_low = -1;
+	rle_repeat = 0;
 
-	LOG_INFO("Initializing remote_bitbang driver");
-	if (remote_bitbang_port == NULL)
-		remote_bitbang_fd = remote_bitbang_init_unix();
-	else
-		remote_bitbang_fd = remote_bitbang_init_tcp();
-
-	if (remote_bitbang_fd < 0)
-		return remote_bitbang_fd;
-
-	remote_bitbang_in = fdopen(remote_bitbang_fd, "r");
-	if (remote_bitbang_in == NULL) {
-		LOG_ERROR("fdopen: failed to open read stream");
-		close(remote_bitbang_fd);
-		return ERROR_FAIL;
-	}
-
-	remote_bitbang_out = fdopen(remote_bitbang_fd, "w");
-#else
-	int fd;
-	bitbang_interface = &remote_bitbang_bitbang;
-	
 	LOG_INFO("Initializing remote_bitbang driver");
 	if (remote_bitbang_port == NULL)
 		fd = remote_bitbang_init_unix();
@@ -367,7 +337,6 @@ static int remote_bitbang_init(void)
 	}
 
 	remote_bitbang_out = fdopen(fd, "w");
-#endif
 	if (remote_bitbang_out == NULL) {
 		LOG_ERROR("fdopen: failed to open write stream");
 		fclose(remote_bitbang_in);
@@ -400,6 +369,15 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_rle_command)
+{
+	if (CMD_ARGC == 1) {
+		COMMAND_PARSE_ON_OFF(CMD_ARGV[0], remote_bitbang_use_rle);
+		return ERROR_OK;
+	}
+	return ERROR_COMMAND_SYNTAX_ERROR;
+}
+
 static const struct command_registration remote_bitbang_command_handlers[] = {
 	{
 		.name = "remote_bitbang_port",
@@ -417,6 +395,14 @@ static const struct command_registration remote_bitbang_command_handlers[] = {
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "remote_bitbang_rle",
+		.handler = remote_bitbang_handle_remote_bitbang_rle_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Send repeated clock cycles as run-length encoded requests.\n"
+			"  The remote side must understand the 'C<count>;' request.",
+		.usage = "('on'|'off')",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
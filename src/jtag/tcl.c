@@ -831,6 +831,24 @@ COMMAND_HANDLER(handle_jtag_init_command)
 	return jtag_init(CMD_CTX);
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	struct cmd_queue_stats stats;
+	cmd_queue_get_stats(&stats);
+
+	command_print(CMD_CTX, "allocations: %" PRIu64 " (%" PRIu64 " bytes)",
+			stats.allocs, stats.bytes);
+	command_print(CMD_CTX, "queue resets: %" PRIu64, stats.resets);
+	command_print(CMD_CTX, "pages allocated: %" PRIu64 ", kept: %u",
+			stats.page_mallocs, stats.pages);
+	command_print(CMD_CTX, "high water mark: %zu bytes", stats.high_water);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -913,6 +931,13 @@ static const struct command_registration jtag_subcommand_handlers[] = {
 		.jim_handler = jim_jtag_names,
 		.help = "Returns list of all JTAG tap names.",
 	},
+	{
+		.name = "queue_stats",
+		.mode = COMMAND_EXEC,
+		.handler = handle_jtag_queue_stats_command,
+		.help = "Show allocation counters of the JTAG command queue.",
+		.usage = "",
+	},
 	{
 		.chain = jtag_command_handlers_to_move,
 	},
@@ -104,6 +104,7 @@ static int FreeRTOS_create(struct target *target);
 static int FreeRTOS_update_threads(struct rtos *rtos);
 static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, char **hex_reg_list);
 static int FreeRTOS_get_symbol_list_to_lookup(symbol_table_elem_t *symbol_list[]);
+static int FreeRTOS_prefetch_thread_reg_lists(struct rtos *rtos);
 
 struct rtos_type FreeRTOS_rtos = {
 	.name = "FreeRTOS",
@@ -113,6 +114,7 @@ struct rtos_type FreeRTOS_rtos = {
 	.update_threads = FreeRTOS_update_threads,
 	.get_thread_reg_list = FreeRTOS_get_thread_reg_list,
 	.get_symbol_list_to_lookup = FreeRTOS_get_symbol_list_to_lookup,
+	.prefetch_thread_reg_lists = FreeRTOS_prefetch_thread_reg_lists,
 };
 
 enum FreeRTOS_symbol_values {
@@ -154,11 +156,44 @@ static const struct symbols FreeRTOS_symbol_list[] = {
 /* may be problems reading if sizes are not 32 bit long integers. */
 /* test mallocs for failure */
 
+static uint64_t FreeRTOS_get_uint(struct target *target, const uint8_t *buf,
+		unsigned width)
+{
+	switch (width) {
+		case 2:
+			return target_buffer_get_u16(target, buf);
+		case 8:
+			return target_buffer_get_u64(target, buf);
+		default:
+			return target_buffer_get_u32(target, buf);
+	}
+}
+
+/* Fill in the "Current Execution" pseudo thread. With @a allocate set, the
+ * thread list is created with just that entry. */
+static int FreeRTOS_add_current_execution(struct rtos *rtos, bool allocate)
+{
+	char tmp_str[] = "Current Execution";
+
+	if (allocate) {
+		rtos->thread_details = calloc(1, sizeof(struct thread_detail));
+		if (!rtos->thread_details) {
+			LOG_ERROR("Error allocating memory for %d threads", 1);
+			return ERROR_FAIL;
+		}
+	}
+	rtos->thread_details->threadid = 1;
+	rtos->thread_details->exists = true;
+	rtos->thread_details->extra_info_str = NULL;
+	rtos->thread_details->thread_name_str = malloc(sizeof(tmp_str));
+	strcpy(rtos->thread_details->thread_name_str, tmp_str);
+	return ERROR_OK;
+}
+
 static int FreeRTOS_update_threads(struct rtos *rtos)
 {
 	int i = 0;
 	int retval;
-	int tasks_found = 0;
 	const struct FreeRTOS_params *param;
 
 	if (rtos->rtos_specific_params == NULL)
@@ -206,37 +241,16 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 										rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address,
 										rtos->current_thread);
 
-	if ((thread_list_size  == 0) || (rtos->current_thread == 0)) {
-		/* Either : No RTOS threads - there is always at least the current execution though */
-		/* OR     : No current thread - all threads suspended - show the current execution
-		 * of idling */
-		char tmp_str[] = "Current Execution";
-		thread_list_size++;
-		tasks_found++;
-		rtos->thread_details = malloc(
-				sizeof(struct thread_detail) * thread_list_size);
-		if (!rtos->thread_details) {
-			LOG_ERROR("Error allocating memory for %d threads", thread_list_size);
-			return ERROR_FAIL;
-		}
-		rtos->thread_details->threadid = 1;
-		rtos->thread_details->exists = true;
-		rtos->thread_details->extra_info_str = NULL;
-		rtos->thread_details->thread_name_str = malloc(sizeof(tmp_str));
-		strcpy(rtos->thread_details->thread_name_str, tmp_str);
+	/* Either : No RTOS threads - there is always at least the current execution though */
+	/* OR     : No current thread - all threads suspended - show the current execution
+	 * of idling */
+	bool show_current_execution = (thread_list_size == 0) || (rtos->current_thread == 0);
 
-		if (thread_list_size == 1) {
+	if (thread_list_size == 0) {
+		retval = FreeRTOS_add_current_execution(rtos, true);
+		if (retval == ERROR_OK)
 			rtos->thread_count = 1;
-			return ERROR_OK;
-		}
-	} else {
-		/* create space for new thread details */
-		rtos->thread_details = malloc(
-				sizeof(struct thread_detail) * thread_list_size);
-		if (!rtos->thread_details) {
-			LOG_ERROR("Error allocating memory for %d threads", thread_list_size);
-			return ERROR_FAIL;
-		}
+		return retval;
 	}
 
 	/* Find out how many lists are needed to be read from pxReadyTasksLists, */
@@ -279,59 +293,66 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xSuspendedTaskList].address;
 	list_of_lists[num_lists++] = rtos->symbols[FreeRTOS_VAL_xTasksWaitingTermination].address;
 
+	/* Only lists whose header (item count, index and end marker pointers)
+	 * changed since the last update are walked again. */
+	retval = rtos_thread_cache_init(rtos, num_lists, param->list_width);
+	if (retval != ERROR_OK) {
+		free(list_of_lists);
+		return retval;
+	}
+
+	int lists_walked = 0;
 	for (i = 0; i < num_lists; i++) {
-		if (list_of_lists[i] == 0)
-			continue;
+		const uint8_t *header;
+		bool changed;
 
-		/* Read the number of threads in this list */
-		int64_t list_thread_count = 0;
-		retval = target_read_buffer(rtos->target,
-				list_of_lists[i],
-				param->thread_count_width,
-				(uint8_t *)&list_thread_count);
+		retval = rtos_thread_cache_check_list(rtos, i, list_of_lists[i], &header, &changed);
 		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading number of threads in FreeRTOS thread list");
+			LOG_ERROR("Error reading FreeRTOS thread list header");
 			free(list_of_lists);
 			return retval;
 		}
+		if (!changed)
+			continue;
+		lists_walked++;
+
+		/* The number of threads in this list */
+		int64_t list_thread_count = FreeRTOS_get_uint(rtos->target, header,
+				param->thread_count_width);
 		LOG_DEBUG("FreeRTOS: Read thread count for list %d at 0x%" PRIx64 ", value %" PRId64 "\r\n",
 										i, list_of_lists[i], list_thread_count);
 
 		if (list_thread_count == 0)
 			continue;
 
-		/* Read the location of first list item */
+		/* The location of first list item */
 		uint64_t prev_list_elem_ptr = -1;
-		uint64_t list_elem_ptr = 0;
-		retval = target_read_buffer(rtos->target,
-				list_of_lists[i] + param->list_next_offset,
-				param->pointer_width,
-				(uint8_t *)&list_elem_ptr);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
-		}
+		uint64_t list_elem_ptr = FreeRTOS_get_uint(rtos->target,
+				header + param->list_next_offset, param->pointer_width);
 		LOG_DEBUG("FreeRTOS: Read first item for list %d at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
 										i, list_of_lists[i] + param->list_next_offset, list_elem_ptr);
 
+		/* The list item fields we need, next pointer and owner, are read
+		 * with a single access. */
+		unsigned elem_size = MAX(param->list_elem_next_offset,
+				param->list_elem_content_offset) + param->pointer_width;
+		uint8_t elem[elem_size];
+
 		while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
-				(list_elem_ptr != prev_list_elem_ptr) &&
-				(tasks_found < thread_list_size)) {
-			/* Get the location of the thread structure. */
-			rtos->thread_details[tasks_found].threadid = 0;
-			retval = target_read_buffer(rtos->target,
-					list_elem_ptr + param->list_elem_content_offset,
-					param->pointer_width,
-					(uint8_t *)&(rtos->thread_details[tasks_found].threadid));
+				(list_elem_ptr != prev_list_elem_ptr)) {
+			retval = target_read_buffer(rtos->target, list_elem_ptr, elem_size, elem);
 			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading thread list item object in FreeRTOS thread list");
+				LOG_ERROR("Error reading thread list item in FreeRTOS thread list");
 				free(list_of_lists);
 				return retval;
 			}
+
+			/* Get the location of the thread structure. */
+			threadid_t threadid = FreeRTOS_get_uint(rtos->target,
+					elem + param->list_elem_content_offset, param->pointer_width);
 			LOG_DEBUG("FreeRTOS: Read Thread ID at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
 										list_elem_ptr + param->list_elem_content_offset,
-										rtos->thread_details[tasks_found].threadid);
+										threadid);
 
 			/* get thread name */
 
@@ -340,7 +361,7 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 
 			/* Read the thread name */
 			retval = target_read_buffer(rtos->target,
-					rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
+					threadid + param->thread_name_offset,
 					FREERTOS_THREAD_NAME_STR_SIZE,
 					(uint8_t *)&tmp_str);
 			if (retval != ERROR_OK) {
@@ -350,40 +371,23 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 			}
 			tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
 			LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value \"%s\"\r\n",
-										rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
+										threadid + param->thread_name_offset,
 										tmp_str);
 
 			if (tmp_str[0] == '\x00')
 				strcpy(tmp_str, "No Name");
 
-			rtos->thread_details[tasks_found].thread_name_str =
-				malloc(strlen(tmp_str)+1);
-			strcpy(rtos->thread_details[tasks_found].thread_name_str, tmp_str);
-			rtos->thread_details[tasks_found].exists = true;
-
-			if (rtos->thread_details[tasks_found].threadid == rtos->current_thread) {
-				char running_str[] = "State: Running";
-				rtos->thread_details[tasks_found].extra_info_str = malloc(
-						sizeof(running_str));
-				strcpy(rtos->thread_details[tasks_found].extra_info_str,
-					running_str);
-			} else
-				rtos->thread_details[tasks_found].extra_info_str = NULL;
-
-			tasks_found++;
-			list_thread_count--;
-
-			prev_list_elem_ptr = list_elem_ptr;
-			list_elem_ptr = 0;
-			retval = target_read_buffer(rtos->target,
-					prev_list_elem_ptr + param->list_elem_next_offset,
-					param->pointer_width,
-					(uint8_t *)&list_elem_ptr);
+			retval = rtos_thread_cache_add_thread(rtos, i, threadid, tmp_str);
 			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading next thread item location in FreeRTOS thread list");
 				free(list_of_lists);
 				return retval;
 			}
+
+			list_thread_count--;
+
+			prev_list_elem_ptr = list_elem_ptr;
+			list_elem_ptr = FreeRTOS_get_uint(rtos->target,
+					elem + param->list_elem_next_offset, param->pointer_width);
 			LOG_DEBUG("FreeRTOS: Read next thread location at 0x%" PRIx64 ", value 0x%" PRIx64 "\r\n",
 										prev_list_elem_ptr + param->list_elem_next_offset,
 										list_elem_ptr);
@@ -391,10 +395,59 @@ static int FreeRTOS_update_threads(struct rtos *rtos)
 	}
 
 	free(list_of_lists);
-	rtos->thread_count = tasks_found;
+	LOG_DEBUG("FreeRTOS: %d of %d thread lists changed", lists_walked, num_lists);
+
+	int reserved = show_current_execution ? 1 : 0;
+	retval = rtos_thread_cache_publish(rtos, reserved, thread_list_size);
+	if (retval != ERROR_OK)
+		return retval;
+	if (show_current_execution) {
+		retval = FreeRTOS_add_current_execution(rtos, false);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (i = reserved; i < rtos->thread_count; i++) {
+		if (rtos->thread_details[i].threadid == rtos->current_thread) {
+			char running_str[] = "State: Running";
+			rtos->thread_details[i].extra_info_str = malloc(
+					sizeof(running_str));
+			strcpy(rtos->thread_details[i].extra_info_str,
+				running_str);
+		}
+	}
+
 	return 0;
 }
 
+/* Check for armv7m with *enabled* FPU, i.e. a Cortex-M4F */
+static int FreeRTOS_fpu_enabled(struct rtos *rtos, int *cm4_fpu_enabled)
+{
+	int retval;
+
+	*cm4_fpu_enabled = 0;
+	struct armv7m_common *armv7m_target = target_to_armv7m(rtos->target);
+	if (is_armv7m(armv7m_target)) {
+		if (armv7m_target->fp_feature == FPv4_SP) {
+			/* Found ARM v7m target which includes a FPU */
+			uint32_t cpacr;
+
+			retval = target_read_u32(rtos->target, FPU_CPACR, &cpacr);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Could not read CPACR register to check FPU state");
+				return -1;
+			}
+
+			/* Check if CP10 and CP11 are set to full access. */
+			if (cpacr & 0x00F00000) {
+				/* Found target with enabled FPU */
+				*cm4_fpu_enabled = 1;
+			}
+		}
+	}
+	return ERROR_OK;
+}
+
 static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, char **hex_reg_list)
 {
 	int retval;
@@ -426,27 +479,10 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, ch
 										thread_id + param->thread_stack_offset,
 										stack_ptr);
 
-	/* Check for armv7m with *enabled* FPU, i.e. a Cortex-M4F */
-	int cm4_fpu_enabled = 0;
-	struct armv7m_common *armv7m_target = target_to_armv7m(rtos->target);
-	if (is_armv7m(armv7m_target)) {
-		if (armv7m_target->fp_feature == FPv4_SP) {
-			/* Found ARM v7m target which includes a FPU */
-			uint32_t cpacr;
-
-			retval = target_read_u32(rtos->target, FPU_CPACR, &cpacr);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Could not read CPACR register to check FPU state");
-				return -1;
-			}
-
-			/* Check if CP10 and CP11 are set to full access. */
-			if (cpacr & 0x00F00000) {
-				/* Found target with enabled FPU */
-				cm4_fpu_enabled = 1;
-			}
-		}
-	}
+	int cm4_fpu_enabled;
+	retval = FreeRTOS_fpu_enabled(rtos, &cm4_fpu_enabled);
+	if (retval != ERROR_OK)
+		return retval;
 
 	if (cm4_fpu_enabled == 1) {
 		/* Read the LR to decide between stacking with or without FPU */
@@ -467,6 +503,122 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, ch
 		return rtos_generic_stack_read(rtos->target, param->stacking_info_cm3, stack_ptr, hex_reg_list);
 }
 
+/* Read the stack pointers of all threads with one batch, then all their
+ * stacked frames with a second one, and cache the resulting register lists.
+ * Threads that are not covered here are read on demand as before. */
+static int FreeRTOS_prefetch_thread_reg_lists(struct rtos *rtos)
+{
+	const struct FreeRTOS_params *param;
+	int retval;
+
+	if (rtos->rtos_specific_params == NULL)
+		return ERROR_FAIL;
+	param = (const struct FreeRTOS_params *) rtos->rtos_specific_params;
+
+	int cm4_fpu_enabled;
+	retval = FreeRTOS_fpu_enabled(rtos, &cm4_fpu_enabled);
+	if (retval != ERROR_OK)
+		return retval;
+
+	const struct rtos_register_stacking *stacking = param->stacking_info_cm3;
+	unsigned frame_size = stacking->stack_registers_size;
+	if (cm4_fpu_enabled) {
+		stacking = param->stacking_info_cm4f;
+		frame_size = MAX(param->stacking_info_cm4f->stack_registers_size,
+				param->stacking_info_cm4f_fpu->stack_registers_size);
+		if (param->stacking_info_cm4f_fpu->stack_growth_direction != -1)
+			return ERROR_OK;
+	}
+	/* a single read covering either frame layout only works from the
+	 * stack pointer upwards */
+	if (stacking->stack_growth_direction != -1)
+		return ERROR_OK;
+	frame_size = (frame_size + 3) & ~3u;
+
+	threadid_t *threads = calloc(rtos->thread_count, sizeof(*threads));
+	struct target_memory_request *requests = calloc(rtos->thread_count, sizeof(*requests));
+	uint8_t *sp_buf = calloc(rtos->thread_count, param->pointer_width);
+	uint8_t *frames = calloc(rtos->thread_count, frame_size);
+	int64_t *stack_ptrs = calloc(rtos->thread_count, sizeof(*stack_ptrs));
+	if (!threads || !requests || !sp_buf || !frames || !stack_ptrs) {
+		LOG_ERROR("Out of memory");
+		retval = ERROR_FAIL;
+		goto done;
+	}
+
+	/* registers of the running thread come from the target itself, thread
+	 * ID 1 is the "Current Execution" placeholder */
+	int count = 0;
+	for (int i = 0; i < rtos->thread_count; i++) {
+		threadid_t threadid = rtos->thread_details[i].threadid;
+		if (threadid == rtos->current_thread || threadid == 1)
+			continue;
+		threads[count] = threadid;
+		requests[count].address = threadid + param->thread_stack_offset;
+		requests[count].size = param->pointer_width;
+		requests[count].count = 1;
+		requests[count].buffer = sp_buf + count * param->pointer_width;
+		count++;
+	}
+	if (count == 0)
+		goto done;
+
+	retval = target_memory_batch(rtos->target, requests, count);
+	if (retval != ERROR_OK)
+		goto done;
+
+	int frame_count = 0;
+	for (int i = 0; i < count; i++) {
+		int64_t stack_ptr = FreeRTOS_get_uint(rtos->target,
+				sp_buf + i * param->pointer_width, param->pointer_width);
+		if (stack_ptr == 0 || (stack_ptr & 3))
+			continue;
+		threads[frame_count] = threads[i];
+		stack_ptrs[frame_count] = stack_ptr;
+		requests[frame_count].address = stack_ptr;
+		requests[frame_count].size = 4;
+		requests[frame_count].count = frame_size / 4;
+		requests[frame_count].buffer = frames + frame_count * frame_size;
+		frame_count++;
+	}
+	if (frame_count == 0)
+		goto done;
+
+	retval = target_memory_batch(rtos->target, requests, frame_count);
+	if (retval != ERROR_OK)
+		goto done;
+
+	for (int i = 0; i < frame_count; i++) {
+		const uint8_t *frame = frames + i * frame_size;
+		stacking = param->stacking_info_cm3;
+		if (cm4_fpu_enabled) {
+			/* the LR tells whether the frame includes FPU registers */
+			uint32_t LR_svc = target_buffer_get_u32(rtos->target, frame + 0x20);
+			if ((LR_svc & 0x10) == 0)
+				stacking = param->stacking_info_cm4f_fpu;
+			else
+				stacking = param->stacking_info_cm4f;
+		}
+
+		char *hex_reg_list;
+		retval = rtos_generic_stack_format(rtos->target, stacking, frame,
+				stack_ptrs[i], &hex_reg_list);
+		if (retval != ERROR_OK)
+			goto done;
+		if (rtos_reg_cache_add(rtos, threads[i], hex_reg_list) != ERROR_OK)
+			free(hex_reg_list);
+	}
+	LOG_DEBUG("FreeRTOS: prefetched registers of %d threads", frame_count);
+
+done:
+	free(stack_ptrs);
+	free(frames);
+	free(sp_buf);
+	free(requests);
+	free(threads);
+	return retval;
+}
+
 static int FreeRTOS_get_symbol_list_to_lookup(symbol_table_elem_t *symbol_list[])
 {
 	unsigned int i;
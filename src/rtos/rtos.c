@@ -93,6 +93,9 @@ static void os_free(struct target *target)
 	if (target->rtos->symbols)
 		free(target->rtos->symbols);
 
+	rtos_thread_cache_free(target->rtos);
+	rtos_reg_cache_invalidate(target->rtos);
+	free(target->rtos->reg_cache);
 	free(target->rtos);
 	target->rtos = NULL;
 }
@@ -352,6 +355,7 @@ int rtos_thread_packet(struct connection *connection, char const *packet, int pa
 		return ERROR_OK;
 	} else if (strncmp(packet, "qfThreadInfo", 12) == 0) {
 		int i;
+		rtos_prefetch_thread_reg_lists(target);
 		if (target->rtos != NULL) {
 			if (target->rtos->thread_count == 0) {
 				gdb_put_packet(connection, "l", 1);
@@ -430,6 +434,69 @@ int rtos_thread_packet(struct connection *connection, char const *packet, int pa
 	return GDB_THREAD_PACKET_NOT_CONSUMED;
 }
 
+static const char *rtos_reg_cache_lookup(struct rtos *rtos, threadid_t threadid)
+{
+	for (int i = 0; i < rtos->reg_cache_count; i++) {
+		if (rtos->reg_cache[i].threadid == threadid)
+			return rtos->reg_cache[i].hex_reg_list;
+	}
+	return NULL;
+}
+
+/**
+ * Remember the register list of a thread until the next halt. On success
+ * the cache takes ownership of @a hex_reg_list.
+ */
+int rtos_reg_cache_add(struct rtos *rtos, threadid_t threadid, char *hex_reg_list)
+{
+	if (rtos_reg_cache_lookup(rtos, threadid) != NULL)
+		return ERROR_FAIL;
+
+	if (rtos->reg_cache_count == rtos->reg_cache_alloc) {
+		int alloc = rtos->reg_cache_alloc ? rtos->reg_cache_alloc * 2 : 16;
+		struct rtos_reg_cache_entry *cache = realloc(rtos->reg_cache,
+				alloc * sizeof(*cache));
+		if (!cache)
+			return ERROR_FAIL;
+		rtos->reg_cache = cache;
+		rtos->reg_cache_alloc = alloc;
+	}
+
+	rtos->reg_cache[rtos->reg_cache_count].threadid = threadid;
+	rtos->reg_cache[rtos->reg_cache_count].hex_reg_list = hex_reg_list;
+	rtos->reg_cache_count++;
+	return ERROR_OK;
+}
+
+/**
+ * Forget all cached thread register lists. Done whenever the thread list
+ * is rebuilt, i.e. on every halt, and when GDB writes to target memory.
+ */
+void rtos_reg_cache_invalidate(struct rtos *rtos)
+{
+	for (int i = 0; i < rtos->reg_cache_count; i++)
+		free(rtos->reg_cache[i].hex_reg_list);
+	rtos->reg_cache_count = 0;
+	rtos->reg_cache_prefetched = false;
+}
+
+/**
+ * GDB is about to ask for the registers of all threads: let the RTOS driver
+ * fetch them together, once per halt.
+ */
+void rtos_prefetch_thread_reg_lists(struct target *target)
+{
+	struct rtos *rtos = target->rtos;
+
+	if (!rtos || !rtos->type || !rtos->type->prefetch_thread_reg_lists ||
+			rtos->reg_cache_prefetched || rtos->thread_count == 0)
+		return;
+
+	rtos->reg_cache_prefetched = true;
+	if (rtos->type->prefetch_thread_reg_lists(rtos) != ERROR_OK)
+		LOG_DEBUG("RTOS: prefetching thread registers failed, reading them on demand");
+}
+
 int rtos_get_gdb_reg_list(struct connection *connection)
 {
 	struct target *target = get_target_from_connection(connection);
@@ -452,6 +519,12 @@ int rtos_get_gdb_reg_list(struct connection *connection)
                     target->rtos->current_thread);
 #endif
 
+		const char *cached = rtos_reg_cache_lookup(target->rtos, current_threadid);
+		if (cached != NULL) {
+			gdb_put_packet(connection, (char *)cached, strlen(cached));
+			return ERROR_OK;
+		}
+
 		int retval = target->rtos->type->get_thread_reg_list(target->rtos,
 				current_threadid,
 				&hex_reg_list);
@@ -462,22 +535,69 @@ int rtos_get_gdb_reg_list(struct connection *connection)
 
 		if (hex_reg_list != NULL) {
 			gdb_put_packet(connection, hex_reg_list, strlen(hex_reg_list));
-			free(hex_reg_list);
+			if (rtos_reg_cache_add(target->rtos, current_threadid, hex_reg_list) != ERROR_OK)
+				free(hex_reg_list);
 			return ERROR_OK;
 		}
 	}
 	return ERROR_FAIL;
 }
 
-int rtos_generic_stack_read(struct target *target,
+int rtos_generic_stack_format(struct target *target,
 	const struct rtos_register_stacking *stacking,
+	const uint8_t *stack_data,
 	int64_t stack_ptr,
 	char **hex_reg_list)
 {
 	int list_size = 0;
-	char *tmp_str_ptr;
 	int64_t new_stack_ptr;
 	int i;
+
+	for (i = 0; i < stacking->num_output_registers; i++)
+		list_size += stacking->register_offsets[i].width_bits/8;
+
+	if (stacking->calculate_process_stack != NULL) {
+		new_stack_ptr = stacking->calculate_process_stack(target,
+				stack_data, stacking, stack_ptr);
+	} else {
+		new_stack_ptr = stack_ptr - stacking->stack_growth_direction *
+			stacking->stack_registers_size;
+	}
+
+	/* gather the raw register bytes, then convert them in one go */
+	uint8_t *reg_data = malloc(list_size);
+	*hex_reg_list = malloc(list_size*2 + 1);
+	if (!reg_data || !*hex_reg_list) {
+		free(reg_data);
+		free(*hex_reg_list);
+		*hex_reg_list = NULL;
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	uint8_t *p = reg_data;
+	for (i = 0; i < stacking->num_output_registers; i++) {
+		int width = stacking->register_offsets[i].width_bits/8;
+		if (stacking->register_offsets[i].offset == -1)
+			memset(p, 0, width);
+		else if (stacking->register_offsets[i].offset == -2)
+			memcpy(p, &new_stack_ptr, width);
+		else
+			memcpy(p, stack_data + stacking->register_offsets[i].offset, width);
+		p += width;
+	}
+
+	hexify(*hex_reg_list, reg_data, list_size, list_size*2 + 1);
+	free(reg_data);
+/*	LOG_OUTPUT("Output register string: %s\r\n", *hex_reg_list); */
+	return ERROR_OK;
+}
+
+int rtos_generic_stack_read(struct target *target,
+	const struct rtos_register_stacking *stacking,
+	int64_t stack_ptr,
+	char **hex_reg_list)
+{
 	int retval;
 
 	if (stack_ptr == 0) {
@@ -500,37 +620,13 @@ int rtos_generic_stack_read(struct target *target,
 
 #if 0
 		LOG_OUTPUT("Stack Data :");
-		for (i = 0; i < stacking->stack_registers_size; i++)
+		for (int i = 0; i < stacking->stack_registers_size; i++)
 			LOG_OUTPUT("%02X", stack_data[i]);
 		LOG_OUTPUT("\r\n");
 #endif
-	for (i = 0; i < stacking->num_output_registers; i++)
-		list_size += stacking->register_offsets[i].width_bits/8;
-	*hex_reg_list = malloc(list_size*2 + 1);
-	tmp_str_ptr = *hex_reg_list;
-	if (stacking->calculate_process_stack != NULL) {
-		new_stack_ptr = stacking->calculate_process_stack(target,
-				stack_data, stacking, stack_ptr);
-	} else {
-		new_stack_ptr = stack_ptr - stacking->stack_growth_direction *
-			stacking->stack_registers_size;
-	}
-	for (i = 0; i < stacking->num_output_registers; i++) {
-		int j;
-		for (j = 0; j < stacking->register_offsets[i].width_bits/8; j++) {
-			if (stacking->register_offsets[i].offset == -1)
-				tmp_str_ptr += sprintf(tmp_str_ptr, "%02x", 0);
-			else if (stacking->register_offsets[i].offset == -2)
-				tmp_str_ptr += sprintf(tmp_str_ptr, "%02x",
-						((uint8_t *)&new_stack_ptr)[j]);
-			else
-				tmp_str_ptr += sprintf(tmp_str_ptr, "%02x",
-						stack_data[stacking->register_offsets[i].offset + j]);
-		}
-	}
+	retval = rtos_generic_stack_format(target, stacking, stack_data, stack_ptr, hex_reg_list);
 	free(stack_data);
-/*	LOG_OUTPUT("Output register string: %s\r\n", *hex_reg_list); */
-	return ERROR_OK;
+	return retval;
 }
 
 int rtos_try_next(struct target *target)
@@ -548,6 +644,7 @@ int rtos_try_next(struct target *target)
 		return 0;
 
 	os->type = *type;
+	rtos_thread_cache_free(os);
 	if (os->symbols) {
 		free(os->symbols);
 		os->symbols = NULL;
@@ -565,6 +662,8 @@ int rtos_update_threads(struct target *target)
 
 void rtos_free_threadlist(struct rtos *rtos)
 {
+	rtos_reg_cache_invalidate(rtos);
+
 	if (rtos->thread_details) {
 		int j;
 
@@ -580,3 +679,183 @@ void rtos_free_threadlist(struct rtos *rtos)
 		rtos->current_thread = 0;
 	}
 }
+
+static void rtos_cached_list_clear(struct rtos_cached_list *list)
+{
+	for (int i = 0; i < list->thread_count; i++)
+		free(list->threads[i].name);
+	list->thread_count = 0;
+}
+
+void rtos_thread_cache_free(struct rtos *rtos)
+{
+	struct rtos_thread_cache *cache = rtos->thread_cache;
+
+	if (!cache)
+		return;
+
+	for (unsigned i = 0; i < cache->list_count; i++) {
+		rtos_cached_list_clear(&cache->lists[i]);
+		free(cache->lists[i].threads);
+		free(cache->lists[i].header);
+	}
+	free(cache->lists);
+	free(cache);
+	rtos->thread_cache = NULL;
+}
+
+/**
+ * Make sure the thread cache tracks @a list_count lists with headers of
+ * @a header_size bytes. A cache of a different shape is dropped.
+ */
+int rtos_thread_cache_init(struct rtos *rtos, unsigned list_count, unsigned header_size)
+{
+	struct rtos_thread_cache *cache = rtos->thread_cache;
+
+	if (cache && cache->list_count == list_count && cache->header_size == header_size)
+		return ERROR_OK;
+
+	rtos_thread_cache_free(rtos);
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	cache->lists = calloc(list_count, sizeof(*cache->lists));
+	if (!cache->lists) {
+		LOG_ERROR("Out of memory");
+		free(cache);
+		return ERROR_FAIL;
+	}
+	cache->list_count = list_count;
+	cache->header_size = header_size;
+	rtos->thread_cache = cache;
+
+	for (unsigned i = 0; i < list_count; i++) {
+		cache->lists[i].header = malloc(header_size);
+		if (!cache->lists[i].header) {
+			LOG_ERROR("Out of memory");
+			rtos_thread_cache_free(rtos);
+			return ERROR_FAIL;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+/**
+ * Read the header of list @a index, located at @a address, with a single
+ * memory access. @a changed tells whether it differs from the previous
+ * update; in that case the cached threads of the list are dropped and the
+ * caller is expected to walk the list and add them again. An address of 0
+ * denotes a list that does not exist on this target.
+ */
+int rtos_thread_cache_check_list(struct rtos *rtos, unsigned index,
+		symbol_address_t address, const uint8_t **header, bool *changed)
+{
+	struct rtos_thread_cache *cache = rtos->thread_cache;
+	struct rtos_cached_list *list = &cache->lists[index];
+
+	assert(index < cache->list_count);
+
+	if (address == 0) {
+		rtos_cached_list_clear(list);
+		list->valid = false;
+		*changed = false;
+		return ERROR_OK;
+	}
+
+	uint8_t buf[cache->header_size];
+	int retval = target_read_buffer(rtos->target, address, cache->header_size, buf);
+	if (retval != ERROR_OK) {
+		list->valid = false;
+		return retval;
+	}
+
+	*changed = !list->valid || list->address != address ||
+		memcmp(list->header, buf, cache->header_size);
+	if (*changed) {
+		rtos_cached_list_clear(list);
+		memcpy(list->header, buf, cache->header_size);
+		list->address = address;
+		/* only valid once the caller has walked it successfully, see
+		 * rtos_thread_cache_publish() */
+		list->valid = false;
+	}
+	*header = list->header;
+
+	return ERROR_OK;
+}
+
+int rtos_thread_cache_add_thread(struct rtos *rtos, unsigned index,
+		threadid_t threadid, const char *name)
+{
+	struct rtos_cached_list *list = &rtos->thread_cache->lists[index];
+
+	if (list->thread_count == list->thread_alloc) {
+		int alloc = list->thread_alloc ? list->thread_alloc * 2 : 8;
+		struct rtos_cached_thread *threads = realloc(list->threads,
+				alloc * sizeof(*threads));
+		if (!threads) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		list->threads = threads;
+		list->thread_alloc = alloc;
+	}
+
+	char *copy = strdup(name);
+	if (!copy) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	list->threads[list->thread_count].threadid = threadid;
+	list->threads[list->thread_count].name = copy;
+	list->thread_count++;
+	return ERROR_OK;
+}
+
+/**
+ * Rebuild rtos->thread_details from the cached lists. The first
+ * @a reserved entries are left zeroed for the caller to fill in, at most
+ * @a max_threads cached threads are listed. All lists checked during this
+ * update are marked valid, so they are only walked again once their header
+ * changes.
+ */
+int rtos_thread_cache_publish(struct rtos *rtos, int reserved, int max_threads)
+{
+	struct rtos_thread_cache *cache = rtos->thread_cache;
+	int count = 0;
+
+	for (unsigned i = 0; i < cache->list_count; i++) {
+		struct rtos_cached_list *list = &cache->lists[i];
+		if (list->address)
+			list->valid = true;
+		count += list->thread_count;
+	}
+	if (count > max_threads)
+		count = max_threads;
+
+	struct thread_detail *details = calloc(reserved + count, sizeof(*details));
+	if (!details) {
+		LOG_ERROR("Error allocating memory for %d threads", reserved + count);
+		return ERROR_FAIL;
+	}
+
+	int n = reserved;
+	for (unsigned i = 0; i < cache->list_count && n < reserved + count; i++) {
+		struct rtos_cached_list *list = &cache->lists[i];
+		for (int j = 0; j < list->thread_count && n < reserved + count; j++) {
+			details[n].threadid = list->threads[j].threadid;
+			details[n].exists = true;
+			details[n].thread_name_str = strdup(list->threads[j].name);
+			n++;
+		}
+	}
+
+	rtos->thread_details = details;
+	rtos->thread_count = n;
+	return ERROR_OK;
+}
@@ -43,6 +43,39 @@ struct thread_detail {
 	char *extra_info_str;
 };
 
+/* Register list of a thread, in GDB hex format, cached until the next halt. */
+struct rtos_reg_cache_entry {
+	threadid_t threadid;
+	char *hex_reg_list;
+};
+
+struct rtos_cached_thread {
+	threadid_t threadid;
+	char *name;
+};
+
+/* One target-side thread list, as seen at the last update. */
+struct rtos_cached_list {
+	symbol_address_t address;
+	uint8_t *header;	/* raw list header read at the last update */
+	bool valid;
+	int thread_count;
+	int thread_alloc;
+	struct rtos_cached_thread *threads;
+};
+
+/**
+ * Thread lists cached between updates. RTOS drivers that keep their threads
+ * in linked lists with a fixed-size header (count, head and tail pointers)
+ * re-read the header on each update and only walk the lists whose header
+ * has changed since the previous one.
+ */
+struct rtos_thread_cache {
+	unsigned header_size;
+	unsigned list_count;
+	struct rtos_cached_list *lists;
+};
+
 struct rtos {
 	const struct rtos_type *type;
 
@@ -53,6 +86,11 @@ struct rtos {
 	threadid_t current_thread;
 	struct thread_detail *thread_details;
 	int thread_count;
+	struct rtos_thread_cache *thread_cache;
+	struct rtos_reg_cache_entry *reg_cache;
+	int reg_cache_count;
+	int reg_cache_alloc;
+	bool reg_cache_prefetched;
 	int (*gdb_thread_packet)(struct connection *connection, char const *packet, int packet_size);
 #if BUILD_RISCV == 1
 	int (*gdb_v_packet)(struct connection *connection, char const *packet, int packet_size);
@@ -67,6 +105,9 @@ struct rtos_type {
 	int (*smp_init)(struct target *target);
 	int (*update_threads)(struct rtos *rtos);
 	int (*get_thread_reg_list)(struct rtos *rtos, int64_t thread_id, char **hex_reg_list);
+	/* Optional: read the register lists of many threads at once and store
+	 * them with rtos_reg_cache_add(). Called when GDB lists the threads. */
+	int (*prefetch_thread_reg_lists)(struct rtos *rtos);
 	int (*get_symbol_list_to_lookup)(symbol_table_elem_t *symbol_list[]);
 	int (*clean)(struct target *target);
 	char * (*ps_command)(struct target *target);
@@ -102,12 +143,27 @@ int rtos_generic_stack_read(struct target *target,
 		const struct rtos_register_stacking *stacking,
 		int64_t stack_ptr,
 		char **hex_reg_list);
+int rtos_generic_stack_format(struct target *target,
+		const struct rtos_register_stacking *stacking,
+		const uint8_t *stack_data,
+		int64_t stack_ptr,
+		char **hex_reg_list);
 int rtos_try_next(struct target *target);
 int gdb_thread_packet(struct connection *connection, char const *packet, int packet_size);
 int rtos_get_gdb_reg_list(struct connection *connection);
 int rtos_update_threads(struct target *target);
 void rtos_free_threadlist(struct rtos *rtos);
 int rtos_smp_init(struct target *target);
+int rtos_reg_cache_add(struct rtos *rtos, threadid_t threadid, char *hex_reg_list);
+void rtos_reg_cache_invalidate(struct rtos *rtos);
+void rtos_prefetch_thread_reg_lists(struct target *target);
+int rtos_thread_cache_init(struct rtos *rtos, unsigned list_count, unsigned header_size);
+void rtos_thread_cache_free(struct rtos *rtos);
+int rtos_thread_cache_check_list(struct rtos *rtos, unsigned index,
+		symbol_address_t address, const uint8_t **header, bool *changed);
+int rtos_thread_cache_add_thread(struct rtos *rtos, unsigned index,
+		threadid_t threadid, const char *name);
+int rtos_thread_cache_publish(struct rtos *rtos, int reserved, int max_threads);
 /*  function for handling symbol access */
 int rtos_qsymbol(struct connection *connection, char const *packet, int packet_size);
 
@@ -65,7 +65,11 @@ struct target_desc_format {
 
 /* private connection data for GDB */
 struct gdb_connection {
-	char buffer[GDB_BUFFER_SIZE];
+	/* buffer_size bytes of input from GDB, and of space to assemble a
+	 * packet in */
+	char *buffer;
+	char *packet_buffer;
+	unsigned buffer_size;
 	char *buf_p;
 	int buf_cnt;
 	int ctrl_c;
@@ -132,6 +136,9 @@ static int gdb_report_data_abort;
 /* enabled by default */
 static int gdb_use_target_description = 1;
 
+/* packet buffer size for gdb servers that haven't been started yet */
+static unsigned gdb_buffer_size = GDB_BUFFER_SIZE;
+
 /* current processing free-run type, used by file-I/O */
 static char gdb_running_type;
 
@@ -202,14 +209,14 @@ static int gdb_get_char_inner(struct connection *connection, int *next_char)
 #endif
 	for (;; ) {
 		if (connection->service->type != CONNECTION_TCP)
-			gdb_con->buf_cnt = read(connection->fd, gdb_con->buffer, GDB_BUFFER_SIZE);
+			gdb_con->buf_cnt = read(connection->fd, gdb_con->buffer, gdb_con->buffer_size);
 		else {
 			retval = check_pending(connection, 1, NULL);
 			if (retval != ERROR_OK)
 				return retval;
 			gdb_con->buf_cnt = read_socket(connection->fd,
 					gdb_con->buffer,
-					GDB_BUFFER_SIZE);
+					gdb_con->buffer_size);
 		}
 
 		if (gdb_con->buf_cnt > 0)
@@ -345,6 +352,62 @@ static int gdb_write(struct connection *connection, void *data, int len)
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
 
+/* Waits for GDB to acknowledge the packet that was just sent.  *resend is set
+ * if GDB wants the packet to be sent again. */
+static int gdb_get_packet_ack(struct connection *connection, bool *resend)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	int reply;
+	int retval;
+
+	*resend = false;
+	if (gdb_con->noack_mode)
+		return ERROR_OK;
+
+	retval = gdb_get_char(connection, &reply);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (reply == '+')
+		return ERROR_OK;
+	else if (reply == '-') {
+		/* Stop sending output packets for now */
+		log_remove_callback(gdb_log_callback, connection);
+		LOG_WARNING("negative reply, retrying");
+		*resend = true;
+	} else if (reply == 0x3) {
+		gdb_con->ctrl_c = 1;
+		retval = gdb_get_char(connection, &reply);
+		if (retval != ERROR_OK)
+			return retval;
+		if (reply == '+')
+			return ERROR_OK;
+		else if (reply == '-') {
+			/* Stop sending output packets for now */
+			log_remove_callback(gdb_log_callback, connection);
+			LOG_WARNING("negative reply, retrying");
+			*resend = true;
+		} else if (reply == '$') {
+			LOG_ERROR("GDB missing ack(1) - assumed good");
+			gdb_putback_char(connection, reply);
+		} else {
+			LOG_ERROR("unknown character(1) 0x%2.2x in reply, dropping connection", reply);
+			gdb_con->closed = 1;
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+	} else if (reply == '$') {
+		LOG_ERROR("GDB missing ack(2) - assumed good");
+		gdb_putback_char(connection, reply);
+	} else {
+		LOG_ERROR("unknown character(2) 0x%2.2x in reply, dropping connection",
+			reply);
+		gdb_con->closed = 1;
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	return ERROR_OK;
+}
+
 static int gdb_put_packet_inner(struct connection *connection,
 		char *buffer, int len)
 {
@@ -352,8 +415,8 @@ static int gdb_put_packet_inner(struct connection *connection,
 	unsigned char my_checksum = 0;
 #ifdef _DEBUG_GDB_IO_
 	char *debug_buffer;
-#endif
 	int reply;
+#endif
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
 
@@ -418,49 +481,12 @@ static int gdb_put_packet_inner(struct connection *connection,
 				return retval;
 		}
 
-		if (gdb_con->noack_mode)
-			break;
-
-		retval = gdb_get_char(connection, &reply);
+		bool resend;
+		retval = gdb_get_packet_ack(connection, &resend);
 		if (retval != ERROR_OK)
 			return retval;
-
-		if (reply == '+')
+		if (!resend)
 			break;
-		else if (reply == '-') {
-			/* Stop sending output packets for now */
-			log_remove_callback(gdb_log_callback, connection);
-			LOG_WARNING("negative reply, retrying");
-		} else if (reply == 0x3) {
-			gdb_con->ctrl_c = 1;
-			retval = gdb_get_char(connection, &reply);
-			if (retval != ERROR_OK)
-				return retval;
-			if (reply == '+')
-				break;
-			else if (reply == '-') {
-				/* Stop sending output packets for now */
-				log_remove_callback(gdb_log_callback, connection);
-				LOG_WARNING("negative reply, retrying");
-			} else if (reply == '$') {
-				LOG_ERROR("GDB missing ack(1) - assumed good");
-				gdb_putback_char(connection, reply);
-				return ERROR_OK;
-			} else {
-				LOG_ERROR("unknown character(1) 0x%2.2x in reply, dropping connection", reply);
-				gdb_con->closed = 1;
-				return ERROR_SERVER_REMOTE_CLOSED;
-			}
-		} else if (reply == '$') {
-			LOG_ERROR("GDB missing ack(2) - assumed good");
-			gdb_putback_char(connection, reply);
-			return ERROR_OK;
-		} else {
-			LOG_ERROR("unknown character(2) 0x%2.2x in reply, dropping connection",
-				reply);
-			gdb_con->closed = 1;
-			return ERROR_SERVER_REMOTE_CLOSED;
-		}
 	}
 	if (gdb_con->closed)
 		return ERROR_SERVER_REMOTE_CLOSED;
@@ -924,6 +950,18 @@ static int gdb_new_connection(struct connection *connection)
 	connection->priv = gdb_connection;
 
 	/* initialize gdb connection information */
+	gdb_connection->buffer_size = gdb_service->buffer_size;
+	gdb_connection->buffer = malloc(gdb_connection->buffer_size);
+	gdb_connection->packet_buffer = malloc(gdb_connection->buffer_size);
+	if (!gdb_connection->buffer || !gdb_connection->packet_buffer) {
+		LOG_ERROR("Unable to allocate %u byte GDB packet buffers",
+				gdb_connection->buffer_size);
+		free(gdb_connection->buffer);
+		free(gdb_connection->packet_buffer);
+		free(gdb_connection);
+		connection->priv = NULL;
+		return ERROR_FAIL;
+	}
 	gdb_connection->buf_p = gdb_connection->buffer;
 	gdb_connection->buf_cnt = 0;
 	gdb_connection->ctrl_c = 0;
@@ -1032,6 +1070,8 @@ static int gdb_connection_closed(struct connection *connection)
 	delete_debug_msg_receiver(connection->cmd_ctx, gdb_service->target);
 
 	if (connection->priv) {
+		free(gdb_connection->buffer);
+		free(gdb_connection->packet_buffer);
 		free(connection->priv);
 		connection->priv = NULL;
 	} else
@@ -1397,42 +1437,14 @@ static int gdb_error(struct connection *connection, int retval)
  *
  * 8191 bytes by the looks of it. Why 8191 bytes instead of 8192?????
  */
-static int gdb_read_memory_packet(struct connection *connection,
-		char const *packet, int packet_size)
-{
-	struct target *target = get_target_from_connection(connection);
-	char *separator;
-	uint64_t addr = 0;
-	uint32_t len = 0;
-
-	uint8_t *buffer;
-	char *hex_buffer;
-
-	int retval = ERROR_OK;
-
-	/* skip command character */
-	packet++;
-
-	addr = strtoull(packet, &separator, 16);
-
-	if (*separator != ',') {
-		LOG_ERROR("incomplete read memory packet received, dropping connection");
-		return ERROR_SERVER_REMOTE_CLOSED;
-	}
-
-	len = strtoul(separator + 1, NULL, 16);
-
-	if (!len) {
-		LOG_WARNING("invalid read memory packet received (len == 0)");
-		gdb_put_packet(connection, NULL, 0);
-		return ERROR_OK;
-	}
-
-	buffer = malloc(len);
+/* Memory read replies are produced a chunk of this many bytes at a time,
+ * so they never have to be held in memory as a whole. */
+#define GDB_MEMORY_CHUNK_SIZE 1024
 
-	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
-
-	retval = target_read_buffer(target, addr, len, buffer);
+static int gdb_read_memory_chunk(struct target *target, target_addr_t addr,
+		uint32_t len, uint8_t *buffer)
+{
+	int retval = target_read_buffer(target, addr, len, buffer);
 
 	if ((retval != ERROR_OK) && !gdb_report_data_abort) {
 		/* TODO : Here we have to lie and send back all zero's lest stack traces won't work.
@@ -1452,22 +1464,149 @@ static int gdb_read_memory_packet(struct connection *connection,
 		retval = ERROR_OK;
 	}
 
-	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
+	return retval;
+}
 
-		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
+/* Encodes memory contents as hex digits, or as escaped binary data for 'x'
+ * packets, and adds the result to the running packet checksum. */
+static size_t gdb_encode_memory(char *out, const uint8_t *data, uint32_t len,
+		bool binary, unsigned char *checksum)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	size_t count = 0;
 
-		gdb_put_packet(connection, hex_buffer, pkt_len);
+	for (uint32_t i = 0; i < len; i++) {
+		if (binary) {
+			char c = data[i];
+			if (c == '#' || c == '$' || c == '}' || c == '*') {
+				out[count++] = '}';
+				c ^= 0x20;
+			}
+			out[count++] = c;
+		} else {
+			out[count++] = hex_digits[data[i] >> 4];
+			out[count++] = hex_digits[data[i] & 0xf];
+		}
+	}
 
-		free(hex_buffer);
-	} else
-		retval = gdb_error(connection, retval);
+	for (size_t i = 0; i < count; i++)
+		*checksum += out[i];
 
-	free(buffer);
+	return count;
+}
+
+/* Sends the reply to an 'm' or 'x' packet.  Target memory is read a chunk at
+ * a time and encoded straight into the outgoing data, with the checksum
+ * computed on the way, instead of building the whole reply first. */
+static int gdb_put_memory_packet(struct connection *connection,
+		target_addr_t addr, uint32_t len, bool binary)
+{
+	struct target *target = get_target_from_connection(connection);
+	struct gdb_connection *gdb_con = connection->priv;
+	uint8_t data[GDB_MEMORY_CHUNK_SIZE];
+	/* "$b", the encoded chunk, "#xx" and the NUL left by sprintf() */
+	char out[2 * GDB_MEMORY_CHUNK_SIZE + 6];
+	int retval;
+
+	/* Errors can only be reported before any of the reply has been sent. */
+	uint32_t chunk = MIN(len, GDB_MEMORY_CHUNK_SIZE);
+	retval = gdb_read_memory_chunk(target, addr, chunk, data);
+	if (retval != ERROR_OK)
+		return gdb_error(connection, retval);
+
+	gdb_con->busy = 1;
+	while (1) {
+		unsigned char checksum = 0;
+		size_t out_len = 0;
+		uint32_t offset = 0;
+
+		out[out_len++] = '$';
+		if (binary) {
+			out[out_len++] = 'b';
+			checksum += 'b';
+		}
+
+		while (1) {
+			out_len += gdb_encode_memory(out + out_len, data, chunk, binary,
+					&checksum);
+			offset += chunk;
+			if (offset == len)
+				break;
+
+			retval = gdb_write(connection, out, out_len);
+			if (retval != ERROR_OK)
+				goto out;
+			out_len = 0;
+
+			chunk = MIN(len - offset, GDB_MEMORY_CHUNK_SIZE);
+			if (gdb_read_memory_chunk(target, addr + offset, chunk,
+						data) != ERROR_OK) {
+				/* It's too late for an error reply, but GDB accepts a reply
+				 * that is shorter than what it asked for. */
+				LOG_DEBUG("short read at 0x%" TARGET_PRIxADDR, addr + offset);
+				break;
+			}
+		}
+
+		out_len += sprintf(out + out_len, "#%02x", checksum);
+		retval = gdb_write(connection, out, out_len);
+		if (retval != ERROR_OK)
+			break;
+
+		bool resend;
+		retval = gdb_get_packet_ack(connection, &resend);
+		if (retval != ERROR_OK || !resend)
+			break;
+
+		chunk = MIN(len, GDB_MEMORY_CHUNK_SIZE);
+		retval = gdb_read_memory_chunk(target, addr, chunk, data);
+		if (retval != ERROR_OK) {
+			gdb_con->busy = 0;
+			return gdb_error(connection, retval);
+		}
+	}
+
+out:
+	gdb_con->busy = 0;
+
+	/* we sent some data, reset timer for keep alive messages */
+	kept_alive();
 
 	return retval;
 }
 
+/* Handles both 'm' (hex) and 'x' (binary) memory read packets. */
+static int gdb_read_memory_packet(struct connection *connection,
+		char const *packet, int packet_size)
+{
+	char *separator;
+	uint64_t addr = 0;
+	uint32_t len = 0;
+	bool binary = packet[0] == 'x';
+
+	/* skip command character */
+	packet++;
+
+	addr = strtoull(packet, &separator, 16);
+
+	if (*separator != ',') {
+		LOG_ERROR("incomplete read memory packet received, dropping connection");
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	len = strtoul(separator + 1, NULL, 16);
+
+	if (!len && !binary) {
+		LOG_WARNING("invalid read memory packet received (len == 0)");
+		gdb_put_packet(connection, NULL, 0);
+		return ERROR_OK;
+	}
+
+	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
+
+	return gdb_put_memory_packet(connection, addr, len, binary);
+}
+
 static int gdb_write_memory_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
@@ -1504,6 +1643,9 @@ static int gdb_write_memory_packet(struct connection *connection,
 		LOG_ERROR("unable to decode memory packet");
 
 	retval = target_write_buffer(target, addr, len, buffer);
+	/* the write may have hit a stacked thread context */
+	if (target->rtos != NULL)
+		rtos_reg_cache_invalidate(target->rtos);
 
 	if (retval == ERROR_OK)
 		gdb_put_packet(connection, "OK", 2);
@@ -1575,6 +1717,8 @@ static int gdb_write_memory_binary_packet(struct connection *connection,
 		retval = target_write_buffer(target, addr, len, (uint8_t *)separator);
 		if (retval != ERROR_OK)
 			gdb_connection->mem_write_error = true;
+		if (target->rtos != NULL)
+			rtos_reg_cache_invalidate(target->rtos);
 	}
 
 	if (len < fast_limit) {
@@ -2346,6 +2490,8 @@ static int gdb_generate_thread_list(struct target *target, char **thread_list_ou
 		   "<?xml version=\"1.0\"?>\n"
 		   "<threads>\n");
 
+	rtos_prefetch_thread_reg_lists(target);
+
 	if (rtos != NULL) {
 		for (int i = 0; i < rtos->thread_count; i++) {
 			struct thread_detail *thread_detail = &rtos->thread_details[i];
@@ -2516,8 +2662,8 @@ static int gdb_query_packet(struct connection *connection,
 			&buffer,
 			&pos,
 			&size,
-			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+",
-			(GDB_BUFFER_SIZE - 1),
+			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;binary-upload+",
+			gdb_connection->buffer_size - 1,
 			((gdb_use_memory_map == 1) && (flash_get_bank_count() > 0)) ? '+' : '-',
 			(gdb_target_desc_supported == 1) ? '+' : '-');
 
@@ -2832,15 +2978,13 @@ static void gdb_sig_halted(struct connection *connection)
 
 static int gdb_input_inner(struct connection *connection)
 {
-	/* Do not allocate this on the stack */
-	static char gdb_packet_buffer[GDB_BUFFER_SIZE];
-
 	struct gdb_service *gdb_service = connection->service->priv;
 	struct target *target = gdb_service->target;
-	char const *packet = gdb_packet_buffer;
 	int packet_size;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
+	char *gdb_packet_buffer = gdb_con->packet_buffer;
+	char const *packet = gdb_packet_buffer;
 	static int extended_protocol;
 
 	/* drain input buffer. If one of the packets fail, then an error
@@ -2855,7 +2999,7 @@ static int gdb_input_inner(struct connection *connection)
 	 * drain the rest of the buffer.
 	 */
 	do {
-		packet_size = GDB_BUFFER_SIZE-1;
+		packet_size = gdb_con->buffer_size - 1;
 		retval = gdb_get_packet(connection, gdb_packet_buffer, &packet_size);
 		if (retval != ERROR_OK)
 			return retval;
@@ -2905,6 +3049,7 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_set_register_packet(connection, packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(connection, packet, packet_size);
 					break;
 				case 'M':
@@ -3104,6 +3249,7 @@ static int gdb_target_start(struct target *target, const char *port)
 	gdb_service->target = target;
 	gdb_service->core[0] = -1;
 	gdb_service->core[1] = -1;
+	gdb_service->buffer_size = gdb_buffer_size;
 	target->gdb_service = gdb_service;
 
 	ret = add_service("gdb",
@@ -3239,6 +3385,26 @@ COMMAND_HANDLER(handle_gdb_report_data_abort_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_packet_size_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned size;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], size);
+		if (size < 1024 || size > GDB_BUFFER_SIZE_MAX) {
+			LOG_ERROR("GDB packet size must be between 1024 and %d bytes",
+					GDB_BUFFER_SIZE_MAX);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		gdb_buffer_size = size;
+	}
+
+	command_print(CMD_CTX, "%u", gdb_buffer_size);
+	return ERROR_OK;
+}
+
 /* gdb_breakpoint_override */
 COMMAND_HANDLER(handle_gdb_breakpoint_override_command)
 {
@@ -3360,6 +3526,14 @@ static const struct command_registration gdb_command_handlers[] = {
 		.help = "enable or disable reporting data aborts",
 		.usage = "('enable'|'disable')"
 	},
+	{
+		.name = "gdb_packet_size",
+		.handler = handle_gdb_packet_size_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Display or set the largest packet GDB may send, "
+			"for the gdb servers started after this.",
+		.usage = "[bytes]"
+	},
 	{
 		.name = "gdb_breakpoint_override",
 		.handler = handle_gdb_breakpoint_override_command,
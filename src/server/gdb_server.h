@@ -32,7 +32,10 @@ struct image;
 struct reg;
 #include <target/target.h>
 
+/* Default and largest size of the buffer GDB packets are received into. The
+ * size can be changed with the gdb_packet_size command. */
 #define GDB_BUFFER_SIZE 16384
+#define GDB_BUFFER_SIZE_MAX (1024 * 1024)
 
 int gdb_target_add_all(struct target *target);
 int gdb_register_commands(struct command_context *command_context);
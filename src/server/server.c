@@ -44,6 +44,10 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 static struct service *services;
 
 /* shutdown_openocd == 1: exit the main event loop, and quit the
@@ -59,6 +63,117 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+#ifdef HAVE_SYS_EPOLL_H
+/* maximum number of ready fds reported by a single epoll_wait() */
+#define SERVER_MAX_EVENTS 64
+
+/* epoll instance watching all listener and connection fds; -1 means the
+ * select() fallback is in use */
+static int server_epoll_fd = -1;
+static struct epoll_event server_events[SERVER_MAX_EVENTS];
+static int server_event_count;
+#endif
+
+/* Start watching fd for input. Listener and connection fds are registered
+ * once when they are created rather than on every server_loop() iteration. */
+static void server_watch_fd(int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd == -1 || fd == -1)
+		return;
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.fd = fd,
+	};
+	if (epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1 && errno != EEXIST) {
+		/* e.g. stdin redirected from a regular file, which epoll refuses
+		 * but select() reports as always readable */
+		LOG_DEBUG("cannot watch fd %d with epoll (%s), falling back to select",
+			fd, strerror(errno));
+		close(server_epoll_fd);
+		server_epoll_fd = -1;
+	}
+#endif
+}
+
+static void server_unwatch_fd(int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd == -1 || fd == -1)
+		return;
+
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+	/* forget events already collected for this fd, the number may be
+	 * reused by a connection accepted later in this iteration */
+	for (int i = 0; i < server_event_count; i++) {
+		if (server_events[i].data.fd == fd)
+			server_events[i].data.fd = -1;
+	}
+#endif
+}
+
+/* check whether the last wait reported input on fd */
+static bool server_fd_ready(int fd, fd_set *read_fds)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd != -1) {
+		for (int i = 0; i < server_event_count; i++) {
+			if (server_events[i].data.fd == fd)
+				return true;
+		}
+		return false;
+	}
+#endif
+	return FD_ISSET(fd, read_fds);
+}
+
+/* Wait up to timeout_ms for input on any service or connection fd.
+ * Returns the number of ready fds, 0 on timeout or -1 on error. */
+static int server_wait(fd_set *read_fds, int timeout_ms)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd != -1) {
+		/* keep read_fds valid in case we fall back to select() while
+		 * dispatching this iteration */
+		FD_ZERO(read_fds);
+		server_event_count = 0;
+		int retval = epoll_wait(server_epoll_fd, server_events,
+				SERVER_MAX_EVENTS, timeout_ms);
+		if (retval > 0)
+			server_event_count = retval;
+		return retval;
+	}
+#endif
+
+	/* select() needs the full set rebuilt on every call */
+	int fd_max = 0;
+	FD_ZERO(read_fds);
+
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1) {
+			/* listen for new connections */
+			FD_SET(service->fd, read_fds);
+
+			if (service->fd > fd_max)
+				fd_max = service->fd;
+		}
+
+		for (struct connection *c = service->connections; c; c = c->next) {
+			/* check for activity on the connection */
+			FD_SET(c->fd, read_fds);
+			if (c->fd > fd_max)
+				fd_max = c->fd;
+		}
+	}
+
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	return socket_select(fd_max + 1, read_fds, NULL, NULL, &tv);
+}
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -102,6 +217,8 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 			free(c);
 			return retval;
 		}
+
+		server_watch_fd(c->fd);
 	} else if (service->type == CONNECTION_STDINOUT) {
 		c->fd = service->fd;
 		c->fd_out = fileno(stdout);
@@ -167,12 +284,14 @@ static int remove_connection(struct service *service, struct connection *connect
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
 			service->connection_closed(c);
-			if (service->type == CONNECTION_TCP)
+			if (service->type == CONNECTION_TCP) {
+				server_unwatch_fd(c->fd);
 				close_socket(c->fd);
-			else if (service->type == CONNECTION_PIPE) {
+			} else if (service->type == CONNECTION_PIPE) {
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
-			}
+			} else
+				server_unwatch_fd(c->fd);
 
 			command_done(c->cmd_ctx);
 
@@ -343,6 +462,8 @@ int add_service(char *name,
 #endif
 	}
 
+	server_watch_fd(c->fd);
+
 	/* add to the end of linked list */
 	for (p = &services; *p; p = &(*p)->next)
 		;
@@ -363,8 +484,10 @@ static int remove_services(void)
 			free(c->name);
 
 		if (c->type == CONNECTION_PIPE) {
-			if (c->fd != -1)
+			if (c->fd != -1) {
+				server_unwatch_fd(c->fd);
 				close(c->fd);
+			}
 		}
 		if (c->port)
 			free(c->port);
@@ -392,7 +515,6 @@ int server_loop(struct command_context *command_context)
 
 	/* used in select() */
 	fd_set read_fds;
-	int fd_max;
 
 	/* used in accept() */
 	int retval;
@@ -403,46 +525,29 @@ int server_loop(struct command_context *command_context)
 #endif
 
 	while (!shutdown_openocd) {
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
-
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next) {
-			if (service->fd != -1) {
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
-
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
-
-			if (service->connections) {
-				struct connection *c;
-
-				for (c = service->connections; c; c = c->next) {
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
+		/* buffered input still waiting to be processed must not be
+		 * delayed by a sleep */
+		for (service = services; service && !poll_ok; service = service->next) {
+			for (struct connection *c = service->connections; c; c = c->next) {
+				if (c->input_pending) {
+					poll_ok = true;
+					break;
 				}
 			}
 		}
 
-		struct timeval tv;
-		tv.tv_sec = 0;
 		if (poll_ok) {
 			/* we're just polling this iteration, this is faster on embedded
 			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(&read_fds, 0);
 		} else {
-			/* Every 100ms, can be changed with "poll_period" command */
-			tv.tv_usec = polling_period * 1000;
+			/* Sleep until the next timer callback is due, but at most
+			 * 100ms, which can be changed with "poll_period" command */
+			int timeout_ms = target_timer_next_event(polling_period);
 			/* Only while we're sleeping we'll let others run */
 			openocd_sleep_prelude();
 			kept_alive();
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(&read_fds, timeout_ms);
 			openocd_sleep_postlude();
 		}
 
@@ -459,9 +564,12 @@ int server_loop(struct command_context *command_context)
 			}
 #else
 
-			if (errno == EINTR)
+			if (errno == EINTR) {
 				FD_ZERO(&read_fds);
-			else {
+#ifdef HAVE_SYS_EPOLL_H
+				server_event_count = 0;
+#endif
+			} else {
 				LOG_ERROR("error during select: %s", strerror(errno));
 				return ERROR_FAIL;
 			}
@@ -475,6 +583,9 @@ int server_loop(struct command_context *command_context)
 			process_jim_events(command_context);
 
 			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
+#ifdef HAVE_SYS_EPOLL_H
+			server_event_count = 0;
+#endif
 
 			/* We timed out/there was nothing to do, timeout rather than poll next time
 			 **/
@@ -494,7 +605,7 @@ int server_loop(struct command_context *command_context)
 		for (service = services; service; service = service->next) {
 			/* handle new connections on listeners */
 			if ((service->fd != -1)
-			    && (FD_ISSET(service->fd, &read_fds))) {
+			    && server_fd_ready(service->fd, &read_fds)) {
 				if (service->max_connections != 0)
 					add_connection(service, command_context);
 				else {
@@ -518,7 +629,7 @@ int server_loop(struct command_context *command_context)
 				struct connection *c;
 
 				for (c = service->connections; c; ) {
-					if ((FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
+					if (server_fd_ready(c->fd, &read_fds) || c->input_pending) {
 						retval = service->input(c);
 						if (retval != ERROR_OK) {
 							struct connection *next = c->next;
@@ -594,6 +705,12 @@ int server_preinit(void)
 	signal(SIGTERM, sig_handler);
 	signal(SIGABRT, sig_handler);
 
+#ifdef HAVE_SYS_EPOLL_H
+	server_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_epoll_fd == -1)
+		LOG_DEBUG("epoll unavailable (%s), using select", strerror(errno));
+#endif
+
 	return ERROR_OK;
 }
 
@@ -619,6 +736,13 @@ int server_quit(void)
 	remove_services();
 	target_quit();
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd != -1) {
+		close(server_epoll_fd);
+		server_epoll_fd = -1;
+	}
+#endif
+
 #ifdef _WIN32
 	WSACleanup();
 	SetConsoleCtrlHandler(ControlHandler, FALSE);
@@ -2211,6 +2211,15 @@ static int aarch64_examine_first(struct target *target)
 	if (retval != ERROR_OK)
 		return retval;
 
+	/* EDPCSR is optional, EDDEVID.PCSample tells whether it exists */
+	uint32_t devid;
+	retval = mem_ap_read_atomic_u32(armv8->debug_ap,
+			armv8->debug_base + CPUV8_DBG_EDDEVID, &devid);
+	if (retval != ERROR_OK)
+		return retval;
+	armv8->dpm.pcsr = (devid & 0xf) ? armv8->debug_base + CPUV8_DBG_EDPCSR : 0;
+	armv8->dpm.pcsr_offset = false;
+
 	/* Setup Breakpoint Register Pairs */
 	aarch64->brp_num = (uint32_t)((debug >> 12) & 0x0F) + 1;
 	aarch64->brp_num_context = (uint32_t)((debug >> 28) & 0x0F) + 1;
@@ -2251,6 +2260,16 @@ static int aarch64_examine(struct target *target)
 	return retval;
 }
 
+static int aarch64_profiling(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct armv8_common *armv8 = target_to_armv8(target);
+
+	/* only the low half of EDPCSR fits the 32 bit gmon samples */
+	return arm_dpm_profiling(&armv8->dpm, armv8->debug_ap, samples,
+			max_num_samples, num_samples, seconds);
+}
+
 /*
  *	Cortex-A8 target creation and initialization
  */
@@ -2440,6 +2459,8 @@ struct target_type aarch64_target = {
 	.add_watchpoint = NULL,
 	.remove_watchpoint = NULL,
 
+	.profiling = aarch64_profiling,
+
 	.commands = aarch64_command_handlers,
 	.target_create = aarch64_target_create,
 	.init_target = aarch64_init_target,
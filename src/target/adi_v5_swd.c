@@ -271,6 +271,71 @@ static int swd_queue_ap_write(struct adiv5_ap *ap, unsigned reg,
 	return check_sync(dap);
 }
 
+static int swd_queue_ap_read_block(struct adiv5_ap *ap, unsigned reg,
+		uint32_t *data, unsigned count)
+{
+	const struct swd_driver *swd = jtag_interface->swd;
+	assert(swd);
+
+	struct adiv5_dap *dap = ap->dap;
+
+	/* each access has to be run on its own */
+	if (do_sync) {
+		for (unsigned i = 0; i < count; i++) {
+			int retval = swd_queue_ap_read(ap, reg, &data[i]);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		return ERROR_OK;
+	}
+
+	int retval = swd_check_reconnect(dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	swd_queue_ap_bankselect(ap, reg);
+
+	const uint8_t cmd = swd_cmd(true,  true, reg);
+	for (unsigned i = 0; i < count; i++) {
+		swd->read_reg(cmd, dap->last_read, ap->memaccess_tck);
+		dap->last_read = &data[i];
+	}
+
+	return ERROR_OK;
+}
+
+static int swd_queue_ap_write_block(struct adiv5_ap *ap, unsigned reg,
+		const uint8_t *buffer, unsigned count)
+{
+	const struct swd_driver *swd = jtag_interface->swd;
+	assert(swd);
+
+	struct adiv5_dap *dap = ap->dap;
+
+	/* each access has to be run on its own */
+	if (do_sync) {
+		for (unsigned i = 0; i < count; i++) {
+			int retval = swd_queue_ap_write(ap, reg, le_to_h_u32(&buffer[4 * i]));
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		return ERROR_OK;
+	}
+
+	int retval = swd_check_reconnect(dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	swd_finish_read(dap);
+	swd_queue_ap_bankselect(ap, reg);
+
+	const uint8_t cmd = swd_cmd(false,  true, reg);
+	for (unsigned i = 0; i < count; i++)
+		swd->write_reg(cmd, le_to_h_u32(&buffer[4 * i]), ap->memaccess_tck);
+
+	return ERROR_OK;
+}
+
 /** Executes all queued DAP operations. */
 static int swd_run(struct adiv5_dap *dap)
 {
@@ -283,6 +348,8 @@ const struct dap_ops swd_dap_ops = {
 	.queue_dp_write = swd_queue_dp_write,
 	.queue_ap_read = swd_queue_ap_read,
 	.queue_ap_write = swd_queue_ap_write,
+	.queue_ap_read_block = swd_queue_ap_read_block,
+	.queue_ap_write_block = swd_queue_ap_write_block,
 	.queue_ap_abort = swd_queue_ap_abort,
 	.run = swd_run,
 };
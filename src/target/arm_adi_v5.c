@@ -252,20 +252,58 @@ int mem_ap_write_atomic_u32(struct adiv5_ap *ap, uint32_t address,
 	return dap_run(ap->dap);
 }
 
-/**
- * Synchronous write of a block of memory, using a specific access size.
- *
- * @param ap The MEM-AP to access.
- * @param buffer The data buffer to write. No particular alignment is assumed.
- * @param size Which access size to use, in bytes. 1, 2 or 4.
- * @param count The number of writes to do (in size units, not bytes).
- * @param address Address to be written; it must be writable by the currently selected MEM-AP.
- * @param addrinc Whether the target address should be increased for each write or not. This
- *  should normally be true, except when writing to e.g. a FIFO.
- * @return ERROR_OK on success, otherwise an error code.
- */
-static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size, uint32_t count,
+/* Check that an access of the given size and address can be done */
+static int mem_ap_check_access(struct adiv5_ap *ap, uint32_t size, uint32_t adr)
+{
+	if (size != 4 && size != 2 && size != 1)
+		return ERROR_TARGET_UNALIGNED_ACCESS;
+
+	if (ap->unaligned_access_bad && (adr % size != 0))
+		return ERROR_TARGET_UNALIGNED_ACCESS;
+
+	return ERROR_OK;
+}
+
+/* True when a transfer is plain aligned words: every DRW access then carries
+ * four consecutive buffer bytes in little-endian order. */
+static bool mem_ap_is_word_transfer(struct adiv5_ap *ap, uint32_t size,
 		uint32_t address, bool addrinc)
+{
+	return size == 4 && addrinc && address % 4 == 0 && !ap->dap->ti_be_32_quirks;
+}
+
+/* Queue aligned word writes, handing whole TAR auto-increment blocks to the
+ * transport at once. */
+static int mem_ap_queue_write_words(struct adiv5_ap *ap, const uint8_t *buffer,
+		uint32_t count, uint32_t address)
+{
+	int retval = mem_ap_setup_csw(ap, CSW_32BIT | CSW_ADDRINC_SINGLE);
+	if (retval != ERROR_OK)
+		return retval;
+
+	while (count > 0) {
+		uint32_t block = MIN(count, max_tar_block_size(ap->tar_autoincr_block, address) / 4);
+
+		retval = mem_ap_setup_tar(ap, address);
+		if (retval != ERROR_OK)
+			return retval;
+
+		retval = dap_queue_ap_write_block(ap, MEM_AP_REG_DRW, buffer, block);
+		if (retval != ERROR_OK)
+			return retval;
+
+		buffer += 4 * block;
+		address += 4 * block;
+		count -= block;
+	}
+
+	return ERROR_OK;
+}
+
+/* Queue the DRW writes of one transfer without running the queue, see
+ * mem_ap_write(). size must already have been validated. */
+static int mem_ap_queue_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size,
+		uint32_t count, uint32_t address, bool addrinc)
 {
 	struct adiv5_dap *dap = ap->dap;
 	size_t nbytes = size * count;
@@ -274,6 +312,9 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 	uint32_t addr_xor;
 	int retval;
 
+	if (mem_ap_is_word_transfer(ap, size, address, addrinc))
+		return mem_ap_queue_write_words(ap, buffer, count, address);
+
 	/* TI BE-32 Quirks mode:
 	 * Writes on big-endian TMS570 behave very strangely. Observed behavior:
 	 *   size   write address   bytes written in order
@@ -293,16 +334,11 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 	} else if (size == 2) {
 		csw_size = CSW_16BIT;
 		addr_xor = dap->ti_be_32_quirks ? 2 : 0;
-	} else if (size == 1) {
+	} else {
 		csw_size = CSW_8BIT;
 		addr_xor = dap->ti_be_32_quirks ? 3 : 0;
-	} else {
-		return ERROR_TARGET_UNALIGNED_ACCESS;
 	}
 
-	if (ap->unaligned_access_bad && (address % size != 0))
-		return ERROR_TARGET_UNALIGNED_ACCESS;
-
 	retval = mem_ap_setup_tar(ap, address ^ addr_xor);
 	if (retval != ERROR_OK)
 		return retval;
@@ -320,7 +356,7 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 		}
 
 		if (retval != ERROR_OK)
-			break;
+			return retval;
 
 		/* How many source bytes each transfer will consume, and their location in the DRW,
 		 * depends on the type of transfer and alignment. See ARM document IHI0031C. */
@@ -357,17 +393,42 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 
 		retval = dap_queue_ap_write(ap, MEM_AP_REG_DRW, outvalue);
 		if (retval != ERROR_OK)
-			break;
+			return retval;
 
 		/* Rewrite TAR if it wrapped or we're xoring addresses */
 		if (addrinc && (addr_xor || (address % ap->tar_autoincr_block < size && nbytes > 0))) {
 			retval = mem_ap_setup_tar(ap, address ^ addr_xor);
 			if (retval != ERROR_OK)
-				break;
+				return retval;
 		}
 	}
 
-	/* REVISIT: Might want to have a queued version of this function that does not run. */
+	return ERROR_OK;
+}
+
+/**
+ * Synchronous write of a block of memory, using a specific access size.
+ *
+ * @param ap The MEM-AP to access.
+ * @param buffer The data buffer to write. No particular alignment is assumed.
+ * @param size Which access size to use, in bytes. 1, 2 or 4.
+ * @param count The number of writes to do (in size units, not bytes).
+ * @param address Address to be written; it must be writable by the currently selected MEM-AP.
+ * @param addrinc Whether the target address should be increased for each write or not. This
+ *  should normally be true, except when writing to e.g. a FIFO.
+ * @return ERROR_OK on success, otherwise an error code.
+ */
+static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t size, uint32_t count,
+		uint32_t address, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	int retval;
+
+	retval = mem_ap_check_access(ap, size, address);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = mem_ap_queue_write(ap, buffer, size, count, address, addrinc);
 	if (retval == ERROR_OK)
 		retval = dap_run(dap);
 
@@ -383,66 +444,60 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 	return retval;
 }
 
-/**
- * Synchronous read of a block of memory, using a specific access size.
- *
- * @param ap The MEM-AP to access.
- * @param buffer The data buffer to receive the data. No particular alignment is assumed.
- * @param size Which access size to use, in bytes. 1, 2 or 4.
- * @param count The number of reads to do (in size units, not bytes).
- * @param address Address to be read; it must be readable by the currently selected MEM-AP.
- * @param addrinc Whether the target address should be increased after each read or not. This
- *  should normally be true, except when reading from e.g. a FIFO.
- * @return ERROR_OK on success, otherwise an error code.
- */
-static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
-		uint32_t adr, bool addrinc)
+/* Queue aligned word reads, handing whole TAR auto-increment blocks to the
+ * transport at once. */
+static int mem_ap_queue_read_words(struct adiv5_ap *ap, uint32_t **read_ptr,
+		uint32_t count, uint32_t address)
+{
+	int retval = mem_ap_setup_csw(ap, CSW_32BIT | CSW_ADDRINC_SINGLE);
+	if (retval != ERROR_OK)
+		return retval;
+
+	while (count > 0) {
+		uint32_t block = MIN(count, max_tar_block_size(ap->tar_autoincr_block, address) / 4);
+
+		retval = mem_ap_setup_tar(ap, address);
+		if (retval != ERROR_OK)
+			return retval;
+
+		retval = dap_queue_ap_read_block(ap, MEM_AP_REG_DRW, *read_ptr, block);
+		if (retval != ERROR_OK)
+			return retval;
+
+		*read_ptr += block;
+		address += 4 * block;
+		count -= block;
+	}
+
+	return ERROR_OK;
+}
+
+/* Queue up all DRW reads of one transfer. Each read will store the entire DRW word at
+ * *read_ptr, which is advanced. How many useful bytes it contains, and their location
+ * in the word, depends on the type of transfer and alignment; see mem_ap_unpack_read(). */
+static int mem_ap_queue_read(struct adiv5_ap *ap, uint32_t **read_ptr, uint32_t size,
+		uint32_t count, uint32_t adr, bool addrinc)
 {
-	struct adiv5_dap *dap = ap->dap;
 	size_t nbytes = size * count;
 	const uint32_t csw_addrincr = addrinc ? CSW_ADDRINC_SINGLE : CSW_ADDRINC_OFF;
 	uint32_t csw_size;
 	uint32_t address = adr;
 	int retval;
 
-	/* TI BE-32 Quirks mode:
-	 * Reads on big-endian TMS570 behave strangely differently than writes.
-	 * They read from the physical address requested, but with DRW byte-reversed.
-	 * For example, a byte read from address 0 will place the result in the high bytes of DRW.
-	 * Also, packed 8-bit and 16-bit transfers seem to sometimes return garbage in some bytes,
-	 * so avoid them. */
+	if (mem_ap_is_word_transfer(ap, size, adr, addrinc))
+		return mem_ap_queue_read_words(ap, read_ptr, count, adr);
 
 	if (size == 4)
 		csw_size = CSW_32BIT;
 	else if (size == 2)
 		csw_size = CSW_16BIT;
-	else if (size == 1)
-		csw_size = CSW_8BIT;
 	else
-		return ERROR_TARGET_UNALIGNED_ACCESS;
-
-	if (ap->unaligned_access_bad && (adr % size != 0))
-		return ERROR_TARGET_UNALIGNED_ACCESS;
-
-	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
-	 * over-allocation if packed transfers are going to be used, but determining the real need at
-	 * this point would be messy. */
-	uint32_t *read_buf = malloc(count * sizeof(uint32_t));
-	uint32_t *read_ptr = read_buf;
-	if (read_buf == NULL) {
-		LOG_ERROR("Failed to allocate read buffer");
-		return ERROR_FAIL;
-	}
+		csw_size = CSW_8BIT;
 
 	retval = mem_ap_setup_tar(ap, address);
-	if (retval != ERROR_OK) {
-		free(read_buf);
+	if (retval != ERROR_OK)
 		return retval;
-	}
 
-	/* Queue up all reads. Each read will store the entire DRW word in the read buffer. How many
-	 * useful bytes it contains, and their location in the word, depends on the type of transfer
-	 * and alignment. */
 	while (nbytes > 0) {
 		uint32_t this_size = size;
 
@@ -455,11 +510,11 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 			retval = mem_ap_setup_csw(ap, csw_size | csw_addrincr);
 		}
 		if (retval != ERROR_OK)
-			break;
+			return retval;
 
-		retval = dap_queue_ap_read(ap, MEM_AP_REG_DRW, read_ptr++);
+		retval = dap_queue_ap_read(ap, MEM_AP_REG_DRW, (*read_ptr)++);
 		if (retval != ERROR_OK)
-			break;
+			return retval;
 
 		nbytes -= this_size;
 		address += this_size;
@@ -468,34 +523,29 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		if (addrinc && address % ap->tar_autoincr_block < size && nbytes > 0) {
 			retval = mem_ap_setup_tar(ap, address);
 			if (retval != ERROR_OK)
-				break;
+				return retval;
 		}
 	}
 
-	if (retval == ERROR_OK)
-		retval = dap_run(dap);
+	return ERROR_OK;
+}
 
-	/* Restore state */
-	address = adr;
-	nbytes = size * count;
-	read_ptr = read_buf;
+/* Replay loop to populate caller's buffer from the correct word and byte lane.
+ * Returns the first DRW word not consumed. */
+static const uint32_t *mem_ap_unpack_read(struct adiv5_ap *ap, uint8_t *buffer,
+		uint32_t size, size_t nbytes, uint32_t address, bool addrinc,
+		const uint32_t *read_ptr)
+{
+	struct adiv5_dap *dap = ap->dap;
 
-	/* If something failed, read TAR to find out how much data was successfully read, so we can
-	 * at least give the caller what we have. */
-	if (retval != ERROR_OK) {
-		uint32_t tar;
-		if (dap_queue_ap_read(ap, MEM_AP_REG_TAR, &tar) == ERROR_OK
-				&& dap_run(dap) == ERROR_OK) {
-			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
-			if (nbytes > tar - address)
-				nbytes = tar - address;
-		} else {
-			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
-			nbytes = 0;
+	if (mem_ap_is_word_transfer(ap, size, address, addrinc)) {
+		for (; nbytes >= 4; nbytes -= 4) {
+			h_u32_to_le(buffer, *read_ptr++);
+			buffer += 4;
+			address += 4;
 		}
 	}
 
-	/* Replay loop to populate caller's buffer from the correct word and byte lane */
 	while (nbytes > 0) {
 		uint32_t this_size = size;
 
@@ -530,6 +580,71 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		nbytes -= this_size;
 	}
 
+	return read_ptr;
+}
+
+/**
+ * Synchronous read of a block of memory, using a specific access size.
+ *
+ * @param ap The MEM-AP to access.
+ * @param buffer The data buffer to receive the data. No particular alignment is assumed.
+ * @param size Which access size to use, in bytes. 1, 2 or 4.
+ * @param count The number of reads to do (in size units, not bytes).
+ * @param address Address to be read; it must be readable by the currently selected MEM-AP.
+ * @param addrinc Whether the target address should be increased after each read or not. This
+ *  should normally be true, except when reading from e.g. a FIFO.
+ * @return ERROR_OK on success, otherwise an error code.
+ */
+static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint32_t count,
+		uint32_t adr, bool addrinc)
+{
+	struct adiv5_dap *dap = ap->dap;
+	size_t nbytes = size * count;
+	uint32_t address = adr;
+	int retval;
+
+	/* TI BE-32 Quirks mode:
+	 * Reads on big-endian TMS570 behave strangely differently than writes.
+	 * They read from the physical address requested, but with DRW byte-reversed.
+	 * For example, a byte read from address 0 will place the result in the high bytes of DRW.
+	 * Also, packed 8-bit and 16-bit transfers seem to sometimes return garbage in some bytes,
+	 * so avoid them. */
+
+	retval = mem_ap_check_access(ap, size, adr);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
+	 * over-allocation if packed transfers are going to be used, but determining the real need at
+	 * this point would be messy. */
+	uint32_t *read_buf = malloc(count * sizeof(uint32_t));
+	uint32_t *read_ptr = read_buf;
+	if (read_buf == NULL) {
+		LOG_ERROR("Failed to allocate read buffer");
+		return ERROR_FAIL;
+	}
+
+	retval = mem_ap_queue_read(ap, &read_ptr, size, count, adr, addrinc);
+	if (retval == ERROR_OK)
+		retval = dap_run(dap);
+
+	/* If something failed, read TAR to find out how much data was successfully read, so we can
+	 * at least give the caller what we have. */
+	if (retval != ERROR_OK) {
+		uint32_t tar;
+		if (dap_queue_ap_read(ap, MEM_AP_REG_TAR, &tar) == ERROR_OK
+				&& dap_run(dap) == ERROR_OK) {
+			LOG_ERROR("Failed to read memory at 0x%08"PRIx32, tar);
+			if (nbytes > tar - address)
+				nbytes = tar - address;
+		} else {
+			LOG_ERROR("Failed to read memory and, additionally, failed to find out where");
+			nbytes = 0;
+		}
+	}
+
+	mem_ap_unpack_read(ap, buffer, size, nbytes, adr, addrinc, read_buf);
+
 	free(read_buf);
 	return retval;
 }
@@ -546,6 +661,76 @@ int mem_ap_write_buf(struct adiv5_ap *ap,
 	return mem_ap_write(ap, buffer, size, count, address, true);
 }
 
+/**
+ * Carry out several memory reads and writes through one MEM-AP with a single
+ * dap_run(), so that e.g. the unaligned head, body and tail of a buffer, or
+ * a data block plus the pointer words around it, cost one adapter round trip.
+ */
+int mem_ap_buf_batch(struct adiv5_ap *ap,
+		const struct target_memory_request *requests, unsigned int count)
+{
+	size_t words = 0;
+	int retval;
+
+	for (unsigned int i = 0; i < count; i++) {
+		retval = mem_ap_check_access(ap, requests[i].size, requests[i].address);
+		if (retval != ERROR_OK)
+			return retval;
+		if (!requests[i].wbuffer)
+			words += requests[i].count;
+	}
+
+	uint32_t *read_buf = NULL;
+	uint32_t *read_ptr = NULL;
+	if (words > 0) {
+		read_buf = malloc(words * sizeof(uint32_t));
+		read_ptr = read_buf;
+		if (read_buf == NULL) {
+			LOG_ERROR("Failed to allocate read buffer");
+			return ERROR_FAIL;
+		}
+	}
+
+	retval = ERROR_OK;
+	for (unsigned int i = 0; i < count && retval == ERROR_OK; i++) {
+		if (requests[i].wbuffer)
+			retval = mem_ap_queue_write(ap, requests[i].wbuffer, requests[i].size,
+					requests[i].count, requests[i].address, true);
+		else
+			retval = mem_ap_queue_read(ap, &read_ptr, requests[i].size,
+					requests[i].count, requests[i].address, true);
+	}
+	if (retval == ERROR_OK)
+		retval = dap_run(ap->dap);
+
+	if (retval != ERROR_OK) {
+		/* Redo the reads one by one, which reports where the fault happened
+		 * and returns the data read before it.  Writes are not repeated,
+		 * some of them may already have taken effect. */
+		free(read_buf);
+		for (unsigned int i = 0; i < count; i++) {
+			if (requests[i].wbuffer)
+				continue;
+			int read_retval = mem_ap_read(ap, requests[i].buffer, requests[i].size,
+					requests[i].count, requests[i].address, true);
+			if (read_retval != ERROR_OK)
+				return read_retval;
+		}
+		return retval;
+	}
+
+	const uint32_t *words_ptr = read_buf;
+	for (unsigned int i = 0; i < count; i++) {
+		if (!requests[i].wbuffer)
+			words_ptr = mem_ap_unpack_read(ap, requests[i].buffer, requests[i].size,
+					requests[i].size * requests[i].count, requests[i].address,
+					true, words_ptr);
+	}
+
+	free(read_buf);
+	return ERROR_OK;
+}
+
 int mem_ap_read_buf_noincr(struct adiv5_ap *ap,
 		uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address)
 {
@@ -558,6 +743,69 @@ int mem_ap_write_buf_noincr(struct adiv5_ap *ap,
 	return mem_ap_write(ap, buffer, size, count, address, false);
 }
 
+/* number of PC samples fetched per MEM-AP block transfer */
+#define MEM_AP_PCSR_BATCH	1024
+
+/**
+ * Profile a running core by reading its PC sample register through a
+ * MEM-AP, many reads per queue flush.  Unlike the default halt and resume
+ * sampler this does not perturb the program being profiled.  The caller
+ * makes sure the core is running.
+ *
+ * @param pcsr Bus address of the PC sample register.
+ * @param pcsr_to_pc Converts a raw sample to a PC, or NULL if the sample
+ *	already is the PC.
+ */
+int mem_ap_profiling_pcsr(struct target *target, struct adiv5_ap *ap,
+		uint32_t pcsr, uint32_t (*pcsr_to_pc)(struct target *target, uint32_t pcsr),
+		uint32_t *samples, uint32_t max_num_samples,
+		uint32_t *num_samples, uint32_t seconds)
+{
+	struct timeval timeout, now;
+	int retval;
+
+	uint8_t *buffer = malloc(MEM_AP_PCSR_BATCH * 4);
+	if (buffer == NULL) {
+		LOG_ERROR("No memory for PCSR samples");
+		return ERROR_FAIL;
+	}
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
+	LOG_INFO("Starting profiling. Sampling PCSR as fast as we can...");
+
+	uint32_t sample_count = 0;
+	for (;;) {
+		uint32_t read_count = MIN(max_num_samples - sample_count, MEM_AP_PCSR_BATCH);
+
+		retval = mem_ap_read_buf_noincr(ap, buffer, 4, read_count, pcsr);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error while reading PCSR");
+			break;
+		}
+
+		for (uint32_t i = 0; i < read_count; i++) {
+			uint32_t value = target_buffer_get_u32(target, buffer + 4 * i);
+			/* all ones: core halted, in debug state or sampling prohibited */
+			if (value == 0xffffffff)
+				continue;
+			samples[sample_count++] = pcsr_to_pc ? pcsr_to_pc(target, value) : value;
+		}
+
+		gettimeofday(&now, NULL);
+		if (sample_count >= max_num_samples || now.tv_sec > timeout.tv_sec ||
+				(now.tv_sec == timeout.tv_sec && now.tv_usec >= timeout.tv_usec)) {
+			LOG_INFO("Profiling completed. %" PRIu32 " samples.", sample_count);
+			break;
+		}
+	}
+
+	free(buffer);
+	*num_samples = sample_count;
+	return retval;
+}
+
 /*--------------------------------------------------------------------------*/
 
 
@@ -264,6 +264,14 @@ struct dap_ops {
 	int (*queue_ap_write)(struct adiv5_ap *ap, unsigned reg,
 			uint32_t data);
 
+	/** Optional: count reads of the same AP register. */
+	int (*queue_ap_read_block)(struct adiv5_ap *ap, unsigned reg,
+			uint32_t *data, unsigned count);
+	/** Optional: count writes of little-endian words to the same
+	 * AP register. */
+	int (*queue_ap_write_block)(struct adiv5_ap *ap, unsigned reg,
+			const uint8_t *buffer, unsigned count);
+
 	/** AP operation abort. */
 	int (*queue_ap_abort)(struct adiv5_dap *dap, uint8_t *ack);
 
@@ -363,6 +371,58 @@ static inline int dap_queue_ap_write(struct adiv5_ap *ap,
 	return ap->dap->ops->queue_ap_write(ap, reg, data);
 }
 
+/**
+ * Queue a run of reads of the same AP register, typically DRW with
+ * address auto-increment.
+ *
+ * @param ap The AP used for reading.
+ * @param reg The number of the AP register being read.
+ * @param data Array of count words receiving the values (host endianness).
+ * @param count Number of reads.
+ *
+ * @return ERROR_OK for success, else a fault code.
+ */
+static inline int dap_queue_ap_read_block(struct adiv5_ap *ap,
+		unsigned reg, uint32_t *data, unsigned count)
+{
+	assert(ap->dap->ops != NULL);
+	if (ap->dap->ops->queue_ap_read_block)
+		return ap->dap->ops->queue_ap_read_block(ap, reg, data, count);
+
+	for (unsigned i = 0; i < count; i++) {
+		int retval = ap->dap->ops->queue_ap_read(ap, reg, &data[i]);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	return ERROR_OK;
+}
+
+/**
+ * Queue a run of writes to the same AP register, typically DRW with
+ * address auto-increment.
+ *
+ * @param ap The AP used for writing.
+ * @param reg The number of the AP register being written.
+ * @param buffer count words to write, little-endian, no alignment assumed.
+ * @param count Number of writes.
+ *
+ * @return ERROR_OK for success, else a fault code.
+ */
+static inline int dap_queue_ap_write_block(struct adiv5_ap *ap,
+		unsigned reg, const uint8_t *buffer, unsigned count)
+{
+	assert(ap->dap->ops != NULL);
+	if (ap->dap->ops->queue_ap_write_block)
+		return ap->dap->ops->queue_ap_write_block(ap, reg, buffer, count);
+
+	for (unsigned i = 0; i < count; i++) {
+		int retval = ap->dap->ops->queue_ap_write(ap, reg, le_to_h_u32(&buffer[4 * i]));
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	return ERROR_OK;
+}
+
 /**
  * Queue an AP abort operation.  The current AP transaction is aborted,
  * including any update of the transaction counter.  The AP is left in
@@ -463,12 +523,24 @@ int mem_ap_read_buf(struct adiv5_ap *ap,
 int mem_ap_write_buf(struct adiv5_ap *ap,
 		const uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 
+/* Several block reads and writes sharing one queue run. */
+struct target_memory_request;
+int mem_ap_buf_batch(struct adiv5_ap *ap,
+		const struct target_memory_request *requests, unsigned int count);
+
 /* Synchronous, non-incrementing buffer functions for accessing fifos. */
 int mem_ap_read_buf_noincr(struct adiv5_ap *ap,
 		uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 int mem_ap_write_buf_noincr(struct adiv5_ap *ap,
 		const uint8_t *buffer, uint32_t size, uint32_t count, uint32_t address);
 
+/* Non-intrusive profiling by sampling a PC sample register through the AP. */
+struct target;
+int mem_ap_profiling_pcsr(struct target *target, struct adiv5_ap *ap,
+		uint32_t pcsr, uint32_t (*pcsr_to_pc)(struct target *target, uint32_t pcsr),
+		uint32_t *samples, uint32_t max_num_samples,
+		uint32_t *num_samples, uint32_t seconds);
+
 /* Create DAP struct */
 struct adiv5_dap *dap_init(void);
 
@@ -21,6 +21,7 @@
 
 #include "arm.h"
 #include "arm_dpm.h"
+#include "arm_adi_v5.h"
 #include "armv8_dpm.h"
 #include <jtag/jtag.h>
 #include "register.h"
@@ -948,6 +949,52 @@ void arm_dpm_report_dscr(struct arm_dpm *dpm, uint32_t dscr)
 	}
 }
 
+static uint32_t dpm_pcsr_to_pc(struct target *target, uint32_t pcsr)
+{
+	struct arm_dpm *dpm = target_to_arm(target)->dpm;
+
+	if (!dpm->pcsr_offset)
+		return pcsr & ~1;
+
+	/* ARMv7 debug: bits [1:0] encode the instruction set */
+	if (pcsr & 1)
+		return (pcsr & ~1) - 4;		/* Thumb, ThumbEE */
+	if ((pcsr & 3) == 0)
+		return pcsr - 8;		/* ARM */
+	return pcsr & ~3;			/* Jazelle */
+}
+
+/**
+ * Profile a running core through its PC sample register, see
+ * mem_ap_profiling_pcsr().  Cores without a PC sample register use
+ * target_profiling_default().
+ */
+int arm_dpm_profiling(struct arm_dpm *dpm, struct adiv5_ap *ap,
+		uint32_t *samples, uint32_t max_num_samples,
+		uint32_t *num_samples, uint32_t seconds)
+{
+	struct target *target = dpm->arm->target;
+
+	if (!dpm->pcsr) {
+		LOG_INFO("PCSR sampling not supported on this processor.");
+		return target_profiling_default(target, samples, max_num_samples,
+				num_samples, seconds);
+	}
+
+	/* Make sure the target is running */
+	target_poll(target);
+	if (target->state == TARGET_HALTED) {
+		int retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error while resuming target");
+			return retval;
+		}
+	}
+
+	return mem_ap_profiling_pcsr(target, ap, dpm->pcsr, dpm_pcsr_to_pc,
+			samples, max_num_samples, num_samples, seconds);
+}
+
 /*----------------------------------------------------------------------*/
 
 /*
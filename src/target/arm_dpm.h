@@ -146,6 +146,12 @@ struct arm_dpm {
 	/** Recent exception level on armv8 */
 	unsigned int last_el;
 
+	/** Address of the PC sample register (DBGPCSR/EDPCSR), 0 if absent. */
+	uint32_t pcsr;
+
+	/** PCSR samples include the ARM (+8) / Thumb (+4) pipeline offset. */
+	bool pcsr_offset;
+
 	/* FIXME -- read/write DCSR methods and symbols */
 };
 
@@ -159,6 +165,11 @@ int arm_dpm_write_dirty_registers(struct arm_dpm *, bool bpwp);
 
 void arm_dpm_report_wfar(struct arm_dpm *, uint32_t wfar);
 
+struct adiv5_ap;
+int arm_dpm_profiling(struct arm_dpm *dpm, struct adiv5_ap *ap,
+		uint32_t *samples, uint32_t max_num_samples,
+		uint32_t *num_samples, uint32_t seconds);
+
 /* DSCR bits; see ARMv7a arch spec section C10.3.1.
  * Not all v7 bits are valid in v6.
  */
@@ -24,8 +24,81 @@
 #include <target/cortex_m.h>
 #include <target/armv7m_trace.h>
 #include <jtag/interface.h>
+#include <server/server.h>
+#include <helper/replacements.h>
 
 #define TRACE_BUF_SIZE	4096
+#define ITM_STREAM_MAX_CLIENTS	8
+
+/* Software stimulus port data decoded in one poll, to be sent to the
+ * clients of an "itm stream" service.  The stream belongs to the trace
+ * configuration and outlives the service, which only gets a pointer to
+ * the stream slot as its private data. */
+struct armv7m_itm_stream {
+	struct connection *clients[ITM_STREAM_MAX_CLIENTS];
+	unsigned int num_clients;
+	uint8_t buf[TRACE_BUF_SIZE];
+	size_t len;
+};
+
+/* The client sockets don't block, so a client that doesn't keep up loses
+ * data instead of stalling the trace capture for everyone. */
+static void armv7m_itm_stream_flush(struct armv7m_itm_stream *stream)
+{
+	for (unsigned int i = 0; i < stream->num_clients; i++) {
+		struct connection *c = stream->clients[i];
+		int written = connection_write(c, stream->buf, stream->len);
+		if (written < (int)stream->len)
+			LOG_DEBUG("itm stream client too slow, dropped %zu bytes",
+					stream->len - (written > 0 ? written : 0));
+	}
+	stream->len = 0;
+}
+
+static void armv7m_itm_packet(void *priv, const struct itm_packet *packet)
+{
+	struct armv7m_trace_config *trace_config = priv;
+
+	if (trace_config->itm_log_file) {
+		/* type, ID, value length, value in as few bytes as possible */
+		uint8_t record[3 + sizeof(packet->value)];
+		unsigned int len = 0;
+
+		for (uint64_t value = packet->value; value; value >>= 8)
+			record[3 + len++] = value & 0xff;
+		record[0] = packet->type;
+		record[1] = packet->id;
+		record[2] = len;
+		fwrite(record, 1, 3 + len, trace_config->itm_log_file);
+	}
+
+	if (packet->type == ITM_PACKET_SWIT &&
+			packet->id < ARRAY_SIZE(trace_config->itm_streams)) {
+		struct armv7m_itm_stream *stream = trace_config->itm_streams[packet->id];
+
+		if (!stream || !stream->num_clients)
+			return;
+		if (stream->len + packet->size > sizeof(stream->buf))
+			armv7m_itm_stream_flush(stream);
+		memcpy(stream->buf + stream->len, packet->data, packet->size);
+		stream->len += packet->size;
+	}
+}
+
+/* Decode the trace in process, so that ITM data can be consumed at the
+ * full SWO rate without parsing it again in Tcl. */
+static void armv7m_itm_decode(struct armv7m_trace_config *trace_config,
+		const uint8_t *buf, size_t size)
+{
+	itm_decoder_feed(&trace_config->itm_decoder, buf, size);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(trace_config->itm_streams); i++) {
+		struct armv7m_itm_stream *stream = trace_config->itm_streams[i];
+
+		if (stream && stream->len)
+			armv7m_itm_stream_flush(stream);
+	}
+}
 
 static int armv7m_poll_trace(void *target)
 {
@@ -49,6 +122,9 @@ static int armv7m_poll_trace(void *target)
 		}
 	}
 
+	if (armv7m->trace_config.itm_streaming || armv7m->trace_config.itm_log_file)
+		armv7m_itm_decode(&armv7m->trace_config, buf, size);
+
 	return ERROR_OK;
 }
 
@@ -115,8 +191,13 @@ int armv7m_trace_tpiu_config(struct target *target)
 	if (retval != ERROR_OK)
 		return retval;
 
-	if (trace_config->config_type == INTERNAL)
+	if (trace_config->config_type == INTERNAL) {
+		/* the synchronous port always uses the formatter */
+		itm_decoder_init(&trace_config->itm_decoder,
+				trace_config->pin_protocol == SYNC || trace_config->formatter,
+				trace_config->trace_bus_id, armv7m_itm_packet, trace_config);
 		target_register_timer_callback(armv7m_poll_trace, 1, 1, target);
+	}
 
 	target_call_event_callbacks(target, TARGET_EVENT_TRACE_CONFIG);
 
@@ -300,6 +381,111 @@ COMMAND_HANDLER(handle_itm_ports_command)
 		return ERROR_OK;
 }
 
+static int armv7m_itm_stream_new_connection(struct connection *connection)
+{
+	struct armv7m_itm_stream **slot = connection->service->priv;
+	struct armv7m_itm_stream *stream = *slot;
+
+	/* the service limits the connections to ITM_STREAM_MAX_CLIENTS */
+	if (connection->service->type == CONNECTION_TCP)
+		socket_nonblock(connection->fd);
+	stream->clients[stream->num_clients++] = connection;
+	connection->priv = stream;
+	return ERROR_OK;
+}
+
+static int armv7m_itm_stream_input(struct connection *connection)
+{
+	uint8_t buf[64];
+
+	/* the stream is output only, just notice when the client goes away */
+	if (connection_read(connection, buf, sizeof(buf)) <= 0)
+		return ERROR_SERVER_REMOTE_CLOSED;
+
+	return ERROR_OK;
+}
+
+static int armv7m_itm_stream_connection_closed(struct connection *connection)
+{
+	struct armv7m_itm_stream *stream = connection->priv;
+
+	for (unsigned int i = 0; i < stream->num_clients; i++) {
+		if (stream->clients[i] == connection) {
+			stream->clients[i] = stream->clients[--stream->num_clients];
+			break;
+		}
+	}
+	connection->priv = NULL;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_itm_stream_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_itm_stream *stream;
+	uint8_t port;
+	int retval;
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_NUMBER(u8, CMD_ARGV[0], port);
+	if (armv7m->trace_config.itm_streams[port]) {
+		LOG_ERROR("ITM stimulus port %u is already streamed", port);
+		return ERROR_FAIL;
+	}
+
+	/* the server frees its private data along with the service, so it
+	 * gets a pointer to the slot rather than the stream itself */
+	stream = calloc(1, sizeof(*stream));
+	struct armv7m_itm_stream **slot = malloc(sizeof(*slot));
+	if (!stream || !slot) {
+		LOG_ERROR("Out of memory");
+		free(stream);
+		free(slot);
+		return ERROR_FAIL;
+	}
+	*slot = stream;
+
+	retval = add_service("itm", CMD_ARGV[1], ITM_STREAM_MAX_CLIENTS,
+			armv7m_itm_stream_new_connection, armv7m_itm_stream_input,
+			armv7m_itm_stream_connection_closed, slot);
+	if (retval != ERROR_OK) {
+		free(stream);
+		free(slot);
+		return retval;
+	}
+
+	armv7m->trace_config.itm_streams[port] = stream;
+	armv7m->trace_config.itm_streaming = true;
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_itm_log_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (armv7m->trace_config.itm_log_file)
+		fclose(armv7m->trace_config.itm_log_file);
+	armv7m->trace_config.itm_log_file = NULL;
+
+	if (strcmp(CMD_ARGV[0], "off") != 0) {
+		armv7m->trace_config.itm_log_file = fopen(CMD_ARGV[0], "wb");
+		if (!armv7m->trace_config.itm_log_file) {
+			LOG_ERROR("Can't open ITM log file");
+			return ERROR_FAIL;
+		}
+	}
+
+	return ERROR_OK;
+}
+
 static const struct command_registration tpiu_command_handlers[] = {
 	{
 		.name = "config",
@@ -329,6 +515,20 @@ static const struct command_registration itm_command_handlers[] = {
 		.help = "Enable or disable all ITM stimulus ports",
 		.usage = "(0|1|on|off)",
 	},
+	{
+		.name = "stream",
+		.handler = handle_itm_stream_command,
+		.mode = COMMAND_ANY,
+		.help = "Stream the data of an ITM stimulus port to TCP clients",
+		.usage = "<port> <tcp port>",
+	},
+	{
+		.name = "log",
+		.handler = handle_itm_log_command,
+		.mode = COMMAND_ANY,
+		.help = "Log decoded ITM and DWT packets to a binary file",
+		.usage = "(<filename> | off)",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
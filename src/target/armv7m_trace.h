@@ -19,6 +19,7 @@
 #define OPENOCD_TARGET_ARMV7M_TRACE_H
 
 #include <target/target.h>
+#include <target/armv7m_trace_decode.h>
 #include <command.h>
 
 /**
@@ -75,6 +76,15 @@ struct armv7m_trace_config {
 	unsigned int trace_freq;
 	/** Handle to output trace data in INTERNAL capture mode */
 	FILE *trace_file;
+
+	/** Decoder for the captured trace, used by ITM streams and the ITM log */
+	struct itm_decoder itm_decoder;
+	/** TCP services streaming single stimulus ports, indexed by port */
+	struct armv7m_itm_stream *itm_streams[256];
+	/** Whether any stimulus port is streamed */
+	bool itm_streaming;
+	/** Handle to output decoded ITM packets in INTERNAL capture mode */
+	FILE *itm_log_file;
 };
 
 extern const struct command_registration armv7m_trace_command_handlers[];
@@ -0,0 +1,234 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "armv7m_trace_decode.h"
+
+/* TPIU full synchronisation packet, as read little endian */
+#define TPIU_SYNC_WORD		0x7fffffff
+
+/* ITM protocol packet headers, see the ARMv7-M ARM, appendix D4 */
+#define ITM_OVERFLOW		0x70
+#define ITM_GTS1		0x94
+#define ITM_GTS2		0xb4
+
+void itm_decoder_init(struct itm_decoder *decoder, bool formatter,
+		unsigned int stream_id, itm_packet_handler_t handler, void *priv)
+{
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->formatter = formatter;
+	decoder->stream_id = stream_id;
+	decoder->handler = handler;
+	decoder->priv = priv;
+}
+
+static void itm_emit(struct itm_decoder *decoder, enum itm_packet_type type,
+		unsigned int id, uint64_t value)
+{
+	struct itm_packet packet = {
+		.type = type,
+		.id = id,
+		.size = decoder->payload_len,
+		.value = value,
+		.data = decoder->payload,
+	};
+
+	decoder->handler(decoder->priv, &packet);
+}
+
+/* Value of the 7 bit groups of a timestamp or extension payload. */
+static uint64_t itm_continuation_value(struct itm_decoder *decoder)
+{
+	uint64_t value = 0;
+
+	for (unsigned int i = 0; i < decoder->payload_len; i++)
+		value |= (uint64_t)(decoder->payload[i] & 0x7f) << (7 * i);
+
+	return value;
+}
+
+/* Decode a source packet: a software stimulus write or a DWT packet. */
+static void itm_source_packet(struct itm_decoder *decoder)
+{
+	uint8_t header = decoder->header;
+	unsigned int address = header >> 3;
+	uint32_t value = 0;
+
+	for (unsigned int i = 0; i < decoder->payload_len; i++)
+		value |= (uint32_t)decoder->payload[i] << (8 * i);
+
+	if (!(header & 0x04)) {
+		itm_emit(decoder, ITM_PACKET_SWIT, decoder->page * 32 + address, value);
+		return;
+	}
+
+	/* DWT packet, the address is the discriminator */
+	if (address == 0)
+		itm_emit(decoder, ITM_PACKET_EVENT_COUNTER, 0, value);
+	else if (address == 1)
+		itm_emit(decoder, ITM_PACKET_EXCEPTION, (value >> 12) & 0x3, value & 0x1ff);
+	else if (address == 2)
+		itm_emit(decoder, ITM_PACKET_PC_SAMPLE, 0, value);
+	else if (address >= 8 && address < 16)
+		itm_emit(decoder, (address & 1) ? ITM_PACKET_DATA_ADDRESS : ITM_PACKET_DATA_PC,
+				(address >> 1) & 0x3, value);
+	else if (address >= 16 && address < 24)
+		itm_emit(decoder, (address & 1) ? ITM_PACKET_DATA_WRITE : ITM_PACKET_DATA_READ,
+				(address >> 1) & 0x3, value);
+	/* other discriminators are reserved, skip them */
+}
+
+/* Decode a protocol packet with a complete payload. */
+static void itm_protocol_packet(struct itm_decoder *decoder)
+{
+	uint8_t header = decoder->header;
+	uint64_t value = itm_continuation_value(decoder);
+
+	if (header == ITM_GTS1) {
+		/* bits 25:0, the last byte also carries clock change and wrap flags.
+		 * High order bytes that didn't change may be left out, so only
+		 * replace the bits that were sent. */
+		uint64_t mask = 0x3ffffff;
+		if (decoder->payload_len < 4)
+			mask = (1ull << (7 * decoder->payload_len)) - 1;
+		decoder->global_timestamp = (decoder->global_timestamp & ~mask) | (value & mask);
+		itm_emit(decoder, ITM_PACKET_GLOBAL_TIMESTAMP, 0, decoder->global_timestamp);
+	} else if (header == ITM_GTS2) {
+		decoder->global_timestamp = (decoder->global_timestamp & 0x3ffffff) | (value << 26);
+		itm_emit(decoder, ITM_PACKET_GLOBAL_TIMESTAMP, 0, decoder->global_timestamp);
+	} else if ((header & 0x0f) == 0) {
+		/* local timestamp, format 1 */
+		itm_emit(decoder, ITM_PACKET_LOCAL_TIMESTAMP, (header >> 4) & 0x3, value);
+	} else if ((header & 0x0b) == 0x08) {
+		/* extension; the only one defined selects the stimulus port page */
+		if (!(header & 0x04))
+			decoder->page = ((header >> 4) & 0x7) | (value << 3);
+	}
+}
+
+static void itm_decode_byte(struct itm_decoder *decoder, uint8_t byte)
+{
+	if (decoder->payload_size) {
+		decoder->payload[decoder->payload_len++] = byte;
+
+		if (decoder->continuation) {
+			if ((byte & 0x80) && decoder->payload_len < decoder->payload_size)
+				return;
+			decoder->payload_size = 0;
+			itm_protocol_packet(decoder);
+		} else if (decoder->payload_len == decoder->payload_size) {
+			decoder->payload_size = 0;
+			itm_source_packet(decoder);
+		}
+		return;
+	}
+
+	/* synchronisation: at least 47 zero bits followed by a one */
+	if (byte == 0x00) {
+		decoder->zeros++;
+		return;
+	}
+	if (decoder->zeros) {
+		decoder->zeros = 0;
+		if (byte == 0x80)
+			return;
+	}
+
+	decoder->header = byte;
+	decoder->payload_len = 0;
+	decoder->continuation = false;
+
+	if (byte & 0x03) {
+		/* source packet with 1, 2 or 4 payload bytes */
+		decoder->payload_size = (byte & 0x03) == 3 ? 4 : (byte & 0x03);
+	} else if (byte == ITM_OVERFLOW) {
+		itm_emit(decoder, ITM_PACKET_OVERFLOW, 0, 0);
+	} else if (byte == ITM_GTS1 || (byte & 0xcf) == 0xc0) {
+		/* global timestamp bits 25:0, or local timestamp, format 1 */
+		decoder->payload_size = 4;
+		decoder->continuation = true;
+	} else if (byte == ITM_GTS2) {
+		/* global timestamp bits 47:26 or 63:26 */
+		decoder->payload_size = 6;
+		decoder->continuation = true;
+	} else if ((byte & 0x8f) == 0x00) {
+		/* local timestamp, format 2: the delta is in the header */
+		itm_emit(decoder, ITM_PACKET_LOCAL_TIMESTAMP, 0, (byte >> 4) & 0x7);
+	} else if ((byte & 0x0b) == 0x08) {
+		/* extension, possibly with continuation bytes */
+		if (byte & 0x80) {
+			decoder->payload_size = sizeof(decoder->payload);
+			decoder->continuation = true;
+		} else
+			itm_protocol_packet(decoder);
+	}
+	/* anything else is reserved, skip it */
+}
+
+/* Decode one TPIU frame: 15 bytes of data and IDs, and one byte of flags. */
+static void tpiu_decode_frame(struct itm_decoder *decoder)
+{
+	const uint8_t *frame = decoder->frame;
+	uint8_t aux = frame[15];
+
+	for (unsigned int i = 0; i < 8; i++) {
+		uint8_t a = frame[2 * i];
+		bool aux_bit = aux & (1 << i);
+
+		if (a & 1) {
+			/* ID change; with the aux bit set, it only applies after
+			 * the next byte */
+			if (aux_bit && i < 7 && decoder->frame_id == decoder->stream_id)
+				itm_decode_byte(decoder, frame[2 * i + 1]);
+			decoder->frame_id = a >> 1;
+			if (!aux_bit && i < 7 && decoder->frame_id == decoder->stream_id)
+				itm_decode_byte(decoder, frame[2 * i + 1]);
+		} else if (decoder->frame_id == decoder->stream_id) {
+			itm_decode_byte(decoder, a | aux_bit);
+			if (i < 7)
+				itm_decode_byte(decoder, frame[2 * i + 1]);
+		}
+	}
+}
+
+void itm_decoder_feed(struct itm_decoder *decoder, const uint8_t *data,
+		size_t size)
+{
+	if (!decoder->formatter) {
+		for (size_t i = 0; i < size; i++)
+			itm_decode_byte(decoder, data[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < size; i++) {
+		decoder->sync_word = (decoder->sync_word >> 8) | ((uint32_t)data[i] << 24);
+		if (decoder->sync_word == TPIU_SYNC_WORD) {
+			/* frames start right after a synchronisation packet */
+			decoder->frame_len = 0;
+			continue;
+		}
+
+		decoder->frame[decoder->frame_len++] = data[i];
+		if (decoder->frame_len == sizeof(decoder->frame)) {
+			decoder->frame_len = 0;
+			tpiu_decode_frame(decoder);
+		}
+	}
+}
@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_ARMV7M_TRACE_DECODE_H
+#define OPENOCD_TARGET_ARMV7M_TRACE_DECODE_H
+
+#include <helper/types.h>
+
+/**
+ * @file
+ * Incremental decoder for the ITM/DWT trace stream, optionally wrapped in
+ * TPIU formatter frames. Trace data can be fed in arbitrary pieces as it
+ * arrives from the adapter; decoded packets are passed to a handler.
+ */
+
+enum itm_packet_type {
+	ITM_PACKET_OVERFLOW,		/**< trace data was lost */
+	ITM_PACKET_SWIT,		/**< software stimulus write, id = port */
+	ITM_PACKET_LOCAL_TIMESTAMP,	/**< timestamp delta, id = TC field */
+	ITM_PACKET_GLOBAL_TIMESTAMP,	/**< absolute timestamp */
+	ITM_PACKET_EVENT_COUNTER,	/**< DWT counter wrap flags */
+	ITM_PACKET_EXCEPTION,		/**< exception number, id = function */
+	ITM_PACKET_PC_SAMPLE,		/**< periodic PC sample, size 1 if asleep */
+	ITM_PACKET_DATA_PC,		/**< data trace PC value, id = comparator */
+	ITM_PACKET_DATA_ADDRESS,	/**< data trace address offset */
+	ITM_PACKET_DATA_READ,		/**< data trace value read */
+	ITM_PACKET_DATA_WRITE,		/**< data trace value written */
+};
+
+struct itm_packet {
+	enum itm_packet_type type;
+	unsigned int id;
+	/** Size of the payload in bytes */
+	unsigned int size;
+	uint64_t value;
+	/** Payload bytes as sent by the target, for software stimulus */
+	const uint8_t *data;
+};
+
+typedef void (*itm_packet_handler_t)(void *priv, const struct itm_packet *packet);
+
+struct itm_decoder {
+	/** Whether the stream is wrapped in TPIU formatter frames */
+	bool formatter;
+	/** TPIU source ID of the ITM, when the formatter is used */
+	unsigned int stream_id;
+
+	/* TPIU deformatter state */
+	uint8_t frame[16];
+	unsigned int frame_len;
+	uint32_t sync_word;
+	unsigned int frame_id;
+
+	/* ITM packet decoder state */
+	uint8_t header;
+	uint8_t payload[8];
+	unsigned int payload_len;
+	unsigned int payload_size;	/**< 0 while waiting for a header */
+	bool continuation;		/**< payload ends at a byte without bit 7 */
+	unsigned int zeros;
+	unsigned int page;
+	uint64_t global_timestamp;
+
+	itm_packet_handler_t handler;
+	void *priv;
+};
+
+void itm_decoder_init(struct itm_decoder *decoder, bool formatter,
+		unsigned int stream_id, itm_packet_handler_t handler, void *priv);
+void itm_decoder_feed(struct itm_decoder *decoder, const uint8_t *data,
+		size_t size);
+
+#endif /* OPENOCD_TARGET_ARMV7M_TRACE_DECODE_H */
@@ -222,6 +222,9 @@ target_to_armv8(struct target *target)
 
 #define CPUV8_DBG_OSLAR		0x300
 
+#define CPUV8_DBG_EDPCSR	0x0A0
+#define CPUV8_DBG_EDDEVID	0xFC8
+
 #define CPUV8_DBG_AUTHSTATUS	0xFB8
 
 #define PAGE_SIZE_4KB				0x1000
@@ -3064,6 +3064,25 @@ static int cortex_a_examine_first(struct target *target)
 			return retval;
 	}
 
+	/* Locate the PC sample register used for non-intrusive profiling.
+	 * v7 debug implements it at 0x084 (sample includes a pipeline offset),
+	 * v7.1 debug at 0x0a0 as advertised by DBGDEVID.PCsample. */
+	armv7a->dpm.pcsr = 0;
+	if (didr & CPUDBG_DIDR_PCSR_IMP) {
+		armv7a->dpm.pcsr = armv7a->debug_base + CPUDBG_PCSR;
+		armv7a->dpm.pcsr_offset = true;
+	} else if (didr & CPUDBG_DIDR_DEVID_IMP) {
+		uint32_t devid;
+		retval = mem_ap_read_atomic_u32(armv7a->debug_ap,
+				armv7a->debug_base + CPUDBG_DEVID, &devid);
+		if (retval != ERROR_OK)
+			return retval;
+		if (devid & 0xf) {
+			armv7a->dpm.pcsr = armv7a->debug_base + CPUDBG_PCSR_V71;
+			armv7a->dpm.pcsr_offset = false;
+		}
+	}
+
 	/* Setup Breakpoint Register Pairs */
 	cortex_a->brp_num = ((didr >> 24) & 0x0F) + 1;
 	cortex_a->brp_num_context = ((didr >> 20) & 0x0F) + 1;
@@ -3105,6 +3124,15 @@ static int cortex_a_examine(struct target *target)
 	return retval;
 }
 
+static int cortex_a_profiling(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct armv7a_common *armv7a = target_to_armv7a(target);
+
+	return arm_dpm_profiling(&armv7a->dpm, armv7a->debug_ap, samples,
+			max_num_samples, num_samples, seconds);
+}
+
 /*
  *	Cortex-A target creation and initialization
  */
@@ -3464,6 +3492,8 @@ struct target_type cortexa_target = {
 	.add_watchpoint = NULL,
 	.remove_watchpoint = NULL,
 
+	.profiling = cortex_a_profiling,
+
 	.commands = cortex_a_command_handlers,
 	.target_create = cortex_a_target_create,
 	.init_target = cortex_a_init_target,
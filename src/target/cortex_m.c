@@ -1678,6 +1678,22 @@ static int cortex_m_read_memory(struct target *target, target_addr_t address,
 	return mem_ap_read_buf(armv7m->debug_ap, buffer, size, count, address);
 }
 
+static int cortex_m_memory_batch(struct target *target,
+	const struct target_memory_request *requests, unsigned int count)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (armv7m->arm.is_armv6m) {
+		/* armv6m does not handle unaligned memory access */
+		for (unsigned int i = 0; i < count; i++) {
+			if (requests[i].address % requests[i].size)
+				return ERROR_TARGET_UNALIGNED_ACCESS;
+		}
+	}
+
+	return mem_ap_buf_batch(armv7m->debug_ap, requests, count);
+}
+
 static int cortex_m_write_memory(struct target *target, target_addr_t address,
 	uint32_t size, uint32_t count, const uint8_t *buffer)
 {
@@ -2142,6 +2158,43 @@ static int cortex_m_handle_target_request(void *priv)
 	return ERROR_OK;
 }
 
+/*
+ * Non-intrusive profiling: let the core run and sample the PC through
+ * DWT_PCSR as fast as the adapter allows.  Cores without PCSR (e.g.
+ * ARMv6-M) fall back to the halt/resume sampler.
+ */
+static int cortex_m_profiling(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	uint32_t reg_value;
+	int retval;
+
+	retval = target_read_u32(target, DWT_PCSR, &reg_value);
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error while reading PCSR");
+		return retval;
+	}
+	if (reg_value == 0) {
+		LOG_INFO("PCSR sampling not supported on this processor.");
+		return target_profiling_default(target, samples, max_num_samples,
+				num_samples, seconds);
+	}
+
+	/* Make sure the target is running */
+	target_poll(target);
+	if (target->state == TARGET_HALTED) {
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error while resuming target");
+			return retval;
+		}
+	}
+
+	return mem_ap_profiling_pcsr(target, armv7m->debug_ap, DWT_PCSR, NULL,
+			samples, max_num_samples, num_samples, seconds);
+}
+
 static int cortex_m_init_arch_info(struct target *target,
 	struct cortex_m_common *cortex_m, struct jtag_tap *tap)
 {
@@ -2438,6 +2491,7 @@ struct target_type cortexm_target = {
 	.get_gdb_reg_list = armv7m_get_gdb_reg_list,
 
 	.read_memory = cortex_m_read_memory,
+	.memory_batch = cortex_m_memory_batch,
 	.write_memory = cortex_m_write_memory,
 	.checksum_memory = armv7m_checksum_memory,
 	.blank_check_memory = armv7m_blank_check_memory,
@@ -2451,6 +2505,8 @@ struct target_type cortexm_target = {
 	.add_watchpoint = cortex_m_add_watchpoint,
 	.remove_watchpoint = cortex_m_remove_watchpoint,
 
+	.profiling = cortex_m_profiling,
+
 	.commands = cortex_m_command_handlers,
 	.target_create = cortex_m_target_create,
 	.target_jim_configure = adiv5_jim_configure,
@@ -115,222 +115,285 @@ static int identify_image_type(struct image *image, const char *type_string, con
 	return ERROR_OK;
 }
 
-static int image_ihex_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
+/* Value of each hex digit character, 0x10 for anything else. */
+static uint8_t hex_digit_value[256];
+
+static void image_hex_init(void)
 {
-	struct image_ihex *ihex = image->type_private;
-	struct fileio *fileio = ihex->fileio;
-	uint32_t full_address = 0x0;
-	uint32_t cooked_bytes;
+	static bool first_init;
 	int i;
 
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
+	if (first_init)
+		return;
+
+	for (i = 0; i < 256; i++)
+		hex_digit_value[i] = 0x10;
+	for (i = 0; i < 10; i++)
+		hex_digit_value['0' + i] = i;
+	for (i = 0; i < 6; i++) {
+		hex_digit_value['a' + i] = 10 + i;
+		hex_digit_value['A' + i] = 10 + i;
+	}
+
+	first_init = true;
+}
 
+/**
+ * Decode @a count bytes from pairs of hex digits at @a text into @a data,
+ * adding them up into @a sum for the record checksum. Returns false on
+ * anything that is not a hex digit.
+ */
+static bool image_hex_decode(const char *text, uint8_t *data, unsigned count,
+		uint8_t *sum)
+{
+	const uint8_t *p = (const uint8_t *)text;
+	uint8_t invalid = 0;
+	uint8_t s = *sum;
+
+	while (count-- > 0) {
+		uint8_t hi = hex_digit_value[p[0]];
+		uint8_t lo = hex_digit_value[p[1]];
+
+		invalid |= hi | lo;
+		*data = (hi << 4) | lo;
+		s += *data++;
+		p += 2;
+	}
+
+	*sum = s;
+	return !(invalid & 0x10);
+}
+
+/* State shared by the IHEX and S19 parsers while they decode a file. */
+struct image_hex_parser {
+	const char *text;		/* file contents */
+	const char *end;
+	char *text_owned;		/* text copy to free, if the file is not mapped */
+	uint8_t *buffer;		/* decoded data, at most half the file size */
+	uint32_t cooked_bytes;
+	struct imagesection *sections;
+	int num_sections;
+	int max_sections;
+	target_addr_t next_address;	/* address following the last section */
+};
+
+/**
+ * Get the whole file into memory for parsing, from its mapping if possible,
+ * and allocate the data buffer. Parsing in one go avoids the line-by-line
+ * stdio calls, which used to dominate loading large hex files.
+ */
+static int image_hex_parser_init(struct image_hex_parser *parser,
+		struct fileio *fileio, uint8_t **buffer)
+{
 	size_t filesize;
+	uint8_t *map;
 	int retval;
+
+	image_hex_init();
+	memset(parser, 0, sizeof(*parser));
+	*buffer = NULL;
+
 	retval = fileio_size(fileio, &filesize);
 	if (retval != ERROR_OK)
 		return retval;
 
-	ihex->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
-	section[image->num_sections].private = &ihex->buffer[cooked_bytes];
-	section[image->num_sections].base_address = 0x0;
-	section[image->num_sections].size = 0x0;
-	section[image->num_sections].flags = 0;
+	if (fileio_map(fileio, &map) == ERROR_OK) {
+		parser->text = (const char *)map;
+	} else {
+		parser->text_owned = malloc(filesize + 1);
+		if (parser->text_owned == NULL) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		retval = fileio_read(fileio, filesize, parser->text_owned, &filesize);
+		if (retval != ERROR_OK)
+			return retval;
+		parser->text = parser->text_owned;
+	}
+	parser->end = parser->text + filesize;
+
+	*buffer = parser->buffer = malloc((filesize >> 1) + 1);
+	if (parser->buffer == NULL) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
+static void image_hex_parser_cleanup(struct image_hex_parser *parser)
+{
+	free(parser->text_owned);
+	free(parser->sections);
+}
+
+/**
+ * Account for @a count bytes just decoded to the end of the data buffer,
+ * which belong at @a address. They extend the last section if they follow
+ * it directly, or else start a new one.
+ */
+static int image_hex_add_data(struct image_hex_parser *parser,
+		target_addr_t address, uint32_t count)
+{
+	struct imagesection *section;
+
+	if (count == 0)
+		return ERROR_OK;
+
+	if (parser->num_sections == 0 || parser->next_address != address) {
+		if (parser->num_sections == parser->max_sections) {
+			int max_sections = parser->max_sections ? 2 * parser->max_sections : 16;
+			section = realloc(parser->sections,
+					max_sections * sizeof(struct imagesection));
+			if (section == NULL) {
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+			parser->sections = section;
+			parser->max_sections = max_sections;
+		}
+
+		section = &parser->sections[parser->num_sections++];
+		section->base_address = address;
+		section->size = 0;
+		section->flags = 0;
+		section->private = &parser->buffer[parser->cooked_bytes];
+	} else
+		section = &parser->sections[parser->num_sections - 1];
 
-	while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
+	section->size += count;
+	parser->cooked_bytes += count;
+	parser->next_address = address + count;
+
+	return ERROR_OK;
+}
+
+/* Hand the sections over to the image once the end record was found. */
+static int image_hex_parser_finish(struct image *image,
+		struct image_hex_parser *parser)
+{
+	/* an image without any data still has one (empty) section */
+	if (parser->num_sections == 0) {
+		parser->sections = calloc(1, sizeof(struct imagesection));
+		if (parser->sections == NULL) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		parser->sections[0].private = parser->buffer;
+		parser->num_sections = 1;
+	}
+
+	image->num_sections = parser->num_sections;
+	image->sections = parser->sections;
+	parser->sections = NULL;
+
+	return ERROR_OK;
+}
+
+/* Skip to the start of the next line. */
+static const char *image_hex_next_line(const char *p, const char *end)
+{
+	const char *eol = memchr(p, '\n', end - p);
+
+	return eol ? eol + 1 : end;
+}
+
+static int image_ihex_buffer_complete_inner(struct image *image,
+		struct image_hex_parser *parser)
+{
+	const char *p = parser->text;
+	const char *end = parser->end;
+	uint32_t full_address = 0x0;
+
+	while (p < end) {
+		uint8_t record[4];
+		uint8_t cal_checksum = 0;
+		uint8_t checksum;
+		uint8_t data[255];
 		uint32_t count;
-		uint32_t address;
 		uint32_t record_type;
-		uint32_t checksum;
-		uint8_t cal_checksum = 0;
-		size_t bytes_read = 0;
 
-		if (lpszLine[0] == '#')
+		if (*p == '\r' || *p == '\n' || *p == ' ' || *p == '\t') {
+			p++;
+			continue;
+		}
+
+		if (*p == '#') {
+			p = image_hex_next_line(p, end);
 			continue;
+		}
 
-		if (sscanf(&lpszLine[bytes_read], ":%2" SCNx32 "%4" SCNx32 "%2" SCNx32, &count,
-			&address, &record_type) != 3)
+		/* ':', count, address, record type, data, checksum */
+		if (*p != ':' || end - p < 11 ||
+				!image_hex_decode(p + 1, record, 4, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+		count = record[0];
+		record_type = record[3];
+		if ((uint32_t)(end - p) < 11 + 2 * count)
 			return ERROR_IMAGE_FORMAT_ERROR;
-		bytes_read += 9;
 
-		cal_checksum += (uint8_t)count;
-		cal_checksum += (uint8_t)(address >> 8);
-		cal_checksum += (uint8_t)address;
-		cal_checksum += (uint8_t)record_type;
+		/* data bytes go straight into the image buffer */
+		uint8_t *dest = (record_type == 0) ?
+				&parser->buffer[parser->cooked_bytes] : data;
+		if (!image_hex_decode(p + 9, dest, count, &cal_checksum) ||
+				!image_hex_decode(p + 9 + 2 * count, &checksum, 1, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		if (cal_checksum != 0) {
+			/* checksum failed */
+			LOG_ERROR("incorrect record checksum found in IHEX file");
+			return ERROR_IMAGE_CHECKSUM;
+		}
 
 		if (record_type == 0) {	/* Data Record */
-			if ((full_address & 0xffff) != address) {
-				/* we encountered a nonconsecutive location, create a new section,
-				 * unless the current section has zero size, in which case this specifies
-				 * the current section's base address
-				 */
-				if (section[image->num_sections].size != 0) {
-					image->num_sections++;
-					if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-						/* too many sections */
-						LOG_ERROR("Too many sections found in IHEX file");
-						return ERROR_IMAGE_FORMAT_ERROR;
-					}
-					section[image->num_sections].size = 0x0;
-					section[image->num_sections].flags = 0;
-					section[image->num_sections].private =
-						&ihex->buffer[cooked_bytes];
-				}
-				section[image->num_sections].base_address =
-					(full_address & 0xffff0000) | address;
-				full_address = (full_address & 0xffff0000) | address;
-			}
+			full_address = (full_address & 0xffff0000) | be_to_h_u16(&record[1]);
 
-			while (count-- > 0) {
-				unsigned value;
-				sscanf(&lpszLine[bytes_read], "%2x", &value);
-				ihex->buffer[cooked_bytes] = (uint8_t)value;
-				cal_checksum += (uint8_t)ihex->buffer[cooked_bytes];
-				bytes_read += 2;
-				cooked_bytes += 1;
-				section[image->num_sections].size += 1;
-				full_address++;
-			}
+			int retval = image_hex_add_data(parser, full_address, count);
+			if (retval != ERROR_OK)
+				return retval;
+			full_address += count;
 		} else if (record_type == 1) {	/* End of File Record */
-			/* finish the current section */
-			image->num_sections++;
-
-			/* copy section information */
-			image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-			for (i = 0; i < image->num_sections; i++) {
-				image->sections[i].private = section[i].private;
-				image->sections[i].base_address = section[i].base_address;
-				image->sections[i].size = section[i].size;
-				image->sections[i].flags = section[i].flags;
-			}
-
-			return ERROR_OK;
+			return image_hex_parser_finish(image, parser);
 		} else if (record_type == 2) {	/* Linear Address Record */
-			uint16_t upper_address;
-
-			sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-			cal_checksum += (uint8_t)(upper_address >> 8);
-			cal_checksum += (uint8_t)upper_address;
-			bytes_read += 4;
-
-			if ((full_address >> 4) != upper_address) {
-				/* we encountered a nonconsecutive location, create a new section,
-				 * unless the current section has zero size, in which case this specifies
-				 * the current section's base address
-				 */
-				if (section[image->num_sections].size != 0) {
-					image->num_sections++;
-					if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-						/* too many sections */
-						LOG_ERROR("Too many sections found in IHEX file");
-						return ERROR_IMAGE_FORMAT_ERROR;
-					}
-					section[image->num_sections].size = 0x0;
-					section[image->num_sections].flags = 0;
-					section[image->num_sections].private =
-						&ihex->buffer[cooked_bytes];
-				}
-				section[image->num_sections].base_address =
-					(full_address & 0xffff) | (upper_address << 4);
-				full_address = (full_address & 0xffff) | (upper_address << 4);
-			}
+			if (count != 2)
+				return ERROR_IMAGE_FORMAT_ERROR;
+			if ((full_address >> 4) != be_to_h_u16(data))
+				full_address = (full_address & 0xffff) | (be_to_h_u16(data) << 4);
+		} else if (record_type == 4) {	/* Extended Linear Address Record */
+			if (count != 2)
+				return ERROR_IMAGE_FORMAT_ERROR;
+			full_address = (full_address & 0xffff) | (be_to_h_u16(data) << 16);
 		} else if (record_type == 3) {	/* Start Segment Address Record */
-			uint32_t dummy;
-
 			/* "Start Segment Address Record" will not be supported
 			 * but we must consume it, and do not create an error.  */
-			while (count-- > 0) {
-				sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-				cal_checksum += (uint8_t)dummy;
-				bytes_read += 2;
-			}
-		} else if (record_type == 4) {	/* Extended Linear Address Record */
-			uint16_t upper_address;
-
-			sscanf(&lpszLine[bytes_read], "%4hx", &upper_address);
-			cal_checksum += (uint8_t)(upper_address >> 8);
-			cal_checksum += (uint8_t)upper_address;
-			bytes_read += 4;
-
-			if ((full_address >> 16) != upper_address) {
-				/* we encountered a nonconsecutive location, create a new section,
-				 * unless the current section has zero size, in which case this specifies
-				 * the current section's base address
-				 */
-				if (section[image->num_sections].size != 0) {
-					image->num_sections++;
-					if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-						/* too many sections */
-						LOG_ERROR("Too many sections found in IHEX file");
-						return ERROR_IMAGE_FORMAT_ERROR;
-					}
-					section[image->num_sections].size = 0x0;
-					section[image->num_sections].flags = 0;
-					section[image->num_sections].private =
-						&ihex->buffer[cooked_bytes];
-				}
-				section[image->num_sections].base_address =
-					(full_address & 0xffff) | (upper_address << 16);
-				full_address = (full_address & 0xffff) | (upper_address << 16);
-			}
 		} else if (record_type == 5) {	/* Start Linear Address Record */
-			uint32_t start_address;
-
-			sscanf(&lpszLine[bytes_read], "%8" SCNx32, &start_address);
-			cal_checksum += (uint8_t)(start_address >> 24);
-			cal_checksum += (uint8_t)(start_address >> 16);
-			cal_checksum += (uint8_t)(start_address >> 8);
-			cal_checksum += (uint8_t)start_address;
-			bytes_read += 8;
-
+			if (count != 4)
+				return ERROR_IMAGE_FORMAT_ERROR;
 			image->start_address_set = 1;
-			image->start_address = be_to_h_u32((uint8_t *)&start_address);
+			image->start_address = be_to_h_u32(data);
 		} else {
 			LOG_ERROR("unhandled IHEX record type: %i", (int)record_type);
 			return ERROR_IMAGE_FORMAT_ERROR;
 		}
 
-		sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
-
-		if ((uint8_t)checksum != (uint8_t)(~cal_checksum + 1)) {
-			/* checksum failed */
-			LOG_ERROR("incorrect record checksum found in IHEX file");
-			return ERROR_IMAGE_CHECKSUM;
-		}
+		p = image_hex_next_line(p + 11 + 2 * count, end);
 	}
 
 	LOG_ERROR("premature end of IHEX file, no end-of-file record found");
 	return ERROR_IMAGE_FORMAT_ERROR;
 }
 
-/**
- * Allocate memory dynamically instead of on the stack. This
- * is important w/embedded hosts.
- */
 static int image_ihex_buffer_complete(struct image *image)
 {
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
+	struct image_ihex *ihex = image->type_private;
+	struct image_hex_parser parser;
 	int retval;
 
-	retval = image_ihex_buffer_complete_inner(image, lpszLine, section);
+	retval = image_hex_parser_init(&parser, ihex->fileio, &ihex->buffer);
+	if (retval == ERROR_OK)
+		retval = image_ihex_buffer_complete_inner(image, &parser);
 
-	free(section);
-	free(lpszLine);
+	image_hex_parser_cleanup(&parser);
 
 	return retval;
 }
@@ -483,6 +546,12 @@ static int image_elf_read_section(struct image *image,
 		read_size = MIN(size, field32(elf, segment->p_filesz) - offset);
 		LOG_DEBUG("read elf: size = 0x%zu at 0x%" PRIx32 "", read_size,
 			field32(elf, segment->p_offset) + offset);
+		uint8_t *data = image_section_data(image, section, offset, read_size);
+		if (data) {
+			memcpy(buffer, data, read_size);
+			*size_read += read_size;
+			return ERROR_OK;
+		}
 		/* read initialized area of the segment */
 		retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
 		if (retval != ERROR_OK) {
@@ -505,186 +574,105 @@ static int image_elf_read_section(struct image *image,
 }
 
 static int image_mot_buffer_complete_inner(struct image *image,
-	char *lpszLine,
-	struct imagesection *section)
+		struct image_hex_parser *parser)
 {
-	struct image_mot *mot = image->type_private;
-	struct fileio *fileio = mot->fileio;
-	uint32_t full_address = 0x0;
-	uint32_t cooked_bytes;
-	int i;
-
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
-
-	int retval;
-	size_t filesize;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
+	const char *p = parser->text;
+	const char *end = parser->end;
 
-	mot->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
-	section[image->num_sections].private = &mot->buffer[cooked_bytes];
-	section[image->num_sections].base_address = 0x0;
-	section[image->num_sections].size = 0x0;
-	section[image->num_sections].flags = 0;
-
-	while (fileio_fgets(fileio, 1023, lpszLine) == ERROR_OK) {
+	while (p < end) {
+		uint8_t cal_checksum = 0;
+		uint8_t checksum;
+		uint8_t address_bytes[4];
+		uint8_t data[255];
 		uint32_t count;
-		uint32_t address;
 		uint32_t record_type;
-		uint32_t checksum;
-		uint8_t cal_checksum = 0;
-		uint32_t bytes_read = 0;
-
-		/* get record type and record length */
-		if (sscanf(&lpszLine[bytes_read], "S%1" SCNx32 "%2" SCNx32, &record_type,
-			&count) != 2)
-			return ERROR_IMAGE_FORMAT_ERROR;
-
-		bytes_read += 4;
-		cal_checksum += (uint8_t)count;
-
-		/* skip checksum byte */
-		count -= 1;
-
-		if (record_type == 0) {
-			/* S0 - starting record (optional) */
-			int iValue;
-
-			while (count-- > 0) {
-				sscanf(&lpszLine[bytes_read], "%2x", &iValue);
-				cal_checksum += (uint8_t)iValue;
-				bytes_read += 2;
-			}
-		} else if (record_type >= 1 && record_type <= 3) {
-			switch (record_type) {
-				case 1:
-					/* S1 - 16 bit address data record */
-					sscanf(&lpszLine[bytes_read], "%4" SCNx32, &address);
-					cal_checksum += (uint8_t)(address >> 8);
-					cal_checksum += (uint8_t)address;
-					bytes_read += 4;
-					count -= 2;
-					break;
-
-				case 2:
-					/* S2 - 24 bit address data record */
-					sscanf(&lpszLine[bytes_read], "%6" SCNx32, &address);
-					cal_checksum += (uint8_t)(address >> 16);
-					cal_checksum += (uint8_t)(address >> 8);
-					cal_checksum += (uint8_t)address;
-					bytes_read += 6;
-					count -= 3;
-					break;
-
-				case 3:
-					/* S3 - 32 bit address data record */
-					sscanf(&lpszLine[bytes_read], "%8" SCNx32, &address);
-					cal_checksum += (uint8_t)(address >> 24);
-					cal_checksum += (uint8_t)(address >> 16);
-					cal_checksum += (uint8_t)(address >> 8);
-					cal_checksum += (uint8_t)address;
-					bytes_read += 8;
-					count -= 4;
-					break;
-
-			}
+		uint32_t address_size;
 
-			if (full_address != address) {
-				/* we encountered a nonconsecutive location, create a new section,
-				 * unless the current section has zero size, in which case this specifies
-				 * the current section's base address
-				 */
-				if (section[image->num_sections].size != 0) {
-					image->num_sections++;
-					section[image->num_sections].size = 0x0;
-					section[image->num_sections].flags = 0;
-					section[image->num_sections].private =
-						&mot->buffer[cooked_bytes];
-				}
-				section[image->num_sections].base_address = address;
-				full_address = address;
-			}
+		if (*p == '\r' || *p == '\n' || *p == ' ' || *p == '\t') {
+			p++;
+			continue;
+		}
 
-			while (count-- > 0) {
-				unsigned value;
-				sscanf(&lpszLine[bytes_read], "%2x", &value);
-				mot->buffer[cooked_bytes] = (uint8_t)value;
-				cal_checksum += (uint8_t)mot->buffer[cooked_bytes];
-				bytes_read += 2;
-				cooked_bytes += 1;
-				section[image->num_sections].size += 1;
-				full_address++;
-			}
-		} else if (record_type == 5) {
-			/* S5 is the data count record, we ignore it */
-			uint32_t dummy;
-
-			while (count-- > 0) {
-				sscanf(&lpszLine[bytes_read], "%2" SCNx32, &dummy);
-				cal_checksum += (uint8_t)dummy;
-				bytes_read += 2;
-			}
-		} else if (record_type >= 7 && record_type <= 9) {
-			/* S7, S8, S9 - ending records for 32, 24 and 16bit */
-			image->num_sections++;
+		/* 'S', record type, count of the bytes that follow */
+		if (*p != 'S' || end - p < 4 || p[1] < '0' || p[1] > '9' ||
+				!image_hex_decode(p + 2, data, 1, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+		record_type = p[1] - '0';
+		count = data[0];
+		if ((uint32_t)(end - p) < 4 + 2 * count)
+			return ERROR_IMAGE_FORMAT_ERROR;
 
-			/* copy section information */
-			image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-			for (i = 0; i < image->num_sections; i++) {
-				image->sections[i].private = section[i].private;
-				image->sections[i].base_address = section[i].base_address;
-				image->sections[i].size = section[i].size;
-				image->sections[i].flags = section[i].flags;
-			}
+		switch (record_type) {
+			case 1:
+			case 2:
+			case 3:
+				/* S1, S2, S3 - 16, 24 and 32 bit address data records */
+				address_size = record_type + 1;
+				break;
+			case 0:		/* S0 - starting record (optional) */
+			case 5:		/* S5, S6 - data count records, we ignore them */
+			case 6:
+			case 7:		/* S7, S8, S9 - ending records for 32, 24 and 16bit */
+			case 8:
+			case 9:
+				address_size = 0;
+				break;
+			default:
+				LOG_ERROR("unhandled S19 record type: %i", (int)(record_type));
+				return ERROR_IMAGE_FORMAT_ERROR;
+		}
 
-			return ERROR_OK;
-		} else {
-			LOG_ERROR("unhandled S19 record type: %i", (int)(record_type));
+		/* the count includes the address and the checksum byte */
+		if (count < address_size + 1)
+			return ERROR_IMAGE_FORMAT_ERROR;
+		count -= address_size + 1;
+
+		/* data bytes go straight into the image buffer */
+		uint8_t *dest = address_size ? &parser->buffer[parser->cooked_bytes] : data;
+		if (!image_hex_decode(p + 4, address_bytes, address_size, &cal_checksum) ||
+				!image_hex_decode(p + 4 + 2 * address_size, dest, count, &cal_checksum) ||
+				!image_hex_decode(p + 4 + 2 * (address_size + count), &checksum,
+					1, &cal_checksum))
 			return ERROR_IMAGE_FORMAT_ERROR;
-		}
 
 		/* account for checksum, will always be 0xFF */
-		sscanf(&lpszLine[bytes_read], "%2" SCNx32, &checksum);
-		cal_checksum += (uint8_t)checksum;
-
 		if (cal_checksum != 0xFF) {
 			/* checksum failed */
 			LOG_ERROR("incorrect record checksum found in S19 file");
 			return ERROR_IMAGE_CHECKSUM;
 		}
+
+		if (address_size) {
+			uint32_t address = 0;
+			uint32_t i;
+
+			for (i = 0; i < address_size; i++)
+				address = (address << 8) | address_bytes[i];
+
+			int retval = image_hex_add_data(parser, address, count);
+			if (retval != ERROR_OK)
+				return retval;
+		} else if (record_type >= 7)
+			return image_hex_parser_finish(image, parser);
+
+		p = image_hex_next_line(p + 4 + 2 * (address_size + count + 1), end);
 	}
 
 	LOG_ERROR("premature end of S19 file, no end-of-file record found");
 	return ERROR_IMAGE_FORMAT_ERROR;
 }
 
-/**
- * Allocate memory dynamically instead of on the stack. This
- * is important w/embedded hosts.
- */
 static int image_mot_buffer_complete(struct image *image)
 {
-	char *lpszLine = malloc(1023);
-	if (lpszLine == NULL) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (section == NULL) {
-		free(lpszLine);
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
+	struct image_mot *mot = image->type_private;
+	struct image_hex_parser parser;
 	int retval;
 
-	retval = image_mot_buffer_complete_inner(image, lpszLine, section);
+	retval = image_hex_parser_init(&parser, mot->fileio, &mot->buffer);
+	if (retval == ERROR_OK)
+		retval = image_mot_buffer_complete_inner(image, &parser);
 
-	free(section);
-	free(lpszLine);
+	image_hex_parser_cleanup(&parser);
 
 	return retval;
 }
@@ -712,6 +700,10 @@ int image_open(struct image *image, const char *url, const char *type_string)
 			return retval;
 		}
 
+		/* serve the data straight from the file mapping if possible */
+		if (fileio_map(image_binary->fileio, &image_binary->data) != ERROR_OK)
+			image_binary->data = NULL;
+
 		image->num_sections = 1;
 		image->sections = malloc(sizeof(struct imagesection));
 		image->sections[0].base_address = 0x0;
@@ -747,6 +739,11 @@ int image_open(struct image *image, const char *url, const char *type_string)
 			fileio_close(image_elf->fileio);
 			return retval;
 		}
+
+		/* serve segment contents straight from the file mapping if possible */
+		if (fileio_map(image_elf->fileio, &image_elf->data) != ERROR_OK ||
+				fileio_size(image_elf->fileio, &image_elf->data_size) != ERROR_OK)
+			image_elf->data = NULL;
 	} else if (image->type == IMAGE_MEMORY) {
 		struct target *target = get_target(url);
 
@@ -832,6 +829,14 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		if (image_binary->data) {
+			if (offset > image->sections[0].size)
+				return ERROR_IMAGE_FORMAT_ERROR;
+			*size_read = MIN(size, image->sections[0].size - offset);
+			memcpy(buffer, image_binary->data + offset, *size_read);
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -901,6 +906,43 @@ int image_read_section(struct image *image,
 	return ERROR_OK;
 }
 
+/**
+ * Return a pointer to @a size bytes of section data at @a offset, without
+ * copying them, or NULL if the data is not available in memory; then use
+ * image_read_section(). Plain binaries and ELF files are served from the
+ * file mapping, hex and S-record files from their decoded buffer. The data
+ * stays valid until image_close(); callers may scribble on it, but the
+ * modifications are visible to later readers of the image.
+ */
+uint8_t *image_section_data(struct image *image, int section, uint32_t offset,
+		uint32_t size)
+{
+	if (offset + size > image->sections[section].size)
+		return NULL;
+
+	if (image->type == IMAGE_BINARY) {
+		struct image_binary *image_binary = image->type_private;
+
+		if (!image_binary->data)
+			return NULL;
+		return image_binary->data + offset;
+	} else if (image->type == IMAGE_ELF) {
+		struct image_elf *elf = image->type_private;
+		Elf32_Phdr *segment = (Elf32_Phdr *)image->sections[section].private;
+		uint32_t file_offset = field32(elf, segment->p_offset);
+
+		/* the zero-initialized tail of a segment is not in the file */
+		if (!elf->data || offset + size > field32(elf, segment->p_filesz) ||
+				file_offset + offset + size > elf->data_size)
+			return NULL;
+		return elf->data + file_offset + offset;
+	} else if (image->type == IMAGE_IHEX || image->type == IMAGE_SRECORD ||
+			image->type == IMAGE_BUILDER)
+		return (uint8_t *)image->sections[section].private + offset;
+
+	return NULL;
+}
+
 int image_add_section(struct image *image, uint32_t base, uint32_t size, int flags, uint8_t const *data)
 {
 	struct imagesection *section;
@@ -1003,36 +1045,78 @@ void image_close(struct image *image)
 	}
 }
 
-int image_calculate_checksum(uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
-{
-	uint32_t crc = 0xffffffff;
-	LOG_DEBUG("Calculating checksum");
-
-	static uint32_t crc32_table[256];
+/* CRC32 lookup tables for slicing-by-16: crc32_table[k][i] is the CRC of
+ * byte i followed by k zero bytes. */
+static uint32_t crc32_table[16][256];
 
+static void image_crc32_init(void)
+{
 	static bool first_init;
-	if (!first_init) {
-		/* Initialize the CRC table and the decoding table.  */
-		int i, j;
-		unsigned int c;
+	int i, j, k;
+	unsigned int c;
+
+	if (first_init)
+		return;
+
+	/* Initialize the CRC table and the decoding table.  */
+	for (i = 0; i < 256; i++) {
+		/* as per gdb */
+		for (c = i << 24, j = 8; j > 0; --j)
+			c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
+		crc32_table[0][i] = c;
+	}
+
+	for (k = 1; k < 16; k++) {
 		for (i = 0; i < 256; i++) {
-			/* as per gdb */
-			for (c = i << 24, j = 8; j > 0; --j)
-				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
+			c = crc32_table[k - 1][i];
+			crc32_table[k][i] = (c << 8) ^ crc32_table[0][c >> 24];
 		}
-
-		first_init = true;
 	}
 
+	first_init = true;
+}
+
+int image_calculate_checksum(uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
+{
+	uint32_t crc = 0xffffffff;
+	LOG_DEBUG("Calculating checksum");
+
+	image_crc32_init();
+
 	while (nbytes > 0) {
 		int run = nbytes;
 		if (run > 32768)
 			run = 32768;
 		nbytes -= run;
+
+		/* 16 bytes per step, each one looked up in the table that
+		 * accounts for the bytes following it in the block */
+		while (run >= 16) {
+			uint32_t w = crc ^ ((uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 |
+					(uint32_t)buffer[2] << 8 | buffer[3]);
+			crc = crc32_table[15][w >> 24] ^
+				crc32_table[14][(w >> 16) & 255] ^
+				crc32_table[13][(w >> 8) & 255] ^
+				crc32_table[12][w & 255] ^
+				crc32_table[11][buffer[4]] ^
+				crc32_table[10][buffer[5]] ^
+				crc32_table[9][buffer[6]] ^
+				crc32_table[8][buffer[7]] ^
+				crc32_table[7][buffer[8]] ^
+				crc32_table[6][buffer[9]] ^
+				crc32_table[5][buffer[10]] ^
+				crc32_table[4][buffer[11]] ^
+				crc32_table[3][buffer[12]] ^
+				crc32_table[2][buffer[13]] ^
+				crc32_table[1][buffer[14]] ^
+				crc32_table[0][buffer[15]];
+			buffer += 16;
+			run -= 16;
+		}
+
 		while (run--) {
 			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
+			crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *buffer++) & 255];
 		}
 		keep_alive();
 	}
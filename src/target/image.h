@@ -32,7 +32,6 @@
 #endif
 
 #define IMAGE_MAX_ERROR_STRING		(256)
-#define IMAGE_MAX_SECTIONS			(512)
 
 #define IMAGE_MEMORY_CACHE_SIZE		(2048)
 
@@ -65,6 +64,7 @@ struct image {
 
 struct image_binary {
 	struct fileio *fileio;
+	uint8_t *data;		/* file mapping, if available */
 };
 
 struct image_ihex {
@@ -80,6 +80,8 @@ struct image_memory {
 
 struct image_elf {
 	struct fileio *fileio;
+	uint8_t *data;		/* file mapping, if available */
+	size_t data_size;
 	Elf32_Ehdr *header;
 	Elf32_Phdr *segments;
 	uint32_t segment_count;
@@ -94,6 +96,8 @@ struct image_mot {
 int image_open(struct image *image, const char *url, const char *type_string);
 int image_read_section(struct image *image, int section, uint32_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
+uint8_t *image_section_data(struct image *image, int section, uint32_t offset,
+		uint32_t size);
 void image_close(struct image *image);
 
 int image_add_section(struct image *image, uint32_t base, uint32_t size,
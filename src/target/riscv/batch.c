@@ -34,6 +34,7 @@ void riscv_batch_free(struct riscv_batch *batch)
 	free(batch->data_in);
 	free(batch->data_out);
 	free(batch->fields);
+	free(batch->read_keys);
 	free(batch);
 }
 
@@ -71,7 +72,7 @@ void riscv_batch_run(struct riscv_batch *batch)
 		dump_field(batch->fields + i);
 }
 
-void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data)
+size_t riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data)
 {
 	assert(batch->used_scans < batch->allocated_scans);
 	struct scan_field *field = batch->fields + batch->used_scans;
@@ -81,7 +82,7 @@ void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint
 	riscv_fill_dmi_write_u64(batch->target, (char *)field->out_value, address, data);
 	riscv_fill_dmi_nop_u64(batch->target, (char *)field->in_value);
 	batch->last_scan = RISCV_SCAN_TYPE_WRITE;
-	batch->used_scans++;
+	return batch->used_scans++;
 }
 
 size_t riscv_batch_add_dmi_read(struct riscv_batch *batch, unsigned address)
@@ -123,6 +124,13 @@ uint64_t riscv_batch_get_dmi_read(struct riscv_batch *batch, size_t key)
 		((uint64_t) base[7]) << 56;
 }
 
+unsigned riscv_batch_get_dmi_status(struct riscv_batch *batch, size_t scan)
+{
+	assert(scan < batch->used_scans);
+	struct scan_field *field = batch->fields + scan;
+	return buf_get_u32(field->in_value, DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
+}
+
 void riscv_batch_add_nop(struct riscv_batch *batch)
 {
 	assert(batch->used_scans < batch->allocated_scans);
@@ -142,7 +150,7 @@ void dump_field(const struct scan_field *field)
 	static const char *op_string[] = {"-", "r", "w", "?"};
 	static const char *status_string[] = {"+", "?", "F", "b"};
 
-	if (debug_level < LOG_LVL_DEBUG)
+	if (!LOG_LEVEL_ENABLED(LOG_LVL_DEBUG))
 		return;
 
 	assert(field->out_value != NULL);
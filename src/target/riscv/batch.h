@@ -50,14 +50,20 @@ bool riscv_batch_full(struct riscv_batch *batch);
 /* Executes this scan batch. */
 void riscv_batch_run(struct riscv_batch *batch);
 
-/* Adds a DMI write to this batch. */
-void riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data);
+/* Adds a DMI write to this batch.  Returns the index of the scan, which can be
+ * passed to riscv_batch_get_dmi_status() once the batch has run. */
+size_t riscv_batch_add_dmi_write(struct riscv_batch *batch, unsigned address, uint64_t data);
 
 /* DMI reads must be handled in two parts: the first one schedules a read and
  * provides a key, the second one actually obtains the value of that read .*/
 size_t riscv_batch_add_dmi_read(struct riscv_batch *batch, unsigned address);
 uint64_t riscv_batch_get_dmi_read(struct riscv_batch *batch, size_t key);
 
+/* Returns the DMI status that was captured while shifting in the given scan.
+ * A busy status means the operation in that scan was ignored, and (because
+ * busy is sticky) so was every operation after it. */
+unsigned riscv_batch_get_dmi_status(struct riscv_batch *batch, size_t scan);
+
 /* Scans in a NOP. */
 void riscv_batch_add_nop(struct riscv_batch *batch);
 
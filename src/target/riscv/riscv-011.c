@@ -388,7 +388,7 @@ static void dump_field(const struct scan_field *field)
 	static const char *op_string[] = {"nop", "r", "w", "?"};
 	static const char *status_string[] = {"+", "?", "F", "b"};
 
-	if (debug_level < LOG_LVL_DEBUG)
+	if (!LOG_LEVEL_ENABLED(LOG_LVL_DEBUG))
 		return;
 
 	uint64_t out = buf_get_u64(field->out_value, 0, field->num_bits);
@@ -50,6 +50,10 @@ static void riscv013_step_current_hart(struct target *target);
 static void riscv013_on_halt(struct target *target);
 static void riscv013_on_step(struct target *target);
 static void riscv013_on_resume(struct target *target);
+static int riscv013_halt_harts(struct target *target, uint32_t hart_mask);
+static int riscv013_resume_harts(struct target *target, uint32_t hart_mask);
+static int riscv013_harts_halted(struct target *target, uint32_t hart_mask,
+		bool *any_halted, bool *all_halted);
 static bool riscv013_is_halted(struct target *target);
 static enum riscv_halt_reason riscv013_halt_reason(struct target *target);
 static void riscv013_debug_buffer_enter(struct target *target, struct riscv_program *p);
@@ -183,6 +187,16 @@ typedef struct {
 	// target in cmderr, the caller can look here to see what that error was.
 	// (Compare with errno.)
 	unsigned cmderr;
+
+	// The value of sbcs read in examine(), which describes the System Bus
+	// Access capabilities of the Debug Module. An sbasize of 0 means there is
+	// no System Bus Access at all.
+	uint32_t sbcs;
+
+	// True if the debug module implements the hart array mask.
+	bool hasel_supported;
+	// The value last written to hawindow (for hawindowsel=0).
+	uint32_t hawindow;
 } riscv013_info_t;
 
 static void decode_dmi(char *text, unsigned address, unsigned data)
@@ -248,7 +262,7 @@ static void dump_field(const struct scan_field *field)
 	static const char *op_string[] = {"-", "r", "w", "?"};
 	static const char *status_string[] = {"+", "?", "F", "b"};
 
-	if (debug_level < LOG_LVL_DEBUG)
+	if (!LOG_LEVEL_ENABLED(LOG_LVL_DEBUG))
 		return;
 
 	uint64_t out = buf_get_u64(field->out_value, 0, field->num_bits);
@@ -412,40 +426,111 @@ static dmi_status_t dmi_scan(struct target *target, uint16_t *address_in,
 	return buf_get_u32(in, DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
 }
 
+/**
+ * Like dmi_scan(), but follow the access with a NOP so its result comes back
+ * in the same JTAG flush.  *op_status is the status captured while shifting in
+ * the access; busy means the access itself was ignored.  The return value is
+ * the status captured with the NOP; busy there means the access was accepted
+ * but hadn't completed yet.
+ */
+static dmi_status_t dmi_scan_pair(struct target *target, dmi_status_t *op_status,
+		uint64_t *data_in, dmi_op_t op, uint16_t address_out, uint64_t data_out,
+		bool exec)
+{
+	riscv013_info_t *info = get_info(target);
+	uint8_t in[2][8] = {{0}};
+	uint8_t out[2][8];
+	struct scan_field field[2];
+
+	assert(info->abits != 0);
+
+	for (unsigned i = 0; i < 2; i++) {
+		field[i].num_bits = info->abits + DTM_DMI_OP_LENGTH + DTM_DMI_DATA_LENGTH;
+		field[i].out_value = out[i];
+		field[i].in_value = in[i];
+		field[i].check_value = NULL;
+		field[i].check_mask = NULL;
+	}
+
+	buf_set_u64(out[0], DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH, op);
+	buf_set_u64(out[0], DTM_DMI_DATA_OFFSET, DTM_DMI_DATA_LENGTH, data_out);
+	buf_set_u64(out[0], DTM_DMI_ADDRESS_OFFSET, info->abits, address_out);
+	riscv013_fill_dmi_nop_u64(target, (char *) out[1]);
+
+	int idle_count = info->dmi_busy_delay;
+	if (exec)
+		idle_count += info->ac_busy_delay;
+
+	/* Assume dbus is already selected. */
+	for (unsigned i = 0; i < 2; i++) {
+		jtag_add_dr_scan(target->tap, 1, &field[i], TAP_IDLE);
+		if (idle_count)
+			jtag_add_runtest(idle_count, TAP_IDLE);
+	}
+
+	int retval = jtag_execute_queue();
+	if (retval != ERROR_OK) {
+		LOG_ERROR("dmi_scan_pair failed jtag scan");
+		*op_status = DMI_STATUS_FAILED;
+		return DMI_STATUS_FAILED;
+	}
+
+	dump_field(&field[0]);
+	dump_field(&field[1]);
+
+	*op_status = buf_get_u32(in[0], DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
+	if (data_in)
+		*data_in = buf_get_u64(in[1], DTM_DMI_DATA_OFFSET, DTM_DMI_DATA_LENGTH);
+	return buf_get_u32(in[1], DTM_DMI_OP_OFFSET, DTM_DMI_OP_LENGTH);
+}
+
 static uint64_t dmi_read(struct target *target, uint16_t address)
 {
 	select_dmi(target);
 
 	dmi_status_t status;
+	dmi_status_t op_status;
 	uint16_t address_in;
+	uint64_t value;
 
 	unsigned i = 0;
 
-	// This first loop ensures that the read request was actually sent
-	// to the target. Note that if for some reason this stays busy,
-	// it is actually due to the previous dmi_read or dmi_write.
-	for (i = 0; i < 256; i++) {
-		status = dmi_scan(target, NULL, NULL, DMI_OP_READ, address, 0,
-				false);
-		if (status == DMI_STATUS_BUSY) {
-			increase_dmi_busy_delay(target);
-		} else if (status == DMI_STATUS_SUCCESS) {
-			break;
-		} else {
-			LOG_ERROR("failed read from 0x%x, status=%d", address, status);
-			break;
+	// In the common case the read and the NOP that fetches its result go
+	// out in a single JTAG flush. Only when something comes back busy do we
+	// fall back to doing it one scan at a time.
+	status = dmi_scan_pair(target, &op_status, &value, DMI_OP_READ, address, 0,
+			false);
+	if (op_status == DMI_STATUS_SUCCESS && status == DMI_STATUS_SUCCESS)
+		return value;
+	if (op_status == DMI_STATUS_BUSY || status == DMI_STATUS_BUSY)
+		increase_dmi_busy_delay(target);
+
+	if (op_status != DMI_STATUS_SUCCESS) {
+		// This first loop ensures that the read request was actually sent
+		// to the target. Note that if for some reason this stays busy,
+		// it is actually due to the previous dmi_read or dmi_write.
+		for (i = 0; i < 256; i++) {
+			status = dmi_scan(target, NULL, NULL, DMI_OP_READ, address, 0,
+					false);
+			if (status == DMI_STATUS_BUSY) {
+				increase_dmi_busy_delay(target);
+			} else if (status == DMI_STATUS_SUCCESS) {
+				break;
+			} else {
+				LOG_ERROR("failed read from 0x%x, status=%d", address, status);
+				break;
+			}
 		}
-	}
 
-	if (status != DMI_STATUS_SUCCESS) {
-		LOG_ERROR("Failed read from 0x%x; status=%d", address, status);
-		abort();
+		if (status != DMI_STATUS_SUCCESS) {
+			LOG_ERROR("Failed read from 0x%x; status=%d", address, status);
+			abort();
+		}
 	}
 
 	// This second loop ensures that we got the read
 	// data back. Note that NOP can result in a 'busy' result as well, but
 	// that would be noticed on the next DMI access we do.
-	uint64_t value;
 	for (i = 0; i < 256; i++) {
 		status = dmi_scan(target, &address_in, &value, DMI_OP_NOP, address, 0,
 				false);
@@ -472,26 +557,37 @@ static void dmi_write(struct target *target, uint16_t address, uint64_t value)
 {
 	select_dmi(target);
 	dmi_status_t status = DMI_STATUS_BUSY;
+	dmi_status_t op_status;
 	unsigned i = 0;
 
-	// The first loop ensures that we successfully sent the write request.
-	for (i = 0; i < 256; i++) {
-		status = dmi_scan(target, NULL, NULL, DMI_OP_WRITE, address, value,
-				address == DMI_COMMAND);
-		if (status == DMI_STATUS_BUSY) {
-			increase_dmi_busy_delay(target);
-		} else if (status == DMI_STATUS_SUCCESS) {
-			break;
-		} else {
-			LOG_ERROR("failed write to 0x%x, status=%d", address, status);
-			break;
+	// As in dmi_read(), try to send the write and confirm it in one go.
+	status = dmi_scan_pair(target, &op_status, NULL, DMI_OP_WRITE, address,
+			value, address == DMI_COMMAND);
+	if (op_status == DMI_STATUS_SUCCESS && status == DMI_STATUS_SUCCESS)
+		return;
+	if (op_status == DMI_STATUS_BUSY || status == DMI_STATUS_BUSY)
+		increase_dmi_busy_delay(target);
+
+	if (op_status != DMI_STATUS_SUCCESS) {
+		// The first loop ensures that we successfully sent the write request.
+		for (i = 0; i < 256; i++) {
+			status = dmi_scan(target, NULL, NULL, DMI_OP_WRITE, address, value,
+					address == DMI_COMMAND);
+			if (status == DMI_STATUS_BUSY) {
+				increase_dmi_busy_delay(target);
+			} else if (status == DMI_STATUS_SUCCESS) {
+				break;
+			} else {
+				LOG_ERROR("failed write to 0x%x, status=%d", address, status);
+				break;
+			}
 		}
-	}
 
-	if (status != DMI_STATUS_SUCCESS) {
-		LOG_ERROR("Failed write to 0x%x;, status=%d",
-				address, status);
-		abort();
+		if (status != DMI_STATUS_SUCCESS) {
+			LOG_ERROR("Failed write to 0x%x;, status=%d",
+					address, status);
+			abort();
+		}
 	}
 
 	// The second loop isn't strictly necessary, but would ensure that
@@ -581,14 +677,39 @@ static int execute_abstract_command(struct target *target, uint32_t command)
 {
 	RISCV013_INFO(info);
 	LOG_DEBUG("command=0x%x", command);
-	dmi_write(target, DMI_COMMAND, command);
 
-	{
-		uint32_t dmstatus = 0;
-		wait_for_idle(target, &dmstatus);
+	select_dmi(target);
+
+	// Start the command and check on it in the same JTAG flush. Only if it's
+	// still running (or the DTM was busy) do we poll abstractcs.
+	struct riscv_batch *batch = riscv_batch_alloc(target, 3,
+			info->dmi_busy_delay + info->ac_busy_delay);
+	size_t command_scan = riscv_batch_add_dmi_write(batch, DMI_COMMAND, command);
+	size_t cs_key = riscv_batch_add_dmi_read(batch, DMI_ABSTRACTCS);
+	riscv_batch_run(batch);
+
+	unsigned command_status = riscv_batch_get_dmi_status(batch, command_scan);
+	uint64_t cs_out = riscv_batch_get_dmi_read(batch, cs_key);
+	riscv_batch_free(batch);
+
+	uint32_t cs;
+	if (command_status != DMI_STATUS_SUCCESS) {
+		// The command write was ignored, so send it again the slow way.
+		increase_dmi_busy_delay(target);
+		dmi_write(target, DMI_COMMAND, command);
+		if (wait_for_idle(target, &cs) != ERROR_OK)
+			return ERROR_FAIL;
+	} else if (get_field(cs_out, DTM_DMI_OP) != DMI_STATUS_SUCCESS) {
+		increase_dmi_busy_delay(target);
+		if (wait_for_idle(target, &cs) != ERROR_OK)
+			return ERROR_FAIL;
+	} else {
+		cs = get_field(cs_out, DTM_DMI_DATA);
+		if (get_field(cs, DMI_ABSTRACTCS_BUSY) &&
+				wait_for_idle(target, &cs) != ERROR_OK)
+			return ERROR_FAIL;
 	}
 
-	uint32_t cs = dmi_read(target, DMI_ABSTRACTCS);
 	info->cmderr = get_field(cs, DMI_ABSTRACTCS_CMDERR);
 	if (info->cmderr != 0) {
 		LOG_DEBUG("command 0x%x failed; abstractcs=0x%x", command, cs);
@@ -601,44 +722,15 @@ static int execute_abstract_command(struct target *target, uint32_t command)
 	return ERROR_OK;
 }
 
-static riscv_reg_t read_abstract_arg(struct target *target, unsigned index)
-{
-	riscv_reg_t value = 0;
-	unsigned xlen = riscv_xlen(target);
-	unsigned offset = index * xlen / 32;
-	switch (xlen) {
-		default:
-			LOG_ERROR("Unsupported xlen: %d", xlen);
-			return ~0;
-		case 64:
-			value |= ((uint64_t) dmi_read(target, DMI_DATA0 + offset + 1)) << 32;
-		case 32:
-			value |= dmi_read(target, DMI_DATA0 + offset);
-	}
-	return value;
-}
-
-static int write_abstract_arg(struct target *target, unsigned index,
-		riscv_reg_t value)
-{
-	unsigned xlen = riscv_xlen(target);
-	unsigned offset = index * xlen / 32;
-	switch (xlen) {
-		default:
-			LOG_ERROR("Unsupported xlen: %d", xlen);
-			return ~0;
-		case 64:
-			dmi_write(target, DMI_DATA0 + offset + 1, value >> 32);
-		case 32:
-			dmi_write(target, DMI_DATA0 + offset, value);
-	}
-	return ERROR_OK;
-}
-
-static int register_read_abstract(struct target *target, uint64_t *value,
-		uint32_t number, unsigned size)
+/**
+ * Returns the abstract command that transfers the given register between the
+ * hart and data0, or 0 if that register can't (or is known not to) be accessed
+ * that way.
+ */
+static uint32_t access_register_command(struct target *target, uint32_t number,
+		unsigned size, bool write)
 {
-	RISCV013_INFO(r);
+	RISCV013_INFO(info);
 
 	uint32_t command = set_field(0, DMI_COMMAND_CMDTYPE, 0);
 	switch (size) {
@@ -649,108 +741,226 @@ static int register_read_abstract(struct target *target, uint64_t *value,
 			command = set_field(command, AC_ACCESS_REGISTER_SIZE, 3);
 			break;
 		default:
-			LOG_ERROR("Unsupported abstract register read size: %d", size);
-			return ERROR_FAIL;
+			LOG_ERROR("Unsupported abstract register access size: %d", size);
+			return 0;
 	}
 	command = set_field(command, AC_ACCESS_REGISTER_POSTEXEC, 0);
 	command = set_field(command, AC_ACCESS_REGISTER_TRANSFER, 1);
-	command = set_field(command, AC_ACCESS_REGISTER_WRITE, 0);
+	command = set_field(command, AC_ACCESS_REGISTER_WRITE, write);
 
 	if (number <= GDB_REGNO_XPR31) {
 		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
 				0x1000 + number - GDB_REGNO_XPR0);
 	} else if (number >= GDB_REGNO_FPR0 && number <= GDB_REGNO_FPR31) {
-		if (!r->abstract_read_fpr_supported)
-			return ERROR_FAIL;
+		if (write ? !info->abstract_write_fpr_supported :
+				!info->abstract_read_fpr_supported)
+			return 0;
 		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
 				0x1020 + number - GDB_REGNO_FPR0);
 	} else if (number >= GDB_REGNO_CSR0 && number <= GDB_REGNO_CSR4095) {
-		if (!r->abstract_read_csr_supported)
-			return ERROR_FAIL;
+		if (write ? !info->abstract_write_csr_supported :
+				!info->abstract_read_csr_supported)
+			return 0;
 		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
 				number - GDB_REGNO_CSR0);
 	} else {
-		return ERROR_FAIL;
+		return 0;
 	}
 
-	int result = execute_abstract_command(target, command);
-	if (result != ERROR_OK) {
-		if (r->cmderr == CMDERR_NOT_SUPPORTED) {
-			if (number >= GDB_REGNO_FPR0 && number <= GDB_REGNO_FPR31) {
-				r->abstract_read_fpr_supported = false;
-				LOG_INFO("Disabling abstract command reads from FPRs.");
-			} else if (number >= GDB_REGNO_CSR0 && number <= GDB_REGNO_CSR4095) {
-				r->abstract_read_csr_supported = false;
-				LOG_INFO("Disabling abstract command reads from CSRs.");
-			}
+	return command;
+}
+
+/* Remember which kinds of registers the abstract commands can't access, so
+ * we don't keep trying. */
+static void abstract_access_not_supported(struct target *target,
+		uint32_t number, bool write)
+{
+	RISCV013_INFO(info);
+
+	if (number >= GDB_REGNO_FPR0 && number <= GDB_REGNO_FPR31) {
+		if (write) {
+			info->abstract_write_fpr_supported = false;
+			LOG_INFO("Disabling abstract command writes to FPRs.");
+		} else {
+			info->abstract_read_fpr_supported = false;
+			LOG_INFO("Disabling abstract command reads from FPRs.");
+		}
+	} else if (number >= GDB_REGNO_CSR0 && number <= GDB_REGNO_CSR4095) {
+		if (write) {
+			info->abstract_write_csr_supported = false;
+			LOG_INFO("Disabling abstract command writes to CSRs.");
+		} else {
+			info->abstract_read_csr_supported = false;
+			LOG_INFO("Disabling abstract command reads from CSRs.");
 		}
-		return result;
 	}
+}
 
-	*value = read_abstract_arg(target, 0);
+struct abstract_access {
+	uint32_t number;
+	uint64_t value;
+	bool write;
+	/* ERROR_OK if the access succeeded, otherwise the caller should fall
+	 * back to using the program buffer. */
+	int result;
+};
 
-	return ERROR_OK;
-}
+/* The number of abstract register accesses queued in a single batch. */
+#define ABSTRACT_BATCH_ACCESSES	32
 
-static int register_write_abstract(struct target *target, uint32_t number,
-		uint64_t value, unsigned size)
+/**
+ * Perform a list of abstract register accesses, queueing as many of them as
+ * possible into a single riscv_batch.  Every access is followed by a read of
+ * abstractcs, which tells us exactly which accesses completed.  When the DTM
+ * or the abstract command engine reports busy, only the accesses from the
+ * first failed one onwards are issued again.
+ */
+static int abstract_access_batch(struct target *target,
+		struct abstract_access *accesses, unsigned count)
 {
 	RISCV013_INFO(info);
+	unsigned xlen = riscv_xlen(target);
+	unsigned words = xlen / 32;
 
-	uint32_t command = set_field(0, DMI_COMMAND_CMDTYPE, 0);
-	switch (size) {
-		case 32:
-			command = set_field(command, AC_ACCESS_REGISTER_SIZE, 2);
-			break;
-		case 64:
-			command = set_field(command, AC_ACCESS_REGISTER_SIZE, 3);
-			break;
-		default:
-			LOG_ERROR("Unsupported abstract register read size: %d", size);
-			return ERROR_FAIL;
-	}
-	command = set_field(command, AC_ACCESS_REGISTER_POSTEXEC, 0);
-	command = set_field(command, AC_ACCESS_REGISTER_TRANSFER, 1);
-	command = set_field(command, AC_ACCESS_REGISTER_WRITE, 1);
-
-	if (number <= GDB_REGNO_XPR31) {
-		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
-				0x1000 + number - GDB_REGNO_XPR0);
-	} else if (number >= GDB_REGNO_FPR0 && number <= GDB_REGNO_FPR31) {
-		if (!info->abstract_read_fpr_supported)
-			return ERROR_FAIL;
-		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
-				0x1020 + number - GDB_REGNO_FPR0);
-	} else if (number >= GDB_REGNO_CSR0 && number <= GDB_REGNO_CSR4095) {
-		if (!info->abstract_read_csr_supported)
-			return ERROR_FAIL;
-		command = set_field(command, AC_ACCESS_REGISTER_REGNO,
-				number - GDB_REGNO_CSR0);
-	} else {
+	if (xlen != 32 && xlen != 64) {
+		LOG_ERROR("Unsupported xlen: %d", xlen);
 		return ERROR_FAIL;
 	}
 
-	if (write_abstract_arg(target, 0, value) != ERROR_OK) {
-		return ERROR_FAIL;
-	}
+	select_dmi(target);
 
-	int result = execute_abstract_command(target, command);
-	if (result != ERROR_OK) {
-		if (info->cmderr == CMDERR_NOT_SUPPORTED) {
-			if (number >= GDB_REGNO_FPR0 && number <= GDB_REGNO_FPR31) {
-				info->abstract_write_fpr_supported = false;
-				LOG_INFO("Disabling abstract command writes to FPRs.");
-			} else if (number >= GDB_REGNO_CSR0 && number <= GDB_REGNO_CSR4095) {
-				info->abstract_write_csr_supported = false;
-				LOG_INFO("Disabling abstract command writes to CSRs.");
+	unsigned done = 0;
+	while (done < count) {
+		unsigned n = MIN(count - done, ABSTRACT_BATCH_ACCESSES);
+		size_t cs_key[ABSTRACT_BATCH_ACCESSES];
+		size_t data_key[ABSTRACT_BATCH_ACCESSES];
+		uint32_t command[ABSTRACT_BATCH_ACCESSES];
+
+		struct riscv_batch *batch = riscv_batch_alloc(target,
+				n * (2 * words + 3),
+				info->dmi_busy_delay + info->ac_busy_delay);
+
+		for (unsigned i = 0; i < n; i++) {
+			struct abstract_access *a = accesses + done + i;
+			command[i] = access_register_command(target, a->number, xlen,
+					a->write);
+			if (command[i] == 0)
+				continue;
+
+			if (a->write) {
+				if (words == 2)
+					riscv_batch_add_dmi_write(batch, DMI_DATA1, a->value >> 32);
+				riscv_batch_add_dmi_write(batch, DMI_DATA0, (uint32_t) a->value);
+			}
+			riscv_batch_add_dmi_write(batch, DMI_COMMAND, command[i]);
+			cs_key[i] = riscv_batch_add_dmi_read(batch, DMI_ABSTRACTCS);
+			if (!a->write) {
+				data_key[i] = riscv_batch_add_dmi_read(batch, DMI_DATA0);
+				if (words == 2)
+					riscv_batch_add_dmi_read(batch, DMI_DATA1);
 			}
 		}
-		return result;
+
+		riscv_batch_run(batch);
+
+		unsigned completed = 0;
+		for (unsigned i = 0; i < n; i++) {
+			struct abstract_access *a = accesses + done + i;
+			if (command[i] == 0) {
+				a->result = ERROR_FAIL;
+				completed++;
+				continue;
+			}
+
+			// Busy is sticky, so if the last read of this access came back
+			// fine, so did everything before it.
+			size_t last_key = a->write ? cs_key[i] : data_key[i] + words - 1;
+			uint64_t last_out = riscv_batch_get_dmi_read(batch, last_key);
+			if (get_field(last_out, DTM_DMI_OP) != DMI_STATUS_SUCCESS) {
+				increase_dmi_busy_delay(target);
+				riscv013_clear_abstract_error(target);
+				break;
+			}
+
+			uint32_t abstractcs = get_field(
+					riscv_batch_get_dmi_read(batch, cs_key[i]), DTM_DMI_DATA);
+			info->cmderr = get_field(abstractcs, DMI_ABSTRACTCS_CMDERR);
+			if (get_field(abstractcs, DMI_ABSTRACTCS_BUSY) ||
+					info->cmderr == CMDERR_BUSY) {
+				increase_ac_busy_delay(target);
+				riscv013_clear_abstract_error(target);
+				break;
+			}
+
+			completed++;
+
+			if (info->cmderr != CMDERR_NONE) {
+				// Any commands after this one were ignored.
+				LOG_DEBUG("command 0x%x failed; abstractcs=0x%x", command[i],
+						abstractcs);
+				if (info->cmderr == CMDERR_NOT_SUPPORTED)
+					abstract_access_not_supported(target, a->number, a->write);
+				riscv013_clear_abstract_error(target);
+				a->result = ERROR_FAIL;
+				break;
+			}
+
+			if (!a->write) {
+				a->value = get_field(riscv_batch_get_dmi_read(batch, data_key[i]),
+						DTM_DMI_DATA);
+				if (words == 2)
+					a->value |= get_field(riscv_batch_get_dmi_read(batch,
+								data_key[i] + 1), DTM_DMI_DATA) << 32;
+			}
+			a->result = ERROR_OK;
+		}
+
+		riscv_batch_free(batch);
+		done += completed;
 	}
 
 	return ERROR_OK;
 }
 
+static int register_read_abstract(struct target *target, uint64_t *value,
+		uint32_t number, unsigned size)
+{
+	if (size != (unsigned) riscv_xlen(target)) {
+		LOG_ERROR("Unsupported abstract register read size: %d", size);
+		return ERROR_FAIL;
+	}
+
+	struct abstract_access access = {
+		.number = number,
+		.write = false,
+	};
+	if (abstract_access_batch(target, &access, 1) != ERROR_OK)
+		return ERROR_FAIL;
+	if (access.result != ERROR_OK)
+		return access.result;
+
+	*value = access.value;
+	return ERROR_OK;
+}
+
+static int register_write_abstract(struct target *target, uint32_t number,
+		uint64_t value, unsigned size)
+{
+	if (size != (unsigned) riscv_xlen(target)) {
+		LOG_ERROR("Unsupported abstract register write size: %d", size);
+		return ERROR_FAIL;
+	}
+
+	struct abstract_access access = {
+		.number = number,
+		.value = value,
+		.write = true,
+	};
+	if (abstract_access_batch(target, &access, 1) != ERROR_OK)
+		return ERROR_FAIL;
+	return access.result;
+}
+
 static int register_write_direct(struct target *target, unsigned number,
 		uint64_t value)
 {
@@ -841,31 +1051,28 @@ static int register_read_direct(struct target *target, uint64_t *value, uint32_t
 
 static int register_get(struct reg *reg)
 {
-	struct target *target = (struct target *) reg->arch_info;
-	uint64_t value = riscv_get_register(target, reg->number);
+	struct riscv_reg_info *reg_info = reg->arch_info;
+	struct target *target = reg_info->target;
+	uint64_t value = riscv_get_register_on_hart(target, reg_info->hartid,
+			reg->number);
 	buf_set_u64(reg->value, 0, 64, value);
 	return ERROR_OK;
 }
 
-static int register_write(struct target *target, unsigned int number,
-		uint64_t value)
-{
-	riscv_set_register(target, number, value);
-	return ERROR_OK;
-}
-
 static int register_set(struct reg *reg, uint8_t *buf)
 {
-	struct target *target = (struct target *) reg->arch_info;
+	struct riscv_reg_info *reg_info = reg->arch_info;
+	struct target *target = reg_info->target;
 
-	uint64_t value = buf_get_u64(buf, 0, riscv_xlen(target));
+	uint64_t value = buf_get_u64(buf, 0, riscv_xlen_of_hart(target,
+				reg_info->hartid));
 
 	LOG_DEBUG("write 0x%" PRIx64 " to %s", value, reg->name);
-	struct reg *r = &target->reg_cache->reg_list[reg->number];
-	r->valid = true;
-	memcpy(r->value, buf, (r->size + 7) / 8);
+	riscv_set_register_deferred(target, reg_info->hartid, reg->number, value);
+	reg->valid = true;
+	memcpy(reg->value, buf, (reg->size + 7) / 8);
 
-	return register_write(target, reg->number, value);
+	return ERROR_OK;
 }
 
 static struct reg_arch_type riscv_reg_arch_type = {
@@ -889,6 +1096,9 @@ static int init_target(struct command_context *cmd_ctx,
 	generic_info->on_halt = &riscv013_on_halt;
 	generic_info->on_resume = &riscv013_on_resume;
 	generic_info->on_step = &riscv013_on_step;
+	generic_info->halt_harts = &riscv013_halt_harts;
+	generic_info->resume_harts = &riscv013_resume_harts;
+	generic_info->harts_halted = &riscv013_harts_halted;
 	generic_info->halt_reason = &riscv013_halt_reason;
 	generic_info->debug_buffer_enter = &riscv013_debug_buffer_enter;
 	generic_info->debug_buffer_leave = &riscv013_debug_buffer_leave;
@@ -931,7 +1141,15 @@ static int init_target(struct command_context *cmd_ctx,
 	const unsigned int max_reg_name_len = 12;
 	info->reg_names = calloc(1, GDB_REGNO_COUNT * max_reg_name_len);
 	char *reg_name = info->reg_names;
-	info->reg_values = NULL;
+	info->reg_values = calloc(GDB_REGNO_COUNT, sizeof(uint64_t));
+	uint64_t *reg_values = info->reg_values;
+
+	/* This is the register cache of the hart we start out with.  The others
+	 * get a copy of it when they're first selected. */
+	struct riscv_reg_info *reg_info = calloc(1, sizeof(*reg_info));
+	reg_info->target = target;
+	reg_info->hartid = generic_info->current_hartid;
+	generic_info->hart_reg_cache[reg_info->hartid] = target->reg_cache;
 
 	for (unsigned int i = 0; i < GDB_REGNO_COUNT; i++) {
 		struct reg *r = &target->reg_cache->reg_list[i];
@@ -941,7 +1159,8 @@ static int init_target(struct command_context *cmd_ctx,
 		r->valid = false;
 		r->exist = true;
 		r->type = &riscv_reg_arch_type;
-		r->arch_info = target;
+		r->arch_info = reg_info;
+		r->value = &reg_values[i];
 		if (i <= GDB_REGNO_XPR31) {
 			sprintf(reg_name, "x%d", i);
 		} else if (i == GDB_REGNO_PC) {
@@ -1047,6 +1266,13 @@ static int examine(struct target *target)
 	info->datacount = get_field(abstractcs, DMI_ABSTRACTCS_DATACOUNT);
 	info->progsize = get_field(abstractcs, DMI_ABSTRACTCS_PROGSIZE);
 
+	// System Bus Access is optional, and doesn't require a halted hart.
+	info->sbcs = dmi_read(target, DMI_SBCS);
+	LOG_DEBUG("sbcs: 0x%08x (sbasize=%d)", info->sbcs,
+			get_field(info->sbcs, DMI_SBCS_SBASIZE));
+	if (get_field(info->sbcs, DMI_SBCS_SBERROR))
+		dmi_write(target, DMI_SBCS, info->sbcs & DMI_SBCS_SBERROR);
+
 	/* Before doing anything else we must first enumerate the harts. */
 	RISCV_INFO(r);
 	int original_coreid = target->coreid;
@@ -1069,6 +1295,27 @@ static int examine(struct target *target)
 
 	LOG_DEBUG("Enumerated %d harts", r->hart_count);
 
+	/* The hart array mask is optional. If hasel sticks, it's there. */
+	dmcontrol = dmi_read(target, DMI_DMCONTROL);
+	dmi_write(target, DMI_DMCONTROL, set_field(dmcontrol, DMI_DMCONTROL_HASEL, 1));
+	info->hasel_supported = get_field(dmi_read(target, DMI_DMCONTROL),
+			DMI_DMCONTROL_HASEL);
+	dmi_write(target, DMI_DMCONTROL, set_field(dmcontrol, DMI_DMCONTROL_HASEL, 0));
+	if (info->hasel_supported) {
+		dmi_write(target, DMI_HAWINDOWSEL, 0);
+		dmi_write(target, DMI_HAWINDOW, 0);
+		info->hawindow = 0;
+	}
+	LOG_DEBUG("hart array mask %s", info->hasel_supported ? "supported" :
+			"not supported");
+	if (!info->hasel_supported) {
+		/* Let the generic code pick the one hart at a time paths up
+		 * front instead of trying these first. */
+		r->halt_harts = NULL;
+		r->resume_harts = NULL;
+		r->harts_halted = NULL;
+	}
+
 	/* Halt every hart so we can probe them. */
 	riscv_halt_all_harts(target);
 
@@ -1298,6 +1545,7 @@ static int deassert_reset(struct target *target)
 		target->state = TARGET_RUNNING;
 	}
 	info->dmi_busy_delay = dmi_busy_delay;
+	riscv_invalidate_register_cache(target);
 	return ERROR_OK;
 }
 
@@ -1322,11 +1570,267 @@ static void write_to_buf(uint8_t *buffer, uint64_t value, unsigned size)
 	}
 }
 
+/*** System Bus Access. ***/
+
+/* The number of words transferred in a single batch over the system bus. */
+#define SB_BATCH_WORDS	64
+
+#define SBERROR_NONE		0
+#define SBERROR_BUSY		4
+
 /**
- * Read the requested memory, taking care to execute every read exactly once,
- * even if cmderr=busy is encountered.
+ * Returns the sbaccess encoding for an access of the given size, or -1 if the
+ * Debug Module can't perform such accesses over the system bus.
  */
-static int read_memory(struct target *target, target_addr_t address,
+static int sb_access_code(struct target *target, uint32_t size)
+{
+	RISCV013_INFO(info);
+
+	if (get_field(info->sbcs, DMI_SBCS_SBASIZE) == 0)
+		return -1;
+
+	switch (size) {
+		case 1:
+			return (info->sbcs & DMI_SBCS_SBACCESS8) ? 0 : -1;
+		case 2:
+			return (info->sbcs & DMI_SBCS_SBACCESS16) ? 1 : -1;
+		case 4:
+			return (info->sbcs & DMI_SBCS_SBACCESS32) ? 2 : -1;
+		default:
+			return -1;
+	}
+}
+
+static void sb_batch_add_address(struct target *target,
+		struct riscv_batch *batch, target_addr_t address)
+{
+	RISCV013_INFO(info);
+	if (get_field(info->sbcs, DMI_SBCS_SBASIZE) > 32)
+		riscv_batch_add_dmi_write(batch, DMI_SBADDRESS1, (uint64_t) address >> 32);
+	riscv_batch_add_dmi_write(batch, DMI_SBADDRESS0, (uint32_t) address);
+}
+
+static target_addr_t sb_read_address(struct target *target)
+{
+	RISCV013_INFO(info);
+	target_addr_t address = dmi_read(target, DMI_SBADDRESS0);
+	if (get_field(info->sbcs, DMI_SBCS_SBASIZE) > 32)
+		address |= (target_addr_t) dmi_read(target, DMI_SBADDRESS1) << 32;
+	return address;
+}
+
+/**
+ * Reads sbcs, clearing sberror if it is set.  Returns the sberror value that
+ * was found.
+ */
+static unsigned sb_check_error(struct target *target)
+{
+	uint32_t sbcs = dmi_read(target, DMI_SBCS);
+	unsigned sberror = get_field(sbcs, DMI_SBCS_SBERROR);
+	if (sberror != SBERROR_NONE) {
+		LOG_DEBUG("system bus error %d (sbcs=0x%08x)", sberror, sbcs);
+		dmi_write(target, DMI_SBCS, sbcs & DMI_SBCS_SBERROR);
+	}
+	return sberror;
+}
+
+/**
+ * Read memory through System Bus Access.  This doesn't touch the hart at all,
+ * so it works while the hart is running.  Each batch programs sbaddress, then
+ * streams reads of sbdata0 with sbautoread and sbautoincrement set.  A DMI
+ * busy response only causes the tail of the batch to be retried.
+ */
+static int read_memory_bus(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	RISCV013_INFO(info);
+
+	LOG_DEBUG("reading %d words of %d bytes from 0x%" TARGET_PRIxADDR
+			" via system bus", count, size, address);
+
+	int access = sb_access_code(target, size);
+	if (access < 0)
+		return ERROR_FAIL;
+
+	uint32_t sbcs = set_field(0, DMI_SBCS_SBACCESS, access);
+	sbcs = set_field(sbcs, DMI_SBCS_SBAUTOINCREMENT, 1);
+	uint32_t sbcs_read = set_field(sbcs, DMI_SBCS_SBAUTOREAD, 1);
+	sbcs_read = set_field(sbcs_read, DMI_SBCS_SBSINGLEREAD, 1);
+
+	select_dmi(target);
+
+	uint32_t index = 0;
+	while (index < count) {
+		uint32_t words = MIN(count - index, SB_BATCH_WORDS);
+		target_addr_t cur_addr = address + index * size;
+
+		struct riscv_batch *batch = riscv_batch_alloc(target, 2 * words + 8,
+				info->dmi_busy_delay);
+
+		/* Writing sbcs with sbsingleread set reads the first word.  Every
+		 * read of sbdata0 then returns that word and starts the next read,
+		 * except for the last one, where sbautoread is cleared first. */
+		riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs);
+		sb_batch_add_address(target, batch, cur_addr);
+		riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs_read);
+		for (uint32_t i = 0; i < words; i++) {
+			if (i == words - 1)
+				riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs);
+			riscv_batch_add_dmi_read(batch, DMI_SBDATA0);
+		}
+		size_t sbcs_key = riscv_batch_add_dmi_read(batch, DMI_SBCS);
+
+		riscv_batch_run(batch);
+
+		/* A busy response means that read, and everything after it, was
+		 * dropped by the DTM. */
+		uint32_t good = 0;
+		while (good < words) {
+			uint64_t dmi_out = riscv_batch_get_dmi_read(batch, good);
+			unsigned status = get_field(dmi_out, DTM_DMI_OP);
+			if (status == DMI_STATUS_FAILED) {
+				LOG_ERROR("failed read from sbdata0 at 0x%" TARGET_PRIxADDR,
+						cur_addr + good * size);
+				riscv_batch_free(batch);
+				return ERROR_FAIL;
+			}
+			if (status != DMI_STATUS_SUCCESS)
+				break;
+			good++;
+		}
+
+		uint64_t sbcs_out = riscv_batch_get_dmi_read(batch, sbcs_key);
+		unsigned sberror;
+		if (good < words ||
+				get_field(sbcs_out, DTM_DMI_OP) != DMI_STATUS_SUCCESS) {
+			increase_dmi_busy_delay(target);
+			sberror = sb_check_error(target);
+		} else {
+			sberror = get_field(get_field(sbcs_out, DTM_DMI_DATA),
+					DMI_SBCS_SBERROR);
+			if (sberror != SBERROR_NONE)
+				sb_check_error(target);
+		}
+
+		if (sberror == SBERROR_BUSY) {
+			/* The bus couldn't keep up, so none of the data can be
+			 * trusted.  Slow down and read the whole batch again. */
+			increase_dmi_busy_delay(target);
+			riscv_batch_free(batch);
+			continue;
+		} else if (sberror != SBERROR_NONE) {
+			LOG_DEBUG("system bus read from 0x%" TARGET_PRIxADDR
+					" failed with sberror=%d", cur_addr, sberror);
+			riscv_batch_free(batch);
+			return ERROR_FAIL;
+		}
+
+		for (uint32_t i = 0; i < good; i++) {
+			uint64_t dmi_out = riscv_batch_get_dmi_read(batch, i);
+			uint32_t value = get_field(dmi_out, DTM_DMI_DATA);
+			write_to_buf(buffer + (index + i) * size, value, size);
+			LOG_DEBUG("M[0x%" TARGET_PRIxADDR "] reads 0x%08x",
+					cur_addr + i * size, value);
+		}
+		riscv_batch_free(batch);
+
+		index += good;
+	}
+
+	return ERROR_OK;
+}
+
+/**
+ * Write memory through System Bus Access.  Like read_memory_bus() this works
+ * while the hart is running.  After every batch sbaddress is read back to find
+ * out how far the writes actually got, so a busy response only causes the
+ * remaining words to be written again.
+ */
+static int write_memory_bus(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, const uint8_t *buffer)
+{
+	RISCV013_INFO(info);
+
+	LOG_DEBUG("writing %d words of %d bytes to 0x%" TARGET_PRIxADDR
+			" via system bus", count, size, address);
+
+	int access = sb_access_code(target, size);
+	if (access < 0)
+		return ERROR_FAIL;
+
+	uint32_t sbcs = set_field(0, DMI_SBCS_SBACCESS, access);
+	sbcs = set_field(sbcs, DMI_SBCS_SBAUTOINCREMENT, 1);
+
+	select_dmi(target);
+
+	target_addr_t fin_addr = address + count * size;
+	target_addr_t cur_addr = address;
+	while (cur_addr < fin_addr) {
+		uint32_t index = (cur_addr - address) / size;
+		uint32_t words = MIN(count - index, SB_BATCH_WORDS);
+
+		struct riscv_batch *batch = riscv_batch_alloc(target, words + 4,
+				info->dmi_busy_delay);
+
+		riscv_batch_add_dmi_write(batch, DMI_SBCS, sbcs);
+		sb_batch_add_address(target, batch, cur_addr);
+		for (uint32_t i = 0; i < words; i++) {
+			const uint8_t *t_buffer = buffer + (index + i) * size;
+			uint32_t value;
+			switch (size) {
+				case 1:
+					value = t_buffer[0];
+					break;
+				case 2:
+					value = t_buffer[0]
+						| ((uint32_t) t_buffer[1] << 8);
+					break;
+				default:
+					value = t_buffer[0]
+						| ((uint32_t) t_buffer[1] << 8)
+						| ((uint32_t) t_buffer[2] << 16)
+						| ((uint32_t) t_buffer[3] << 24);
+					break;
+			}
+			LOG_DEBUG("M[0x%" TARGET_PRIxADDR "] writes 0x%08x",
+					cur_addr + i * size, value);
+			riscv_batch_add_dmi_write(batch, DMI_SBDATA0, value);
+		}
+
+		riscv_batch_run(batch);
+		riscv_batch_free(batch);
+
+		// If any of the scans came back busy, dmi_read() notices it here and
+		// increases dmi_busy_delay for the next batch.
+		unsigned sberror = sb_check_error(target);
+		if (sberror != SBERROR_NONE && sberror != SBERROR_BUSY) {
+			LOG_DEBUG("system bus write to 0x%" TARGET_PRIxADDR
+					" failed with sberror=%d", cur_addr, sberror);
+			return ERROR_FAIL;
+		}
+		if (sberror == SBERROR_BUSY)
+			increase_dmi_busy_delay(target);
+
+		// Figure out how far we managed to write.  If sbaddress didn't even
+		// get written, start the batch over.
+		target_addr_t next_addr = sb_read_address(target);
+		if (next_addr < cur_addr || next_addr > cur_addr + words * size ||
+				(next_addr - cur_addr) % size) {
+			LOG_DEBUG("sbaddress=0x%" TARGET_PRIxADDR " is out of range; "
+					"retrying from 0x%" TARGET_PRIxADDR, next_addr, cur_addr);
+			next_addr = cur_addr;
+		}
+		cur_addr = next_addr;
+	}
+
+	return ERROR_OK;
+}
+
+/**
+ * Read the requested memory using the program buffer, taking care to execute
+ * every read exactly once, even if cmderr=busy is encountered.
+ */
+static int read_memory_progbuf(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, uint8_t *buffer)
 {
 	RISCV013_INFO(info);
@@ -1507,7 +2011,19 @@ static int read_memory(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
-static int write_memory(struct target *target, target_addr_t address,
+static int read_memory(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, uint8_t *buffer)
+{
+	if (sb_access_code(target, size) >= 0) {
+		if (read_memory_bus(target, address, size, count, buffer) == ERROR_OK)
+			return ERROR_OK;
+		LOG_DEBUG("system bus read failed; falling back to program buffer");
+	}
+
+	return read_memory_progbuf(target, address, size, count, buffer);
+}
+
+static int write_memory_progbuf(struct target *target, target_addr_t address,
 		uint32_t size, uint32_t count, const uint8_t *buffer)
 {
 	RISCV013_INFO(info);
@@ -1692,6 +2208,18 @@ static int write_memory(struct target *target, target_addr_t address,
 	return ERROR_OK;
 }
 
+static int write_memory(struct target *target, target_addr_t address,
+		uint32_t size, uint32_t count, const uint8_t *buffer)
+{
+	if (sb_access_code(target, size) >= 0) {
+		if (write_memory_bus(target, address, size, count, buffer) == ERROR_OK)
+			return ERROR_OK;
+		LOG_DEBUG("system bus write failed; falling back to program buffer");
+	}
+
+	return write_memory_progbuf(target, address, size, count, buffer);
+}
+
 static int arch_state(struct target *target)
 {
 	return ERROR_OK;
@@ -1820,6 +2348,103 @@ static void riscv013_resume_current_hart(struct target *target)
 	return riscv013_step_or_resume_current_hart(target, false);
 }
 
+/* Write dmcontrol so that the current hart and the harts in hart_mask are
+ * selected, together with the given request bits. */
+static uint32_t select_hart_array(struct target *target, uint32_t hart_mask,
+		uint32_t request)
+{
+	RISCV_INFO(r);
+	RISCV013_INFO(info);
+
+	/* RISCV_MAX_HARTS is 32, so the first window covers them all. */
+	if (info->hawindow != hart_mask) {
+		dmi_write(target, DMI_HAWINDOW, hart_mask);
+		info->hawindow = hart_mask;
+	}
+
+	uint32_t dmcontrol = request | DMI_DMCONTROL_DMACTIVE | DMI_DMCONTROL_HASEL;
+	dmcontrol = set_field(dmcontrol, DMI_DMCONTROL_HARTSEL, r->current_hartid);
+	dmi_write(target, DMI_DMCONTROL, dmcontrol);
+	return dmcontrol;
+}
+
+/* Go back to only having the current hart selected, which is what everything
+ * else in here expects. */
+static void deselect_hart_array(struct target *target)
+{
+	RISCV_INFO(r);
+
+	uint32_t dmcontrol = DMI_DMCONTROL_DMACTIVE;
+	dmcontrol = set_field(dmcontrol, DMI_DMCONTROL_HARTSEL, r->current_hartid);
+	dmi_write(target, DMI_DMCONTROL, dmcontrol);
+}
+
+/* Sends haltreq or resumereq to every hart in hart_mask at once, and waits
+ * until all of them have halted or acknowledged the resume. */
+static int halt_or_resume_harts(struct target *target, uint32_t hart_mask,
+		bool halt)
+{
+	RISCV013_INFO(info);
+
+	if (!info->hasel_supported)
+		return ERROR_FAIL;
+
+	LOG_DEBUG("%s harts 0x%x", halt ? "halting" : "resuming", hart_mask);
+	uint32_t done_mask = halt ? DMI_DMSTATUS_ALLHALTED :
+		DMI_DMSTATUS_ALLRESUMEACK;
+	uint32_t dmcontrol = select_hart_array(target, hart_mask,
+			halt ? DMI_DMCONTROL_HALTREQ : DMI_DMCONTROL_RESUMEREQ);
+
+	uint32_t dmstatus = 0;
+	for (size_t i = 0; i < 256; ++i) {
+		dmstatus = dmi_read(target, DMI_DMSTATUS);
+		if (dmstatus & done_mask)
+			break;
+		if (!halt)
+			usleep(10);
+	}
+
+	deselect_hart_array(target);
+
+	if (!(dmstatus & done_mask)) {
+		LOG_ERROR("unable to %s harts 0x%x", halt ? "halt" : "resume",
+				hart_mask);
+		LOG_ERROR("  dmcontrol=0x%08x", dmcontrol);
+		LOG_ERROR("  dmstatus =0x%08x", dmstatus);
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
+
+static int riscv013_halt_harts(struct target *target, uint32_t hart_mask)
+{
+	return halt_or_resume_harts(target, hart_mask, true);
+}
+
+static int riscv013_resume_harts(struct target *target, uint32_t hart_mask)
+{
+	return halt_or_resume_harts(target, hart_mask, false);
+}
+
+static int riscv013_harts_halted(struct target *target, uint32_t hart_mask,
+		bool *any_halted, bool *all_halted)
+{
+	RISCV013_INFO(info);
+
+	if (!info->hasel_supported)
+		return ERROR_FAIL;
+
+	select_dmi(target);
+	select_hart_array(target, hart_mask, 0);
+	uint32_t dmstatus = dmi_read(target, DMI_DMSTATUS);
+	deselect_hart_array(target);
+
+	*any_halted = get_field(dmstatus, DMI_DMSTATUS_ANYHALTED);
+	*all_halted = get_field(dmstatus, DMI_DMSTATUS_ALLHALTED);
+	return ERROR_OK;
+}
+
 static void riscv013_step_current_hart(struct target *target)
 {
 	return riscv013_step_or_resume_current_hart(target, true);
@@ -1835,8 +2460,46 @@ static void riscv013_on_step(struct target *target)
 	return riscv013_on_step_or_resume(target, true);
 }
 
+/* Read the registers GDB is about to ask for in a single batch, and put the
+ * results in the register cache. */
 static void riscv013_on_halt(struct target *target)
 {
+	RISCV_INFO(r);
+	RISCV013_INFO(info);
+
+	struct reg_cache *cache = r->hart_reg_cache[riscv_current_hartid(target)];
+	if (!cache)
+		return;
+
+	struct abstract_access accesses[64];
+	unsigned count = 0;
+	for (unsigned i = GDB_REGNO_XPR0 + 1; i <= GDB_REGNO_XPR31; i++)
+		accesses[count++] = (struct abstract_access) { .number = i };
+	accesses[count++] = (struct abstract_access) { .number = GDB_REGNO_DPC };
+
+	unsigned flen = supports_extension(target, 'D') ? 64 :
+		supports_extension(target, 'F') ? 32 : 0;
+	if (flen == (unsigned) riscv_xlen(target) &&
+			info->abstract_read_fpr_supported) {
+		for (unsigned i = GDB_REGNO_FPR0; i <= GDB_REGNO_FPR31; i++)
+			accesses[count++] = (struct abstract_access) { .number = i };
+	}
+
+	if (abstract_access_batch(target, accesses, count) != ERROR_OK)
+		return;
+
+	struct reg *reg_list = cache->reg_list;
+	buf_set_u64(reg_list[GDB_REGNO_XPR0].value, 0, 64, 0);
+	reg_list[GDB_REGNO_XPR0].valid = true;
+	for (unsigned i = 0; i < count; i++) {
+		if (accesses[i].result != ERROR_OK)
+			continue;
+		unsigned number = accesses[i].number;
+		if (number == GDB_REGNO_DPC)
+			number = GDB_REGNO_PC;
+		buf_set_u64(reg_list[number].value, 0, 64, accesses[i].value);
+		reg_list[number].valid = true;
+	}
 }
 
 static bool riscv013_is_halted(struct target *target)
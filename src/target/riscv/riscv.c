@@ -266,9 +266,23 @@ static int riscv_init_target(struct command_context *cmd_ctx,
 static void riscv_deinit_target(struct target *target)
 {
 	LOG_DEBUG("riscv_deinit_target()");
+	riscv_info_t *info = (riscv_info_t *) target->arch_info;
+	/* The cache of the hart we started out with belongs to the
+	 * version-specific code, the others were created here. */
+	for (int h = 0; h < RISCV_MAX_HARTS; ++h) {
+		if (h == target->coreid || !info->hart_reg_cache[h])
+			continue;
+		struct reg_cache *cache = info->hart_reg_cache[h];
+		free(cache->reg_list[0].arch_info);
+		free(cache->reg_list[0].value);
+		free(cache->reg_list);
+		free(cache);
+	}
+	if (info->hart_reg_cache[target->coreid])
+		target->reg_cache = info->hart_reg_cache[target->coreid];
+
 	struct target_type *tt = get_target_type(target);
 	tt->deinit_target(target);
-	riscv_info_t *info = (riscv_info_t *) target->arch_info;
 	free(info);
 	target->arch_info = NULL;
 }
@@ -905,6 +919,16 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 		return ERROR_FAIL;
 	}
 
+	// Read back output parameters before they get restored.
+	for (int i = 0; i < num_reg_params; i++) {
+		if (reg_params[i].direction == PARAM_OUT)
+			continue;
+		struct reg *r = register_get_by_name(target->reg_cache, reg_params[i].reg_name, 0);
+		if (r->type->get(r) != ERROR_OK)
+			return ERROR_FAIL;
+		buf_cpy(r->value, reg_params[i].value, reg_params[i].size);
+	}
+
 	// Restore Interrupts
 	LOG_DEBUG("Restoring Interrupts");
 	buf_set_u64(mstatus_bytes, 0, info->xlen[0], current_mstatus);
@@ -929,32 +953,134 @@ static int riscv_run_algorithm(struct target *target, int num_mem_params,
 	return ERROR_OK;
 }
 
-/* Should run code on the target to perform CRC of 
-memory. Not yet implemented.
-*/
+/* Algorithm parameters are passed in GPRs, which are XLEN bits wide. */
+static void riscv_init_reg_param(struct target *target,
+		struct reg_param *param, const char *name, uint64_t value,
+		enum param_direction direction)
+{
+	init_reg_param(param, (char *) name, riscv_xlen(target), direction);
+	buf_set_u64(param->value, 0, riscv_xlen(target), value);
+}
 
+/* Runs contrib/loaders/checksum/riscv_crc.s on the target.  The loader only
+ * uses 32-bit arithmetic, so the same code works for RV32 and RV64. */
 static int riscv_checksum_memory(struct target *target,
 		target_addr_t address, uint32_t count,
-		uint32_t* checksum)
+		uint32_t *checksum)
 {
+	struct working_area *crc_algorithm;
+	struct reg_param reg_params[6];
+	int retval;
+
+	static const uint8_t riscv_crc_code[] = {
+#include "../../../contrib/loaders/checksum/riscv_crc.inc"
+	};
+
 	*checksum = 0xFFFFFFFF;
-	return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_alloc_working_area(target, sizeof(riscv_crc_code), &crc_algorithm);
+	if (retval != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_write_buffer(target, crc_algorithm->address,
+			sizeof(riscv_crc_code), riscv_crc_code);
+	if (retval != ERROR_OK)
+		goto cleanup;
+
+	/* a2-a5 are scratch registers for the loader; passing them as
+	 * parameters makes riscv_run_algorithm() restore them afterwards. */
+	riscv_init_reg_param(target, &reg_params[0], "x10", address, PARAM_IN_OUT);
+	riscv_init_reg_param(target, &reg_params[1], "x11", count, PARAM_OUT);
+	for (int i = 2; i < 6; i++) {
+		static const char * const scratch[] = { "x12", "x13", "x14", "x15" };
+		riscv_init_reg_param(target, &reg_params[i], scratch[i - 2], 0, PARAM_OUT);
+	}
+
+	int timeout = 20000 * (1 + (count / (1024 * 1024)));
+
+	retval = target_run_algorithm(target, 0, NULL, 6, reg_params,
+			crc_algorithm->address,
+			crc_algorithm->address + (sizeof(riscv_crc_code) - 4),
+			timeout, NULL);
+
+	if (retval == ERROR_OK)
+		*checksum = buf_get_u32(reg_params[0].value, 0, 32);
+	else
+		LOG_ERROR("error executing RISC-V crc algorithm");
+
+	for (int i = 0; i < 6; i++)
+		destroy_reg_param(&reg_params[i]);
+
+cleanup:
+	target_free_working_area(target, crc_algorithm);
+
+	return retval;
 }
 
-/* Should run code on the target to check whether a memory
-block holds all-ones (because this is generally called on
-NOR flash which is 1 when "blank")
-Not yet implemented.
-*/
-int riscv_blank_check_memory(struct target * target,
+/* Runs code on the target to check whether a memory block holds only
+ * erased_value (generally called on NOR flash, which is all ones when
+ * blank). */
+int riscv_blank_check_memory(struct target *target,
 				target_addr_t address,
 				uint32_t count,
-				uint32_t * blank,
+				uint32_t *blank,
 				uint8_t erased_value)
 {
+	struct working_area *erase_check_algorithm;
+	struct reg_param reg_params[4];
+	const uint8_t *code;
+	uint32_t code_size;
+	int retval;
+
+	static const uint8_t erase_check_code[] = {
+#include "../../../contrib/loaders/erase_check/riscv_erase_check.inc"
+	};
+	static const uint8_t zero_erase_check_code[] = {
+#include "../../../contrib/loaders/erase_check/riscv_0_erase_check.inc"
+	};
+
 	*blank = 0;
 
-	return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	switch (erased_value) {
+	case 0x00:
+		code = zero_erase_check_code;
+		code_size = sizeof(zero_erase_check_code);
+		break;
+	case 0xff:
+	default:
+		code = erase_check_code;
+		code_size = sizeof(erase_check_code);
+	}
+
+	if (target_alloc_working_area(target, code_size,
+			&erase_check_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_write_buffer(target, erase_check_algorithm->address,
+			code_size, code);
+	if (retval != ERROR_OK)
+		goto cleanup;
+
+	riscv_init_reg_param(target, &reg_params[0], "x10", address, PARAM_OUT);
+	riscv_init_reg_param(target, &reg_params[1], "x11", count, PARAM_OUT);
+	riscv_init_reg_param(target, &reg_params[2], "x12", erased_value, PARAM_IN_OUT);
+	riscv_init_reg_param(target, &reg_params[3], "x13", 0, PARAM_OUT);
+
+	retval = target_run_algorithm(target, 0, NULL, 4, reg_params,
+			erase_check_algorithm->address,
+			erase_check_algorithm->address + (code_size - 4),
+			10000, NULL);
+
+	if (retval == ERROR_OK)
+		*blank = buf_get_u32(reg_params[2].value, 0, 8);
+
+	for (int i = 0; i < 4; i++)
+		destroy_reg_param(&reg_params[i]);
+
+cleanup:
+	target_free_working_area(target, erase_check_algorithm);
+
+	return retval;
 }
 
 /*** OpenOCD Helper Functions ***/
@@ -980,11 +1106,35 @@ static int riscv_poll_hart(struct target *target, int hartid)
 }
 
 /*** OpenOCD Interface ***/
+
+/* Returns a mask with bit n set if hart n is enabled in this target. */
+static uint32_t riscv_enabled_hart_mask(struct target *target)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < riscv_count_harts(target); ++i) {
+		if (riscv_hart_enabled(target, i))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
 int riscv_openocd_poll(struct target *target)
 {
 	LOG_DEBUG("polling all harts");
 	int triggered_hart = -1;
 	if (riscv_rtos_enabled(target)) {
+		RISCV_INFO(r);
+
+		/* The summary bits tell us whether there's anything to look for
+		 * without selecting every hart in turn. */
+		bool any_halted = true, all_halted = false;
+		if (r->harts_halted && r->harts_halted(target,
+					riscv_enabled_hart_mask(target), &any_halted,
+					&all_halted) == ERROR_OK && !any_halted) {
+			LOG_DEBUG("  no harts halted, target->state=%d", target->state);
+			return ERROR_OK;
+		}
+
 		/* Check every hart for an event. */
 		for (int i = 0; i < riscv_count_harts(target); ++i) {
 			int out = riscv_poll_hart(target, i);
@@ -1010,8 +1160,8 @@ int riscv_openocd_poll(struct target *target)
 		 * halted (as we're either in single-step mode or they also
 		 * triggered a breakpoint), so don't attempt to halt those
 		 * harts. */
-		for (int i = 0; i < riscv_count_harts(target); ++i)
-			riscv_halt_one_hart(target, i);
+		if (!all_halted)
+			riscv_halt_all_harts(target);
 	} else {
 		if (riscv_poll_hart(target, riscv_current_hartid(target)) == 0)
 			return ERROR_OK;
@@ -1055,6 +1205,17 @@ int riscv_openocd_halt(struct target *target)
 		return out;
 	}
 
+	/* Writes that were deferred while the harts were halted before must
+	 * not be lost with the cache. */
+	int current_hartid = riscv_current_hartid(target);
+	for (int i = 0; i < riscv_count_harts(target); ++i) {
+		if (!riscv_hart_enabled(target, i))
+			continue;
+		riscv_set_current_hartid(target, i);
+		riscv_flush_registers(target, i);
+	}
+	riscv_set_current_hartid(target, current_hartid);
+
 	register_cache_invalidate(target->reg_cache);
 	if (riscv_rtos_enabled(target)) {
 		target->rtos->current_threadid = r->rtos_hartid + 1;
@@ -1110,7 +1271,6 @@ int riscv_openocd_step(
 		return out;
 	}
 
-	register_cache_invalidate(target->reg_cache);
 	target->state = TARGET_RUNNING;
 	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
 	target->state = TARGET_HALTED;
@@ -1224,11 +1384,110 @@ struct target_type riscv_target =
 
 /*** RISC-V Interface ***/
 
+/* Returns the register cache of the given hart, creating it with the same
+ * layout as the current one the first time the hart is used. */
+static struct reg_cache *riscv_hart_reg_cache(struct target *target, int hartid)
+{
+	RISCV_INFO(r);
+
+	if (r->hart_reg_cache[hartid])
+		return r->hart_reg_cache[hartid];
+
+	struct reg_cache *proto = target->reg_cache;
+	if (!proto)
+		return NULL;
+
+	struct reg_cache *cache = calloc(1, sizeof(*cache));
+	struct reg *reg_list = calloc(proto->num_regs, sizeof(*reg_list));
+	uint64_t *values = calloc(proto->num_regs, sizeof(*values));
+	struct riscv_reg_info *reg_info = calloc(1, sizeof(*reg_info));
+	if (!cache || !reg_list || !values || !reg_info) {
+		LOG_ERROR("Failed to allocate register cache for hart %d", hartid);
+		free(cache);
+		free(reg_list);
+		free(values);
+		free(reg_info);
+		return NULL;
+	}
+
+	reg_info->target = target;
+	reg_info->hartid = hartid;
+
+	cache->name = proto->name;
+	cache->num_regs = proto->num_regs;
+	cache->reg_list = reg_list;
+	for (unsigned i = 0; i < cache->num_regs; ++i) {
+		reg_list[i] = proto->reg_list[i];
+		reg_list[i].value = &values[i];
+		reg_list[i].arch_info = reg_info;
+		reg_list[i].valid = false;
+		reg_list[i].dirty = false;
+	}
+
+	r->hart_reg_cache[hartid] = cache;
+	return cache;
+}
+
+/* GPRs, FPRs and the PC only change when the hart runs or when we write them,
+ * so those are the registers we keep in the cache.  CSRs always go to the
+ * hart, because writes to them may not stick and reads may have side
+ * effects. */
+static struct reg *riscv_cached_reg(struct target *target, int hartid,
+		enum gdb_regno regid)
+{
+	RISCV_INFO(r);
+
+	if (regid > GDB_REGNO_FPR31 || !target_was_examined(target) ||
+			!r->hart_reg_cache[hartid])
+		return NULL;
+	return &r->hart_reg_cache[hartid]->reg_list[regid];
+}
+
+static void riscv_invalidate_hart_register_cache(struct target *target,
+		int hartid)
+{
+	RISCV_INFO(r);
+	struct reg_cache *cache = r->hart_reg_cache[hartid];
+
+	/* Update the register list's widths. */
+	register_cache_invalidate(cache);
+	for (size_t i = 0; i < cache->num_regs; ++i) {
+		struct reg *reg = &cache->reg_list[i];
+
+		switch (i) {
+		case GDB_REGNO_PRIV:
+			reg->size = 8;
+			break;
+		default:
+			reg->size = riscv_xlen_of_hart(target, hartid);
+			break;
+		}
+	}
+}
+
+/* Writes the registers that were changed in the cache back to the hart. */
+void riscv_flush_registers(struct target *target, int hartid)
+{
+	RISCV_INFO(r);
+	struct reg_cache *cache = r->hart_reg_cache[hartid];
+	if (!cache)
+		return;
+
+	for (unsigned i = 0; i <= GDB_REGNO_FPR31; ++i) {
+		struct reg *reg = &cache->reg_list[i];
+		if (!reg->dirty)
+			continue;
+		uint64_t value = buf_get_u64(reg->value, 0, 64);
+		LOG_DEBUG("[%d] flush %s <- %" PRIx64, hartid, gdb_regno_name(i), value);
+		r->set_register(target, hartid, i, value);
+		reg->dirty = false;
+	}
+}
+
 void riscv_info_init(struct target *target, riscv_info_t *r)
 {
 	memset(r, 0, sizeof(*r));
 	r->dtm_version = 1;
-	r->registers_initialized = false;
 	r->current_hartid = target->coreid;
 
 	memset(r->trigger_unique_id, 0xff, sizeof(r->trigger_unique_id));
@@ -1236,14 +1495,20 @@ void riscv_info_init(struct target *target, riscv_info_t *r)
 	for (size_t h = 0; h < RISCV_MAX_HARTS; ++h) {
 		r->xlen[h] = -1;
 		r->debug_buffer_addr[h] = -1;
-
-		for (size_t e = 0; e < RISCV_MAX_REGISTERS; ++e)
-			r->valid_saved_registers[h][e] = false;
 	}
 }
 
 int riscv_halt_all_harts(struct target *target)
 {
+	RISCV_INFO(r);
+
+	/* Halting all the harts with one request keeps them from drifting apart
+	 * while we go around them one at a time. */
+	uint32_t hart_mask = riscv_enabled_hart_mask(target);
+	if (r->halt_harts && (hart_mask & (hart_mask - 1)) &&
+			r->halt_harts(target, hart_mask) == ERROR_OK)
+		return ERROR_OK;
+
 	for (int i = 0; i < riscv_count_harts(target); ++i) {
 		if (!riscv_hart_enabled(target, i))
 			continue;
@@ -1270,6 +1535,39 @@ int riscv_halt_one_hart(struct target *target, int hartid)
 
 int riscv_resume_all_harts(struct target *target)
 {
+	RISCV_INFO(r);
+
+	uint32_t hart_mask = riscv_enabled_hart_mask(target);
+	if (r->resume_harts && (hart_mask & (hart_mask - 1))) {
+		/* Get every halted hart ready to go, and then let them all go with
+		 * one request. */
+		uint32_t halted_mask = 0;
+		int last_halted = -1;
+		for (int i = 0; i < riscv_count_harts(target); ++i) {
+			if (!(hart_mask & (1U << i)))
+				continue;
+
+			riscv_set_current_hartid(target, i);
+			if (!riscv_is_halted(target))
+				continue;
+
+			riscv_flush_registers(target, i);
+			r->on_resume(target);
+			halted_mask |= 1U << i;
+			last_halted = i;
+		}
+
+		/* The currently selected hart is always part of the request, so
+		 * make sure it's one that's actually going to resume. */
+		if (last_halted != -1)
+			riscv_set_current_hartid(target, last_halted);
+		int result = ERROR_OK;
+		if (halted_mask != 0)
+			result = r->resume_harts(target, halted_mask);
+		riscv_invalidate_register_cache(target);
+		return result;
+	}
+
 	for (int i = 0; i < riscv_count_harts(target); ++i) {
 		if (!riscv_hart_enabled(target, i))
 			continue;
@@ -1291,6 +1589,7 @@ int riscv_resume_one_hart(struct target *target, int hartid)
 		return ERROR_OK;
 	}
 
+	riscv_flush_registers(target, hartid);
 	r->on_resume(target);
 	r->resume_current_hart(target);
 	return ERROR_OK;
@@ -1311,10 +1610,10 @@ int riscv_step_rtos_hart(struct target *target)
 	LOG_DEBUG("stepping hart %d", hartid);
 
 	assert(riscv_is_halted(target));
-	riscv_invalidate_register_cache(target);
+	riscv_flush_registers(target, hartid);
 	r->on_step(target);
 	r->step_current_hart(target);
-	riscv_invalidate_register_cache(target);
+	riscv_invalidate_hart_register_cache(target, hartid);
 	r->on_halt(target);
 	assert(riscv_is_halted(target));
 	return ERROR_OK;
@@ -1354,41 +1653,27 @@ void riscv_set_current_hartid(struct target *target, int hartid)
 	if (!target_was_examined(target))
 		return;
 
-	/* Avoid invalidating the register cache all the time. */
-	if (r->registers_initialized
-			&& (!riscv_rtos_enabled(target) || (previous_hartid == hartid))
-			&& target->reg_cache->reg_list[GDB_REGNO_XPR0].size == (unsigned)riscv_xlen(target)
-			&& (!riscv_rtos_enabled(target) || (r->rtos_hartid != -1))) {
+	/* Every hart has its own register cache, so there's no need to throw
+	 * anything away when switching between them. */
+	struct reg_cache *cache = riscv_hart_reg_cache(target, hartid);
+	if (!cache)
 		return;
-	} else
-		LOG_DEBUG("Initializing registers: xlen=%d", riscv_xlen(target));
+	target->reg_cache = cache;
 
-	riscv_invalidate_register_cache(target);
+	if (cache->reg_list[GDB_REGNO_XPR0].size != (unsigned) riscv_xlen(target)) {
+		LOG_DEBUG("Initializing registers: xlen=%d", riscv_xlen(target));
+		riscv_invalidate_hart_register_cache(target, hartid);
+	}
 }
 
 void riscv_invalidate_register_cache(struct target *target)
 {
 	RISCV_INFO(r);
 
-	/* Update the register list's widths. */
-	register_cache_invalidate(target->reg_cache);
-	for (size_t i = 0; i < GDB_REGNO_COUNT; ++i) {
-		struct reg *reg = &target->reg_cache->reg_list[i];
-
-		reg->value = &r->reg_cache_values[i];
-		reg->valid = false;
-
-		switch (i) {
-		case GDB_REGNO_PRIV:
-			reg->size = 8;
-			break;
-		default:
-			reg->size = riscv_xlen(target);
-			break;
-		}
+	for (int h = 0; h < RISCV_MAX_HARTS; ++h) {
+		if (r->hart_reg_cache[h])
+			riscv_invalidate_hart_register_cache(target, h);
 	}
-
-	r->registers_initialized = true;
 }
 
 int riscv_current_hartid(const struct target *target)
@@ -1434,7 +1719,30 @@ void riscv_set_register_on_hart(struct target *target, int hartid,
 	RISCV_INFO(r);
 	LOG_DEBUG("[%d] %s <- %" PRIx64, hartid, gdb_regno_name(regid), value);
 	assert(r->set_register);
-	return r->set_register(target, hartid, regid, value);
+	r->set_register(target, hartid, regid, value);
+
+	struct reg *reg = riscv_cached_reg(target, hartid, regid);
+	if (reg) {
+		buf_set_u64(reg->value, 0, 64, value);
+		reg->valid = true;
+		reg->dirty = false;
+	}
+}
+
+void riscv_set_register_deferred(struct target *target, int hartid,
+		enum gdb_regno regid, uint64_t value)
+{
+	struct reg *reg = riscv_cached_reg(target, hartid, regid);
+	if (!reg) {
+		riscv_set_register_on_hart(target, hartid, regid, value);
+		return;
+	}
+
+	LOG_DEBUG("[%d] %s <- %" PRIx64 " (deferred)", hartid,
+			gdb_regno_name(regid), value);
+	buf_set_u64(reg->value, 0, 64, value);
+	reg->valid = true;
+	reg->dirty = true;
 }
 
 riscv_reg_t riscv_get_register(struct target *target, enum gdb_regno r)
@@ -1445,8 +1753,22 @@ riscv_reg_t riscv_get_register(struct target *target, enum gdb_regno r)
 uint64_t riscv_get_register_on_hart(struct target *target, int hartid, enum gdb_regno regid)
 {
 	RISCV_INFO(r);
+
+	struct reg *reg = riscv_cached_reg(target, hartid, regid);
+	if (reg && reg->valid) {
+		uint64_t value = buf_get_u64(reg->value, 0, 64);
+		LOG_DEBUG("[%d] %s: %" PRIx64 " (cached)", hartid,
+				gdb_regno_name(regid), value);
+		return value;
+	}
+
 	uint64_t value = r->get_register(target, hartid, regid);
 	LOG_DEBUG("[%d] %s: %" PRIx64, hartid, gdb_regno_name(regid), value);
+
+	if (reg) {
+		buf_set_u64(reg->value, 0, 64, value);
+		reg->valid = true;
+	}
 	return value;
 }
 
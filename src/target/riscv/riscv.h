@@ -7,9 +7,7 @@ struct riscv_program;
 #include "opcodes.h"
 #include "gdb_regs.h"
 
-/* The register cache is staticly allocated. */
 #define RISCV_MAX_HARTS 32
-#define RISCV_MAX_REGISTERS 5000
 #define RISCV_MAX_TRIGGERS 32
 #define RISCV_MAX_HWBPS 16
 
@@ -32,6 +30,12 @@ enum riscv_halt_reason {
 	RISCV_HALT_SINGLESTEP,
 };
 
+/* The arch_info of every register in the per-hart register caches. */
+struct riscv_reg_info {
+	struct target *target;
+	int hartid;
+};
+
 typedef struct {
 	unsigned dtm_version;
 
@@ -52,14 +56,11 @@ typedef struct {
 	 * every function than an actual */
 	int current_hartid;
 
-	/* Enough space to store all the registers we might need to save. */
-	/* FIXME: This should probably be a bunch of register caches. */
-	uint64_t saved_registers[RISCV_MAX_HARTS][RISCV_MAX_REGISTERS];
-	bool valid_saved_registers[RISCV_MAX_HARTS][RISCV_MAX_REGISTERS];
+	/* Every hart has its own register cache, which is created the first
+	 * time that hart is selected.  target->reg_cache points at the one that
+	 * belongs to current_hartid. */
+	struct reg_cache *hart_reg_cache[RISCV_MAX_HARTS];
 
-	/* The register cache points into here. */
-	uint64_t reg_cache_values[RISCV_MAX_REGISTERS];
-	
 	/* It's possible that each core has a different supported ISA set. */
 	int xlen[RISCV_MAX_HARTS];
 
@@ -78,9 +79,6 @@ typedef struct {
 	/* The number of entries in the debug buffer. */
 	int debug_buffer_size[RISCV_MAX_HARTS];
 
-	/* This avoids invalidating the register cache too often. */
-	bool registers_initialized;
-
 	/* Helper functions that target the various RISC-V debug spec
 	 * implementations. */
 	riscv_reg_t (*get_register)(struct target *, int hartid, int regid);
@@ -94,6 +92,15 @@ typedef struct {
 	void (*on_halt)(struct target *target);
 	void (*on_resume)(struct target *target);
 	void (*on_step)(struct target *target);
+	/* Optional.  Halt or resume all the harts in hart_mask (bit n is hart n)
+	 * with a single request.  Returns ERROR_FAIL if the debug module can't do
+	 * that, in which case the harts are handled one at a time. */
+	int (*halt_harts)(struct target *target, uint32_t hart_mask);
+	int (*resume_harts)(struct target *target, uint32_t hart_mask);
+	/* Optional.  Finds out whether any or all of the harts in hart_mask are
+	 * halted, without looking at each hart separately. */
+	int (*harts_halted)(struct target *target, uint32_t hart_mask,
+			bool *any_halted, bool *all_halted);
 	enum riscv_halt_reason (*halt_reason)(struct target *target);
 	void (*debug_buffer_enter)(struct target *target, struct riscv_program *program);
 	void (*debug_buffer_leave)(struct target *target, struct riscv_program *program);
@@ -200,6 +207,12 @@ void riscv_set_register_on_hart(struct target *target, int hid, enum gdb_regno r
 riscv_reg_t riscv_get_register(struct target *target, enum gdb_regno i);
 riscv_reg_t riscv_get_register_on_hart(struct target *target, int hid, enum gdb_regno rid);
 
+/* Sets the value of the given register in the register cache of the given
+ * hart.  The register is only written to the hart before it next runs.
+ * Registers that aren't cached are written immediately. */
+void riscv_set_register_deferred(struct target *target, int hid,
+		enum gdb_regno rid, uint64_t v);
+
 /* Checks the state of the current hart -- "is_halted" checks the actual
  * on-device register. */
 bool riscv_is_halted(struct target *target);
@@ -229,7 +242,11 @@ void riscv_fill_dmi_write_u64(struct target *target, char *buf, int a, uint64_t
 void riscv_fill_dmi_read_u64(struct target *target, char *buf, int a);
 int riscv_dmi_write_u64_bits(struct target *target);
 
-/* Invalidates the register cache. */
+/* Writes the deferred register writes of a halted hart to the hardware. */
+void riscv_flush_registers(struct target *target, int hartid);
+
+/* Invalidates the register caches of all harts, discarding any register
+ * writes that haven't been flushed yet. */
 void riscv_invalidate_register_cache(struct target *target);
 
 /* Returns TRUE when a hart is enabled in this target. */
@@ -60,6 +60,11 @@
 
 static int target_read_buffer_default(struct target *target, target_addr_t address,
 		uint32_t count, uint8_t *buffer);
+static int target_memory_batch_default(struct target *target,
+		const struct target_memory_request *requests, unsigned int count);
+static unsigned int target_split_buffer(target_addr_t address, uint32_t count,
+		uint8_t *buffer, const uint8_t *wbuffer,
+		struct target_memory_request *requests);
 static int target_write_buffer_default(struct target *target, target_addr_t address,
 		uint32_t count, const uint8_t *buffer);
 static int target_array2mem(Jim_Interp *interp, struct target *target,
@@ -71,9 +76,6 @@ static int target_get_gdb_fileio_info_default(struct target *target,
 		struct gdb_fileio_info *fileio_info);
 static int target_gdb_fileio_end_default(struct target *target, int retcode,
 		int fileio_errno, bool ctrl_c);
-static int target_profiling_default(struct target *target, uint32_t *samples,
-		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
-
 /* targets */
 extern struct target_type arm7tdmi_target;
 extern struct target_type arm720t_target;
@@ -898,6 +900,11 @@ done:
  * @param target used to run the algorithm
  */
 
+/* Give up on an async algorithm that does not consume fifo data for this long */
+#define ASYNC_ALGORITHM_TIMEOUT_MS	5000
+/* Upper bound for the pause between read pointer polls while the fifo is full */
+#define ASYNC_ALGORITHM_MAX_THROTTLE_MS	10
+
 int target_run_flash_async_algorithm(struct target *target,
 		const uint8_t *buffer, uint32_t count, int block_size,
 		int num_mem_params, struct mem_param *mem_params,
@@ -906,7 +913,6 @@ int target_run_flash_async_algorithm(struct target *target,
 		uint32_t entry_point, uint32_t exit_point, void *arch_info)
 {
 	int retval;
-	int timeout = 0;
 
 	const uint8_t *buffer_orig = buffer;
 
@@ -916,6 +922,7 @@ int target_run_flash_async_algorithm(struct target *target,
 	uint32_t rp_addr = buffer_start + 4;
 	uint32_t fifo_start_addr = buffer_start + 8;
 	uint32_t fifo_end_addr = buffer_start + buffer_size;
+	uint32_t fifo_size = fifo_end_addr - fifo_start_addr;
 
 	uint32_t wp = fifo_start_addr;
 	uint32_t rp = fifo_start_addr;
@@ -923,10 +930,11 @@ int target_run_flash_async_algorithm(struct target *target,
 	/* validate block_size is 2^n */
 	assert(!block_size || !(block_size & (block_size - 1)));
 
-	retval = target_write_u32(target, wp_addr, wp);
-	if (retval != ERROR_OK)
-		return retval;
-	retval = target_write_u32(target, rp_addr, rp);
+	/* Both pointers are adjacent, set them up in one go */
+	uint8_t pointers[8];
+	target_buffer_set_u32(target, pointers, wp);
+	target_buffer_set_u32(target, pointers + 4, rp);
+	retval = target_write_buffer(target, wp_addr, sizeof(pointers), pointers);
 	if (retval != ERROR_OK)
 		return retval;
 
@@ -942,13 +950,15 @@ int target_run_flash_async_algorithm(struct target *target,
 		return retval;
 	}
 
-	while (count > 0) {
+	/* Used to measure how fast the target drains the fifo */
+	int64_t start_ms = timeval_ms();
+	int64_t progress_ms = start_ms;
+	uint32_t last_rp = rp;
+	uint64_t total_written = 0;
 
-		retval = target_read_u32(target, rp_addr, &rp);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("failed to get read pointer");
-			break;
-		}
+	uint8_t wp_buf[4], rp_buf[4];
+
+	while (count > 0) {
 
 		LOG_DEBUG("offs 0x%zx count 0x%" PRIx32 " wp 0x%" PRIx32 " rp 0x%" PRIx32,
 			(size_t) (buffer - buffer_orig), count, wp, rp);
@@ -964,6 +974,12 @@ int target_run_flash_async_algorithm(struct target *target,
 			break;
 		}
 
+		int64_t now_ms = timeval_ms();
+		if (rp != last_rp) {
+			last_rp = rp;
+			progress_ms = now_ms;
+		}
+
 		/* Count the number of bytes available in the fifo without
 		 * crossing the wrap around. Make sure to not fill it completely,
 		 * because that would make wp == rp and that's the empty condition. */
@@ -976,44 +992,80 @@ int target_run_flash_async_algorithm(struct target *target,
 			thisrun_bytes = fifo_end_addr - wp - block_size;
 
 		if (thisrun_bytes == 0) {
-			/* Throttle polling a bit if transfer is (much) faster than flash
-			 * programming. The exact delay shouldn't matter as long as it's
-			 * less than buffer size / flash speed. This is very unlikely to
-			 * run when using high latency connections such as USB. */
-			alive_sleep(10);
-
-			/* to stop an infinite loop on some targets check and increment a timeout
+			/* to stop an infinite loop on some targets check for a timeout
 			 * this issue was observed on a stellaris using the new ICDI interface */
-			if (timeout++ >= 500) {
+			if (now_ms - progress_ms >= ASYNC_ALGORITHM_TIMEOUT_MS) {
 				LOG_ERROR("timeout waiting for algorithm, a target reset is recommended");
 				return ERROR_FLASH_OPERATION_FAILED;
 			}
+
+			/* Throttle polling if transfer is faster than flash programming:
+			 * wait about as long as the flash needs, at the rate measured so
+			 * far, to free a quarter of the fifo. This is very unlikely to
+			 * run when using high latency connections such as USB. */
+			uint32_t used = (wp - rp + fifo_size) % fifo_size;
+			uint64_t drained = total_written - used;
+			int64_t elapsed_ms = now_ms - start_ms;
+			int64_t delay_ms = ASYNC_ALGORITHM_MAX_THROTTLE_MS;
+			if (drained > 0 && elapsed_ms > 0)
+				delay_ms = (fifo_size / 4) * elapsed_ms / drained;
+			if (delay_ms > ASYNC_ALGORITHM_MAX_THROTTLE_MS)
+				delay_ms = ASYNC_ALGORITHM_MAX_THROTTLE_MS;
+			if (delay_ms > 0)
+				alive_sleep(delay_ms);
+
+			retval = target_read_u32(target, rp_addr, &rp);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("failed to get read pointer");
+				break;
+			}
 			continue;
 		}
 
-		/* reset our timeout */
-		timeout = 0;
-
 		/* Limit to the amount of data we actually want to write */
 		if (thisrun_bytes > count * block_size)
 			thisrun_bytes = count * block_size;
 
-		/* Write data to fifo */
-		retval = target_write_buffer(target, wp, thisrun_bytes, buffer);
-		if (retval != ERROR_OK)
+		/* Next value of the write pointer, wrapped */
+		uint32_t next_wp = wp + thisrun_bytes;
+		if (next_wp >= fifo_end_addr)
+			next_wp = fifo_start_addr;
+		target_buffer_set_u32(target, wp_buf, next_wp);
+
+		/* Queue the fifo data, the updated write pointer and the poll of
+		 * the read pointer as one transaction.  Targets with their own
+		 * write_buffer get the fifo data through it instead. */
+		struct target_memory_request requests[7];
+		unsigned int num_requests = 0;
+		if (target->type->write_buffer == target_write_buffer_default) {
+			num_requests = target_split_buffer(wp, thisrun_bytes,
+					NULL, buffer, requests);
+		} else {
+			retval = target_write_buffer(target, wp, thisrun_bytes, buffer);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("failed to write fifo data");
+				break;
+			}
+		}
+		requests[num_requests++] = (struct target_memory_request) {
+			.address = wp_addr, .size = 4, .count = 1, .wbuffer = wp_buf
+		};
+		requests[num_requests++] = (struct target_memory_request) {
+			.address = rp_addr, .size = 4, .count = 1, .buffer = rp_buf
+		};
+
+		retval = target_memory_batch(target, requests, num_requests);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("failed to write fifo data");
 			break;
+		}
 
-		/* Update counters and wrap write pointer */
+		/* Update counters and write pointer */
 		buffer += thisrun_bytes;
 		count -= thisrun_bytes / block_size;
-		wp += thisrun_bytes;
-		if (wp >= fifo_end_addr)
-			wp = fifo_start_addr;
-
-		/* Store updated write pointer to target */
-		retval = target_write_u32(target, wp_addr, wp);
-		if (retval != ERROR_OK)
-			break;
+		total_written += thisrun_bytes;
+		wp = next_wp;
+		rp = target_buffer_get_u32(target, rp_buf);
 	}
 
 	if (retval != ERROR_OK) {
@@ -1058,6 +1110,16 @@ int target_read_memory(struct target *target,
 	return target->type->read_memory(target, address, size, count, buffer);
 }
 
+int target_memory_batch(struct target *target,
+		const struct target_memory_request *requests, unsigned int count)
+{
+	if (!target_was_examined(target)) {
+		LOG_ERROR("Target not examined yet");
+		return ERROR_FAIL;
+	}
+	return target->type->memory_batch(target, requests, count);
+}
+
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
@@ -1297,6 +1359,9 @@ static int target_init_one(struct command_context *cmd_ctx,
 	if (target->type->read_buffer == NULL)
 		target->type->read_buffer = target_read_buffer_default;
 
+	if (target->type->memory_batch == NULL)
+		target->type->memory_batch = target_memory_batch_default;
+
 	if (target->type->write_buffer == NULL)
 		target->type->write_buffer = target_write_buffer_default;
 
@@ -1672,6 +1737,33 @@ int target_call_timer_callbacks_now(void)
 	return target_call_timer_callbacks_check_time(0);
 }
 
+/**
+ * Return the number of milliseconds until the next timer callback is due,
+ * clamped to @a max_ms. Returns 0 if a callback is already overdue and
+ * @a max_ms if no callbacks are registered.
+ */
+int target_timer_next_event(int max_ms)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	int64_t next = max_ms;
+	for (struct target_timer_callback *c = target_timer_callbacks; c; c = c->next) {
+		if (c->removed || !c->callback)
+			continue;
+		int64_t delta_us = ((int64_t)c->when.tv_sec - now.tv_sec) * 1000000 +
+			((int64_t)c->when.tv_usec - now.tv_usec);
+		if (delta_us <= 0)
+			return 0;
+		/* round up, a wait shorter than the deadline would just spin */
+		int64_t delta = (delta_us + 999) / 1000;
+		if (delta < next)
+			next = delta;
+	}
+
+	return next;
+}
+
 /* Prints the working area layout for debug purposes */
 static void print_wa_layout(struct target *target)
 {
@@ -2030,7 +2122,7 @@ static int target_gdb_fileio_end_default(struct target *target,
 	return ERROR_OK;
 }
 
-static int target_profiling_default(struct target *target, uint32_t *samples,
+int target_profiling_default(struct target *target, uint32_t *samples,
 		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
 {
 	struct timeval timeout, now;
@@ -2169,37 +2261,79 @@ int target_read_buffer(struct target *target, target_addr_t address, uint32_t si
 	return target->type->read_buffer(target, address, size, buffer);
 }
 
-static int target_read_buffer_default(struct target *target, target_addr_t address, uint32_t count, uint8_t *buffer)
+static int target_memory_batch_default(struct target *target,
+		const struct target_memory_request *requests, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		int retval;
+		if (requests[i].wbuffer)
+			retval = target_write_memory(target, requests[i].address,
+					requests[i].size, requests[i].count, requests[i].wbuffer);
+		else
+			retval = target_read_memory(target, requests[i].address,
+					requests[i].size, requests[i].count, requests[i].buffer);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
+/* Split a buffer transfer into at most five pieces: unaligned head bytes and
+ * halfword, then the rest with as large access size as possible.  Reads go
+ * to @a buffer, or if @a wbuffer is set the pieces write from it instead. */
+static unsigned int target_split_buffer(target_addr_t address, uint32_t count,
+		uint8_t *buffer, const uint8_t *wbuffer,
+		struct target_memory_request *requests)
 {
+	unsigned int num_requests = 0;
 	uint32_t size;
 
 	/* Align up to maximum 4 bytes. The loop condition makes sure the next pass
 	 * will have something to do with the size we leave to it. */
 	for (size = 1; size < 4 && count >= size * 2 + (address & size); size *= 2) {
 		if (address & size) {
-			int retval = target_read_memory(target, address, size, 1, buffer);
-			if (retval != ERROR_OK)
-				return retval;
+			requests[num_requests++] = (struct target_memory_request) {
+				.address = address, .size = size, .count = 1,
+				.buffer = buffer, .wbuffer = wbuffer
+			};
 			address += size;
 			count -= size;
-			buffer += size;
+			if (wbuffer)
+				wbuffer += size;
+			else
+				buffer += size;
 		}
 	}
 
-	/* Read the data with as large access size as possible. */
+	/* Transfer the data with as large access size as possible. */
 	for (; size > 0; size /= 2) {
 		uint32_t aligned = count - count % size;
 		if (aligned > 0) {
-			int retval = target_read_memory(target, address, size, aligned / size, buffer);
-			if (retval != ERROR_OK)
-				return retval;
+			requests[num_requests++] = (struct target_memory_request) {
+				.address = address, .size = size, .count = aligned / size,
+				.buffer = buffer, .wbuffer = wbuffer
+			};
 			address += aligned;
 			count -= aligned;
-			buffer += aligned;
+			if (wbuffer)
+				wbuffer += aligned;
+			else
+				buffer += aligned;
 		}
 	}
 
-	return ERROR_OK;
+	return num_requests;
+}
+
+static int target_read_buffer_default(struct target *target, target_addr_t address, uint32_t count, uint8_t *buffer)
+{
+	struct target_memory_request requests[5];
+	unsigned int num_requests = target_split_buffer(address, count, buffer,
+			NULL, requests);
+
+	/* all pieces go out together */
+	return target_memory_batch(target, requests, num_requests);
 }
 
 int target_checksum_memory(struct target *target, target_addr_t address, uint32_t size, uint32_t* crc)
@@ -3358,19 +3492,26 @@ COMMAND_HANDLER(handle_load_image_command)
 	image_size = 0x0;
 	retval = ERROR_OK;
 	for (i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
+		/* use the image data in place if possible, e.g. a mapped file */
+		bool buffer_owned = false;
+		buffer = image_section_data(&image, i, 0x0, image.sections[i].size);
+		buf_cnt = image.sections[i].size;
 		if (buffer == NULL) {
-			command_print(CMD_CTX,
-						  "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
-			retval = ERROR_FAIL;
-			break;
-		}
+			buffer_owned = true;
+			buffer = malloc(image.sections[i].size);
+			if (buffer == NULL) {
+				command_print(CMD_CTX,
+							  "error allocating buffer for section (%d bytes)",
+							  (int)(image.sections[i].size));
+				retval = ERROR_FAIL;
+				break;
+			}
 
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
-			break;
+			retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
+			if (retval != ERROR_OK) {
+				free(buffer);
+				break;
+			}
 		}
 
 		uint32_t offset = 0;
@@ -3393,7 +3534,8 @@ COMMAND_HANDLER(handle_load_image_command)
 			retval = target_write_buffer(target,
 					image.sections[i].base_address + offset, length, buffer + offset);
 			if (retval != ERROR_OK) {
-				free(buffer);
+				if (buffer_owned)
+					free(buffer);
 				break;
 			}
 			image_size += length;
@@ -3402,7 +3544,8 @@ COMMAND_HANDLER(handle_load_image_command)
 					image.sections[i].base_address + offset);
 		}
 
-		free(buffer);
+		if (buffer_owned)
+			free(buffer);
 	}
 
 	if ((ERROR_OK == retval) && (duration_measure(&bench) == ERROR_OK)) {
@@ -4009,7 +4152,8 @@ COMMAND_HANDLER(handle_profile_command)
 	if ((CMD_ARGC != 2) && (CMD_ARGC != 4))
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	const uint32_t MAX_PROFILE_SAMPLE_NUM = 10000;
+	/* large enough for a few minutes of hardware PC sampling */
+	const uint32_t MAX_PROFILE_SAMPLE_NUM = 1000000;
 	uint32_t offset;
 	uint32_t num_of_samples;
 	int retval = ERROR_OK;
@@ -4214,7 +4358,9 @@ static int target_mem2array(Jim_Interp *interp, struct target *target, int argc,
 	/* index counter */
 	n = 0;
 
-	size_t buffersize = 4096;
+	/* len is limited to 65536 above, so read everything in a single
+	 * transfer rather than paying one adapter round trip per chunk */
+	size_t buffersize = len * width;
 	uint8_t *buffer = malloc(buffersize);
 	if (buffer == NULL)
 		return JIM_ERR;
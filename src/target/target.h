@@ -101,6 +101,19 @@ struct working_area {
 	struct working_area *next;
 };
 
+/**
+ * One piece of a scatter/gather memory transfer, see target_memory_batch().
+ * Writes @a count items of @a size bytes at @a address from @a wbuffer if
+ * it is set, otherwise reads them into @a buffer.
+ */
+struct target_memory_request {
+	target_addr_t address;
+	uint32_t size;
+	uint32_t count;
+	uint8_t *buffer;
+	const uint8_t *wbuffer;
+};
+
 struct gdb_service {
 	struct target *target;
 	/*  field for smp display  */
@@ -108,6 +121,8 @@ struct gdb_service {
 	/*  element 1 coreid to be displayed at next resume 1 till n 0 means resume
 	 *  all cores core displayed  */
 	int32_t core[2];
+	/* size of the packet buffers of each connection to this service */
+	unsigned buffer_size;
 };
 
 /* target back off timer */
@@ -378,6 +393,11 @@ int target_call_timer_callbacks(void);
  * a synchronous command completes.
  */
 int target_call_timer_callbacks_now(void);
+/**
+ * Milliseconds until the next registered timer callback is due,
+ * at most @a max_ms.
+ */
+int target_timer_next_event(int max_ms);
 
 struct target *get_target_by_num(int num);
 struct target *get_current_target(struct command_context *cmd_ctx);
@@ -535,6 +555,16 @@ int target_read_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
 int target_read_phys_memory(struct target *target,
 		target_addr_t address, uint32_t size, uint32_t count, uint8_t *buffer);
+/**
+ * Read and/or write several memory regions, possibly with different access
+ * sizes. The requests are carried out in order. Targets that support it
+ * queue all of them and run the queue once, so the pieces share a single
+ * adapter round trip.
+ *
+ * This routine is a wrapper for target->type->memory_batch.
+ */
+int target_memory_batch(struct target *target,
+		const struct target_memory_request *requests, unsigned int count);
 /**
  * Write @a count items of @a size bytes to the memory of @a target at
  * the @a address given. @a address must be aligned to @a size
@@ -605,6 +635,15 @@ int target_get_gdb_fileio_info(struct target *target, struct gdb_fileio_info *fi
  */
 int target_gdb_fileio_end(struct target *target, int retcode, int fileio_errno, bool ctrl_c);
 
+/**
+ * Sample the PC by repeatedly halting and resuming the target.
+ *
+ * Used for targets without a profiling method, and as the fallback for
+ * cores whose hardware PC sampling is not implemented.
+ */
+int target_profiling_default(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
+
 
 
 /** Return the *name* of this targets current state */
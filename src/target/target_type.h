@@ -113,6 +113,14 @@ struct target_type {
 	 */
 	int (*read_memory)(struct target *target, target_addr_t address,
 			uint32_t size, uint32_t count, uint8_t *buffer);
+	/**
+	 * Read and/or write several, not necessarily contiguous, memory
+	 * regions in one go. Do @b not call this method directly, use
+	 * target_memory_batch() instead. Optional, the default issues
+	 * one read_memory or write_memory call per request.
+	 */
+	int (*memory_batch)(struct target *target,
+			const struct target_memory_request *requests, unsigned int count);
 	/**
 	 * Target memory write callback.  Do @b not call this function
 	 * directly, use target_write_memory() instead.